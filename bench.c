@@ -0,0 +1,545 @@
+/* elfin's benchmarks, run by make bench. files of 1k up to 10M lines are *
+ * generated, short lines and very long ones, and two things are timed *
+ * against each: the core operations (editor.c, command.c and the undo log, *
+ * search and save around them) driven directly, then scripts of keys *
+ * replayed through elfin.c itself, just as if they'd been typed, with a *
+ * frame drawn after each. results go to stdout as JSON, ns and *
+ * allocations per operation, so two builds can be compared */
+
+#include "command.h"
+#include "display.h"
+#include "editor.h"
+#include "save.h"
+#include "search.h"
+#include "undo.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __APPLE__
+#include <malloc/malloc.h>
+#endif
+
+// the most lines a file gets, unless given on the command line
+#define BENCH_MAX_LINES 10000000
+// lines of the files with very long ones, and how long they are
+#define LONG_LINES 1000
+#define LONG_LEN (16 << 10)
+// edits made of each kind, fewer where the file's too small for them
+#define BENCH_EDITS 10000
+#define BENCH_RANGES 1000
+// rows in a paste
+#define PASTE_ROWS 20
+// the terminal the keys are replayed in
+#define BENCH_ROWS 50
+#define BENCH_COLS 200
+// how long the editor waits for another key before a script's taken as over
+#define IDLE_MS 500
+
+// from elfin.c, which has no header of its own
+extern struct editorInterface *I;
+void init_I(char *filename);
+void destroy_I(void);
+int countDigits(int n);
+int readKey(int timeout);
+void editorProcessKey(int c);
+
+/* ======= ALLOCATIONS ======= */
+/* every malloc, calloc and realloc in the process is counted, the editor's *
+ * threads' too, by standing in for the allocator's own: glibc's under its *
+ * other names, the default zone's on macOS (where the system libraries' *
+ * own allocations go around these, so aren't counted). anywhere else *
+ * nothing's counted and allocations come out as null */
+static long allocs;
+
+#define COUNT_ALLOC() __atomic_fetch_add(&allocs, 1, __ATOMIC_RELAXED)
+
+#if defined(__GLIBC__)
+#define COUNTS_ALLOCS 1
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t n, size_t size);
+void *__libc_realloc(void *p, size_t size);
+void __libc_free(void *p);
+
+void *malloc(size_t size) {
+    COUNT_ALLOC();
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size) {
+    COUNT_ALLOC();
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *p, size_t size) {
+    COUNT_ALLOC();
+    return __libc_realloc(p, size);
+}
+
+void free(void *p) { __libc_free(p); }
+#elif defined(__APPLE__)
+#define COUNTS_ALLOCS 1
+// the zone p came from, the system libraries' allocations included
+static malloc_zone_t *zoneOf(void *p) {
+    malloc_zone_t *zone = malloc_zone_from_ptr(p);
+    return zone ? zone : malloc_default_zone();
+}
+
+void *malloc(size_t size) {
+    COUNT_ALLOC();
+    return malloc_zone_malloc(malloc_default_zone(), size);
+}
+
+void *calloc(size_t n, size_t size) {
+    COUNT_ALLOC();
+    return malloc_zone_calloc(malloc_default_zone(), n, size);
+}
+
+void *realloc(void *p, size_t size) {
+    COUNT_ALLOC();
+    if (p == NULL)
+        return malloc_zone_malloc(malloc_default_zone(), size);
+    return malloc_zone_realloc(zoneOf(p), p, size);
+}
+
+void free(void *p) {
+    if (p) {
+        malloc_zone_free(zoneOf(p), p);
+    }
+}
+#else
+#define COUNTS_ALLOCS 0
+#endif
+
+#ifdef __OPTIMIZE__
+#define OPTIMIZED "true"
+#else
+#define OPTIMIZED "false"
+#endif
+
+static long allocCount(void) {
+    return __atomic_load_n(&allocs, __ATOMIC_RELAXED);
+}
+
+/* ======= RESULTS ======= */
+struct file {
+    char *path;
+    char *name; // what it's called in the results
+    long lines;
+    long long bytes;
+};
+
+// when something being timed started, or how long it took
+struct timer {
+    long long ns;
+    long allocs;
+};
+
+static long long nowNs(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+static void startTimer(struct timer *t) {
+    t->allocs = allocCount();
+    t->ns = nowNs();
+}
+
+// the time and allocations since t started
+static struct timer since(struct timer *t) {
+    return (struct timer){nowNs() - t->ns, allocCount() - t->allocs};
+}
+
+static int numresults;
+
+/* one result, ops of op done against f taking took. script is the keys *
+ * replayed, NULL for the core operations */
+static void report(struct timer took, struct file *f, const char *op,
+                   const char *script, long ops) {
+    printf("%s\n    {\"file\": \"%s\", \"lines\": %ld, \"bytes\": %lld, ",
+           numresults++ ? "," : "", f->name, f->lines, f->bytes);
+    printf("\"op\": \"%s\", ", op);
+    if (script) {
+        printf("\"script\": \"%s\", ", script);
+    }
+    ops = ops > 0 ? ops : 1;
+    printf("\"ops\": %ld, \"ns_per_op\": %.1f, \"allocs_per_op\": ", ops,
+           (double)took.ns / ops);
+    if (COUNTS_ALLOCS) {
+        printf("%.2f}", (double)took.allocs / ops);
+    } else {
+        printf("null}");
+    }
+    fflush(stdout);
+}
+
+/* ======= FILES ======= */
+static uint64_t seed = 88172645463325252ULL;
+
+// xorshift, so every run edits the same places
+static uint64_t rnd(void) {
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    return seed;
+}
+
+static const char *words[] = {
+    "the",   "quick", "brown", "fox",    "jumps", "over", "lazy", "dog",
+    "elfin", "row",   "block", "editor", "undo",  "line", "text", "paste",
+};
+
+/* random words up to about len bytes, with "needle" one time in a *
+ * thousand for the searches to find */
+static void putWords(FILE *fp, long len) {
+    long n = 0;
+    while (n < len) {
+        const char *w = rnd() % 1000 == 0 ? "needle" : words[rnd() % 16];
+        n += fprintf(fp, n ? " %s" : "%s", w);
+    }
+    fputc('\n', fp);
+}
+
+static void makeFile(struct file *f, char *dir, char *name, long lines,
+                     long len) {
+    f->name = strdup(name);
+    f->path = malloc(strlen(dir) + strlen(name) + 2);
+    sprintf(f->path, "%s/%s", dir, name);
+    f->lines = lines;
+    FILE *fp = fopen(f->path, "w");
+    if (fp == NULL) {
+        perror(f->path);
+        exit(1);
+    }
+    for (long i = 0; i < lines; i++) {
+        putWords(fp, rnd() % (2 * len));
+    }
+    f->bytes = ftell(fp);
+    fclose(fp);
+}
+
+static void freeFile(struct file *f) {
+    free(f->path);
+    free(f->name);
+}
+
+// the directory, and everything in it
+static void removeDir(char *dir) {
+    DIR *d = opendir(dir);
+    struct dirent *ent;
+    char path[4096];
+    while (d && (ent = readdir(d))) {
+        if (strcmp(ent->d_name, ".") && strcmp(ent->d_name, "..") &&
+            snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name) <
+                (int)sizeof(path)) {
+            unlink(path);
+        }
+    }
+    if (d) {
+        closedir(d);
+    }
+    rmdir(dir);
+}
+
+/* ======= CORE OPERATIONS ======= */
+// somewhere in the buffer, rows [0, numrows - below)
+static point randomPoint(struct editor *E, int below) {
+    point p;
+    p.r = rnd() % max(1, E->numrows - below);
+    p.c = rnd() % (getRow(E, p.r)->len + 1);
+    return p;
+}
+
+static void runCommand(struct editor *E, struct undoLog *log,
+                       struct command *cmd) {
+    doCommand(E, cmd);
+    recordCommand(log, cmd);
+    sealUndo(log);
+}
+
+static void benchCore(struct file *f, char *dir) {
+    struct timer t;
+    startTimer(&t);
+    struct editor *E = editorFromFile(f->path);
+    finishLoad(E);
+    report(since(&t), f, "load", NULL, 1);
+
+    struct undoLog log;
+    initUndo(&log);
+    int edits = min(BENCH_EDITS, f->lines);
+    int ranges = min(BENCH_RANGES, f->lines / 8);
+    int done = 0;
+
+    struct erow typed = {1, 0, "x"};
+    struct erow *typedRows[] = {&typed};
+    startTimer(&t);
+    for (int i = 0; i < edits; i++) {
+        struct command cmd = {randomPoint(E, 0), typedRows, 1, ADD};
+        runCommand(E, &log, &cmd);
+    }
+    report(since(&t), f, "insert", NULL, edits);
+    done += edits;
+
+    startTimer(&t);
+    for (int i = 0; i < edits; i++) {
+        struct command cmd = {randomPoint(E, 0), NULL, 0, NEWROW};
+        runCommand(E, &log, &cmd);
+    }
+    report(since(&t), f, "newline", NULL, edits);
+    done += edits;
+
+    // three rows at a time, from partway into the first to into the last
+    startTimer(&t);
+    for (int i = 0; i < ranges; i++) {
+        point start = randomPoint(E, 2);
+        point end = {start.r + 2, 0};
+        end.c = max(0, getRow(E, end.r)->len - 1);
+        end.c = rnd() % (end.c + 1);
+        struct command cmd = {start, copyRange(E, start, end), 3, DELETE};
+        runCommand(E, &log, &cmd);
+        freeRowarr(cmd.rows, cmd.numrows);
+        free(cmd.rows);
+    }
+    report(since(&t), f, "delete_range", NULL, ranges);
+    done += ranges;
+
+    char *line = "the quick brown fox jumps over the lazy dog";
+    struct erow pasted = {strlen(line), 0, line};
+    struct erow *pastedRows[PASTE_ROWS];
+    for (int i = 0; i < PASTE_ROWS; i++) {
+        pastedRows[i] = &pasted;
+    }
+    startTimer(&t);
+    for (int i = 0; i < ranges; i++) {
+        struct command cmd = {randomPoint(E, 0), pastedRows, PASTE_ROWS, ADD};
+        runCommand(E, &log, &cmd);
+    }
+    report(since(&t), f, "paste", NULL, ranges);
+    done += ranges;
+
+    point cursor;
+    int undone = 0;
+    startTimer(&t);
+    while (undone < done && undoLast(&log, E, &cursor)) {
+        undone++;
+    }
+    report(since(&t), f, "undo", NULL, undone);
+
+    // the index takes each needle over, freeMatches frees it with the index
+    startTimer(&t);
+    struct matchIndex *m = indexMatches(E, compileNeedle("needle", 6, false));
+    freeMatches(m);
+    report(since(&t), f, "search", NULL, 1);
+
+    const char *error;
+    startTimer(&t);
+    m = indexMatches(E, regexNeedle("ne+dle|fox j", 12, false, &error));
+    freeMatches(m);
+    report(since(&t), f, "search_regex", NULL, 1);
+
+    char *saved = malloc(strlen(dir) + 8);
+    sprintf(saved, "%s/saved", dir);
+    startTimer(&t);
+    struct saveResult res = editorSaveFile(E, saved);
+    report(since(&t), f, "save", NULL, 1);
+    if (res.error) {
+        fprintf(stderr, "bench: %s %s: %s\n", res.step, saved,
+                strerror(res.error));
+    }
+    unlink(saved);
+    free(saved);
+
+    freeUndo(&log);
+    destroyEditor(&E);
+}
+
+/* ======= KEYSTROKE REPLAY ======= */
+/* the editor reads its keys from stdin and draws to it, so for a replay *
+ * stdin is one end of a socket pair. on the other end this thread feeds *
+ * it the script and throws away what's drawn, until the editor's end is *
+ * closed */
+struct feeder {
+    int fd;
+    char *keys;
+    size_t len;
+    long long drawn; // bytes
+};
+
+static void *feed(void *arg) {
+    struct feeder *f = arg;
+    fcntl(f->fd, F_SETFL, O_NONBLOCK);
+    size_t sent = 0;
+    char buf[1 << 16];
+    while (true) {
+        struct pollfd pfd = {f->fd, POLLIN | (sent < f->len ? POLLOUT : 0), 0};
+        if (poll(&pfd, 1, -1) == -1)
+            continue;
+        if (pfd.revents & POLLOUT) {
+            ssize_t n = write(f->fd, f->keys + sent, f->len - sent);
+            sent += n > 0 ? n : 0;
+        }
+        if (pfd.revents & (POLLIN | POLLHUP | POLLERR)) {
+            ssize_t n = read(f->fd, buf, sizeof(buf));
+            if (n == 0 || (n == -1 && !(pfd.revents & POLLIN)))
+                break;
+            f->drawn += n > 0 ? n : 0;
+        }
+    }
+    close(f->fd);
+    return NULL;
+}
+
+// what elfin's main loop does for a frame, once the keys are taken
+static void drawFrame(void) {
+    I->coloff = max(4, countDigits(I->E->numrows) + 2);
+    refreshScreen();
+    trimBlocks(I->E, I->toprow, I->ws.ws_row);
+}
+
+// a script: keys, more than once over
+struct script {
+    const char *name;
+    const char *keys; // ESC never last, or it would wait to see what's next
+    int times;
+};
+
+static const struct script scripts[] = {
+    // a paragraph typed at the top, with the odd mistake fixed
+    {"typing",
+     "ithe quick brown fox jumps ovr\x7f\x7f\x7fover the lazy dog\r"
+     "elfin edits text one row block at a time\x7f\x7f\x7f\x7f\x7ftime\r"
+     "\x1b" "0",
+     10},
+    // up and down the file, across rows, to the ends and back
+    {"motion",
+     "jjjjjjjjjjllllllllllkkkkkhhhhh$0\x1b[B\x1b[B\x1b[C\x1b[A\x1b[D"
+     "jjjjjjjjjjjjjjjjjjjjjjjjjjjjjjjjjjjjjjjjjjjjjjjjjjjjGgg",
+     20},
+    // lines opened and typed, undone and redone
+    {"lines",
+     "oa new line of text\x1bjjjOand one above it\x1bjjjuuu\x12\x12\x12", 10},
+    // a search, then through the matches both ways
+    {"search",
+     "/needle\rnnnnnnnnnnnnnnnnnnnnNNNNNNNNNN/\\vne+dle|fox j\rnnnnnnnnnN",
+     5},
+    // rows cut, copied and pasted back
+    {"cut_paste", "vjjdpjjvjjyjjpkkpuujjjj", 10},
+};
+
+#define NUMSCRIPTS (int)(sizeof(scripts) / sizeof(scripts[0]))
+
+/* replay a script against a link to the file, so the journal each replay *
+ * leaves has a name of its own */
+static void replay(struct file *f, char *dir, const struct script *s) {
+    char *path = malloc(strlen(dir) + strlen(f->name) + strlen(s->name) + 8);
+    sprintf(path, "%s/%s.%s", dir, f->name, s->name);
+    if (link(f->path, path) == -1) {
+        perror(path);
+        exit(1);
+    }
+    size_t keylen = strlen(s->keys);
+    struct feeder feeder = {-1, malloc(keylen * s->times), keylen * s->times,
+                            0};
+    for (int i = 0; i < s->times; i++) {
+        memcpy(feeder.keys + i * keylen, s->keys, keylen);
+    }
+
+    int pair[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) == -1) {
+        perror("socketpair");
+        exit(1);
+    }
+    dup2(pair[0], STDIN_FILENO);
+    close(pair[0]);
+    feeder.fd = pair[1];
+    pthread_t thread;
+    pthread_create(&thread, NULL, feed, &feeder);
+
+    init_I(path);
+    finishLoad(I->E);
+    I->ws.ws_row = BENCH_ROWS;
+    I->ws.ws_col = BENCH_COLS;
+    resizeScreen(&I->screen, I->ws.ws_row, I->ws.ws_col);
+    drawFrame();
+
+    // timed up to the last key's frame, not the wait for another
+    struct timer t;
+    struct timer took = {0, 0};
+    long keys = 0;
+    int c;
+    startTimer(&t);
+    // readKey gives 0 (KEY_NULL) once none come
+    while (I->mode != QUIT && (c = readKey(IDLE_MS)) != 0) {
+        editorProcessKey(c);
+        drawFrame();
+        keys++;
+        took = since(&t);
+    }
+    report(took, f, "replay", s->name, keys);
+
+    int null = open("/dev/null", O_RDWR);
+    dup2(null, STDIN_FILENO); // which the feeder sees as the end
+    close(null);
+    pthread_join(thread, NULL);
+    destroy_I();
+    I = NULL;
+    free(feeder.keys);
+    free(path);
+}
+
+/* ======= MAIN ======= */
+int main(int argc, char *argv[]) {
+    long maxlines = argc > 1 ? atol(argv[1]) : BENCH_MAX_LINES;
+    if (argc > 2 || maxlines < 1000) {
+        fprintf(stderr, "USAGE: elfin_bench [max lines, 1000 or more]\n");
+        return 1;
+    }
+    const char *tmp = getenv("TMPDIR");
+    char dir[4096];
+    snprintf(dir, sizeof(dir), "%s/elfin-bench.XXXXXX", tmp ? tmp : "/tmp");
+    if (mkdtemp(dir) == NULL) {
+        perror(dir);
+        return 1;
+    }
+
+    printf("{\"compiler\": \"%s\", \"optimized\": %s, \"counts_allocs\": %s,"
+           " \"max_lines\": %ld, \"results\": [",
+           __VERSION__, OPTIMIZED,
+           COUNTS_ALLOCS ? "true" : "false", maxlines);
+    struct file f;
+    char name[64];
+    long replayed = 0; // the largest file made up to 100000 lines
+    for (long lines = 1000; lines <= min(100000, maxlines); lines *= 10) {
+        replayed = lines;
+    }
+    for (long lines = 1000; lines <= maxlines; lines *= 10) {
+        snprintf(name, sizeof(name), "short-%ld", lines);
+        makeFile(&f, dir, name, lines, 32);
+        benchCore(&f, dir);
+        for (int i = 0; lines == replayed && i < NUMSCRIPTS; i++) {
+            replay(&f, dir, &scripts[i]);
+        }
+        unlink(f.path);
+        freeFile(&f);
+    }
+    snprintf(name, sizeof(name), "long-%d", LONG_LINES);
+    makeFile(&f, dir, name, LONG_LINES, LONG_LEN);
+    benchCore(&f, dir);
+    for (int i = 0; i < NUMSCRIPTS; i++) {
+        replay(&f, dir, &scripts[i]);
+    }
+    freeFile(&f);
+    printf("\n]}\n");
+    removeDir(dir);
+    return 0;
+}
@@ -1,11 +1,11 @@
 #include "command.h"
 
 #include <assert.h>
-#include <stdlib.h>
 
 void doCommand(struct editor *E, struct command *cmd) {
     if (cmd->type == ADD) {
         insertRange(E, cmd->at, cmd->rows, cmd->numrows);
+        notifyEdit(E, cmd->at.r, 1, cmd->numrows);
     } else if (cmd->type == DELETE) {
         int last_c = cmd->rows[cmd->numrows - 1]->len - 1;
         if (cmd->numrows == 1) {
@@ -13,15 +13,18 @@ void doCommand(struct editor *E, struct command *cmd) {
         }
         point end = {cmd->numrows - 1 + cmd->at.r, last_c};
         deleteRange(E, cmd->at, end);
+        notifyEdit(E, cmd->at.r, cmd->numrows, 1);
     } else if (cmd->type == NEWROW) {
         insertNewline(E, cmd->at.r, cmd->at.c);
+        notifyEdit(E, cmd->at.r, 1, 2);
     } else if (cmd->type == DELROW) {
         assert(cmd->at.r > 0);
-        struct erow *above = E->rowarray[cmd->at.r - 1];
-        struct erow *at = E->rowarray[cmd->at.r];
+        struct erow *above = getRow(E, cmd->at.r - 1);
+        struct erow *at = getRow(E, cmd->at.r);
 
         insertString(above, above->len, at->text, at->len);
         deleteRow(E, cmd->at.r);
+        notifyEdit(E, cmd->at.r - 1, 2, 1);
     }
 }
 
@@ -40,32 +43,7 @@ void undoCommand(struct editor *E, struct command *cmd) {
         // in at.c
         inv_cmd.type = NEWROW;
         inv_cmd.at.r--;
-        inv_cmd.at.c = E->rowarray[inv_cmd.at.r]->len - inv_cmd.at.c;
+        inv_cmd.at.c = getRow(E, inv_cmd.at.r)->len - inv_cmd.at.c;
     }
     doCommand(E, &inv_cmd);
 }
-
-void freeCommand(struct command *cmd) {
-    freeRowarr(cmd->rows, cmd->numrows);
-    free(cmd->rows);
-    free(cmd);
-}
-
-// removes(frees) the input commandStack (and associated command)
-// returns the next node
-struct commandStack *remove_node(struct commandStack *node) {
-    if (node == NULL)
-        return node;
-    struct commandStack *ret = node->next;
-    freeCommand(node->command);
-    free(node);
-    return ret;
-}
-
-struct commandStack *push(struct command *pushed, struct commandStack *stack) {
-    // TODO merge commands of the same type, if continguous
-    struct commandStack *pushedNode = malloc(sizeof(struct commandStack));
-    pushedNode->command = pushed;
-    pushedNode->next = stack;
-    return pushedNode;
-}
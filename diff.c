@@ -0,0 +1,294 @@
+#include "diff.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* ======= READING ======= */
+/* *len bytes of fd from off onto the heap, after room for before more. *
+ * *len is cut short if the file is. NULL if reading fails */
+static char *readAt(int fd, long long off, size_t before, size_t *len) {
+    char *buf = malloc(before + *len + 1);
+    size_t got = 0;
+    while (got < *len) {
+        ssize_t n = pread(fd, buf + before + got, *len - got, off + got);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n == -1) {
+            free(buf);
+            return NULL;
+        }
+        if (n == 0)
+            break;
+        got += n;
+    }
+    *len = got;
+    return buf;
+}
+
+// split [p, end) into d->rows, all of it
+static void splitAll(struct fileDiff *d, char *p, char *end) {
+    int cap = 1;
+    for (char *nl = p; (nl = memchr(nl, '\n', end - nl)); nl++) {
+        cap++;
+    }
+    d->rows = malloc(cap * sizeof(struct erow));
+    d->numrows = splitRows(&p, end, d->rows, cap);
+}
+
+static void addHunk(struct fileDiff *d, int at, int oldrows, int from,
+                    int newrows) {
+    if (oldrows == 0 && newrows == 0)
+        return;
+    d->hunks = realloc(d->hunks, (d->numhunks + 1) * sizeof(struct hunk));
+    d->hunks[d->numhunks++] = (struct hunk){at, oldrows, from, newrows};
+}
+
+static bool sameRow(struct erow *a, struct erow *b) {
+    return a->len == b->len && !memcmp(a->text, b->text, a->len);
+}
+
+/* ======= APPENDS ======= */
+/* whether the file's first size bytes end the way the buffer does, going *
+ * back APPEND_CHECK bytes (and a whole line at least). *endsLine is set if *
+ * they end in a line break */
+static bool tailMatches(struct editor *E, int fd, long long size,
+                        bool *endsLine) {
+    *endsLine = false;
+    if (size == 0)
+        return E->numrows == 1 && getRow(E, 0)->len == 0;
+    long long from = size > APPEND_CHECK ? size - APPEND_CHECK : 0;
+    size_t len = size - from;
+    char *text = readAt(fd, from, 0, &len);
+    if (text == NULL || len != (size_t)(size - from)) {
+        free(text);
+        return false;
+    }
+    *endsLine = text[len - 1] == '\n';
+    char *p = text;
+    if (from > 0) { // starting partway into a line, so skip it
+        char *nl = memchr(text, '\n', len - 1);
+        p = nl ? nl + 1 : text + len;
+    }
+    struct erow *rows = malloc((len + 1) * sizeof(struct erow));
+    int n = splitRows(&p, text + len, rows, len + 1);
+    // the whole file has to be the whole buffer, otherwise its end
+    bool match = from == 0 ? n == E->numrows : n > 0 && n <= E->numrows;
+    struct rowWalk *w = malloc(sizeof(struct rowWalk));
+    if (match) {
+        walkTo(w, E, E->numrows - n);
+    }
+    for (int i = 0; match && i < n; i++) {
+        match = sameRow(walkNext(w), &rows[i]);
+    }
+    free(w);
+    free(rows);
+    free(text);
+    return match;
+}
+
+/* the fast way, for logs and the like: if all the file did was grow, and *
+ * its old end still matches the buffer's, only what was added is read. *
+ * false if it's changed some other way, or can't be read */
+bool diffAppended(struct editor *E, char *filename, struct fileStamp *old,
+                  struct fileDiff *d) {
+    memset(d, 0, sizeof(*d));
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1)
+        return false;
+    stampFd(fd, &d->stamp);
+    bool endsLine;
+    if (!old->exists || d->stamp.dev != old->dev ||
+        d->stamp.ino != old->ino || d->stamp.size <= old->size ||
+        !tailMatches(E, fd, old->size, &endsLine)) {
+        close(fd);
+        return false;
+    }
+    /* without a line break at the old end the buffer's last row carries on *
+     * into what was added, so it's read in ahead of it */
+    struct erow *last = getRow(E, E->numrows - 1);
+    size_t before = endsLine ? 0 : last->len;
+    size_t len = d->stamp.size - old->size;
+    d->text = readAt(fd, old->size, before, &len);
+    close(fd);
+    if (d->text == NULL)
+        return false;
+    memcpy(d->text, last->text, before);
+    d->stamp.size = old->size + len;
+    splitAll(d, d->text, d->text + before + len);
+    if (endsLine) {
+        addHunk(d, E->numrows, 0, 0, d->numrows);
+    } else {
+        addHunk(d, E->numrows - 1, 1, 0, d->numrows);
+    }
+    return true;
+}
+
+/* ======= LINE DIFF ======= */
+/* the hunks that turn a into b, offset by pre rows, by Myers' O(ND) diff: *
+ * for e edits, the furthest down each diagonal k (x - y) a path can get, *
+ * from the paths for e - 1. the furthest points are kept for each e so *
+ * the path that got to the end can be followed back. false if that takes *
+ * more than DIFF_MAX_EDITS edits or DIFF_MAX_WORK rows compared */
+static bool myers(struct fileDiff *d, struct erow *a, int n, struct erow *b,
+                  int m, int pre) {
+    int maxe = min(DIFF_MAX_EDITS, n + m);
+    int *v = malloc((2 * maxe + 3) * sizeof(int));
+    int *V = v + maxe + 1; // indexed by k, from -maxe - 1 to maxe + 1
+    // the V for e edits, k from -e to e, at trace[e * e]
+    int *trace = malloc((size_t)(maxe + 1) * (maxe + 1) * sizeof(int));
+    long work = 0;
+    int edits = -1;
+    V[1] = 0;
+    for (int e = 0; e <= maxe && edits < 0 && work <= DIFF_MAX_WORK; e++) {
+        for (int k = -e; k <= e; k += 2) {
+            // down from diagonal k + 1 (an insert) or right from k - 1
+            int x = k == -e || (k != e && V[k - 1] < V[k + 1]) ? V[k + 1]
+                                                                : V[k - 1] + 1;
+            int y = x - k;
+            int from = x;
+            while (x < n && y < m && sameRow(&a[x], &b[y])) {
+                x++;
+                y++;
+            }
+            work += x - from + 1;
+            V[k] = x;
+            if (x >= n && y >= m) {
+                edits = e;
+            }
+        }
+        memcpy(trace + e * e, V - e, (2 * e + 1) * sizeof(int));
+    }
+    free(v);
+    if (edits < 0) {
+        free(trace);
+        return false;
+    }
+
+    // back from the end: each edit, then the run of matching lines after it
+    int (*runs)[3] = malloc((edits + 1) * sizeof(*runs));
+    int x = n;
+    int y = m;
+    for (int e = edits; e > 0; e--) {
+        int *P = trace + (e - 1) * (e - 1) + (e - 1);
+        int k = x - y;
+        int pk = k == -e || (k != e && P[k - 1] < P[k + 1]) ? k + 1 : k - 1;
+        int px = P[pk];
+        int sx = pk == k + 1 ? px : px + 1; // just after the edit
+        runs[e][0] = sx;
+        runs[e][1] = sx - k;
+        runs[e][2] = x - sx;
+        x = px;
+        y = px - pk;
+    }
+    runs[0][0] = runs[0][1] = 0;
+    runs[0][2] = x;
+    free(trace);
+
+    // the hunks are what's between the runs
+    x = y = 0;
+    for (int e = 0; e <= edits; e++) {
+        if (runs[e][2] == 0)
+            continue;
+        addHunk(d, pre + x, runs[e][0] - x, y, runs[e][1] - y);
+        x = runs[e][0] + runs[e][2];
+        y = runs[e][1] + runs[e][2];
+    }
+    addHunk(d, pre + x, n - x, y, m - y);
+    free(runs);
+    return true;
+}
+
+/* read the whole file and find the lines that differ from the buffer. the *
+ * lines the two start and end with are skipped first, only the rest are *
+ * kept as rows and diffed. false if the file can't be read */
+bool diffFile(struct editor *E, char *filename, struct fileDiff *d) {
+    memset(d, 0, sizeof(*d));
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1)
+        return false;
+    stampFd(fd, &d->stamp);
+    size_t len = d->stamp.size;
+    d->text = readAt(fd, 0, 0, &len);
+    close(fd);
+    if (d->text == NULL)
+        return false;
+    d->stamp.size = len;
+    char *end = d->text + len;
+
+    // the file's lines, an empty file being an empty row like the buffer's
+    int m = 1;
+    for (char *nl = d->text; (nl = memchr(nl, '\n', end - nl)); nl++) {
+        m += nl + 1 < end;
+    }
+    int n = E->numrows;
+
+    struct rowWalk *w = malloc(sizeof(struct rowWalk));
+    walkTo(w, E, 0);
+    char *p = d->text;
+    struct erow row = {0, 0, d->text};
+    int pre = 0;
+    while (pre < n && pre < m) {
+        char *start = p;
+        splitRows(&p, end, &row, 1);
+        if (!sameRow(walkNext(w), &row)) {
+            p = start;
+            break;
+        }
+        pre++;
+    }
+
+    // then the lines they end with, backwards
+    struct rowblock *b = lastBlock(E->root);
+    int idx = b->numrows;
+    struct erow *rows = peekBlock(b, w->scratch);
+    char *q = len > 0 && end[-1] == '\n' ? end - 1 : end; // last line's end
+    int suf = 0;
+    while (suf < n - pre && suf < m - pre) {
+        while (idx == 0) {
+            b = prevBlock(b);
+            idx = b->numrows;
+            rows = peekBlock(b, w->scratch);
+        }
+        char *s = q;
+        while (s > d->text && s[-1] != '\n') {
+            s--;
+        }
+        bool crlf = q < end && q > s && q[-1] == '\r';
+        row.text = s;
+        row.len = q - s - crlf;
+        if (!sameRow(&rows[--idx], &row))
+            break;
+        q = s > d->text ? s - 1 : s;
+        suf++;
+    }
+
+    int oldrows = n - pre - suf;
+    struct erow *old = malloc(max(oldrows, 1) * sizeof(struct erow));
+    walkTo(w, E, pre);
+    for (int i = 0; i < oldrows; i++) {
+        old[i] = *walkNext(w);
+    }
+    free(w);
+    d->rows = malloc(max(m - pre - suf, 1) * sizeof(struct erow));
+    d->numrows = splitRows(&p, end, d->rows, m - pre - suf);
+    if (d->numrows < m - pre - suf) { // the empty file's row
+        d->rows[d->numrows++] = (struct erow){0, 0, end};
+    }
+    if (!myers(d, old, oldrows, d->rows, d->numrows, pre)) {
+        free(d->hunks);
+        d->hunks = NULL;
+        d->numhunks = 0;
+        addHunk(d, pre, oldrows, 0, d->numrows);
+    }
+    free(old);
+    return true;
+}
+
+void freeDiff(struct fileDiff *d) {
+    free(d->text);
+    free(d->rows);
+    free(d->hunks);
+}
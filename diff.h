@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "editor.h"
+#include "watch.h"
+
+// bytes before the old end of an appended-to file checked against the buffer
+#define APPEND_CHECK 4096
+// most edits the line diff looks for before replacing all it hasn't matched
+#define DIFF_MAX_EDITS 1000
+// most rows compared by the line diff, the same
+#define DIFF_MAX_WORK (16 << 20)
+
+// rows [at, at + oldrows) of the buffer become [from, from + newrows) of it
+struct hunk {
+    int at;
+    int oldrows;
+    int from;
+    int newrows;
+};
+
+/* what it takes to make the buffer match its file, which has changed on *
+ * disk. the rows borrow text read from the file */
+struct fileDiff {
+    char *text;
+    struct erow *rows; // of the file, or as much of it as was read
+    int numrows;
+    struct hunk *hunks; // top to bottom
+    int numhunks;
+    struct fileStamp stamp; // the file as it was read
+};
+
+bool diffAppended(struct editor *E, char *filename, struct fileStamp *old,
+                  struct fileDiff *d);
+bool diffFile(struct editor *E, char *filename, struct fileDiff *d);
+void freeDiff(struct fileDiff *d);
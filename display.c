@@ -6,92 +6,76 @@
 #include <assert.h>
 #include "display.h"
 
-#define szstr(str) str, sizeof(str)
-#define TAB_WIDTH 4
+#define szstr(str) str, sizeof(str) - 1
 extern struct editorInterface *I;
 
-/* ======= ESC SEQUENCE UTILS ======= */
-void abAppend(struct abuf *ab, char *s, int len) {
-    char *new = realloc(ab->buf, ab->size + len);
-    if (new == NULL)
-        return; // :(
-    memcpy(new + ab->size, s, len);
-    ab->buf = new;
-    ab->size += len;
-}
-
-// append the MOVE esc sequence to a string
-void move(struct abuf *ab, int r, int c) {
-    char *buf;
-    int len = asprintf(&buf, "\x1b[%d;%dH", r, c);
-    if (len < 0)
-        return;
-    abAppend(ab, buf, len);
-    free(buf);
-}
-
-void abFree(struct abuf *ab) {
-    free(ab->buf);
-    free(ab);
-}
+// color index -> RGB, for the screen
+const char *palette[] = {
+    [C_FG] = FG,
+    [C_BG] = BG,
+    [C_CURSORLINE_FG] = CURSORLINE_FG,
+    [C_LINENUM_FG] = LINENUM_FG,
+    [C_STATUSLINE_A_BG] = STATUSLINE_A_BG,
+    [C_STATUSLINE_A_FG] = STATUSLINE_A_FG,
+    [C_STATUSLINE_BG] = STATUSLINE_BG,
+    [C_STATUSLINE_FG] = STATUSLINE_FG,
+    [C_SELECT_BG] = SELECT_BG,
+    [C_MATCH_BG] = MATCH_BG,
+    [C_COMMENT_FG] = COMMENT_FG,
+    [C_KEYWORD_FG] = KEYWORD_FG,
+    [C_TYPE_FG] = TYPE_FG,
+    [C_STRING_FG] = STRING_FG,
+    [C_NUMBER_FG] = NUMBER_FG,
+    [C_PREPROC_FG] = PREPROC_FG,
+};
+
+// highlight type -> color
+static const int hlColors[] = {
+    [HL_NORMAL] = C_FG,
+    [HL_COMMENT] = C_COMMENT_FG,
+    [HL_KEYWORD] = C_KEYWORD_FG,
+    [HL_TYPE] = C_TYPE_FG,
+    [HL_STRING] = C_STRING_FG,
+    [HL_NUMBER] = C_NUMBER_FG,
+    [HL_PREPROC] = C_PREPROC_FG,
+};
 
 /* ======= DISPLAY UTILS ======= */
 point getBoundedCursor(void) {
     point out = I->cursor;
-    out.c = min(out.c, I->E->rowarray[out.r]->len);
-    return out;
-}
-
-point getLargestDisplayedPoint(
-    void) { // TODO technically doesn't work because of wide chars
-    int maxr = I->ws.ws_row;
-    int maxc = I->ws.ws_col - I->coloff - 1;
-    struct editor *E = I->E;
-
-    int visual_r = 1;
-
-    int r;
-    int len;
-    for (r = I->toprow; r < E->numrows && visual_r < maxr; r++) {
-        len = E->rowarray[r]->len;
-        visual_r += len / maxc + (len % maxc != 0) + (len == 0);
-    }
-    int extra = max(visual_r - maxr, 0);
-    if (extra != 0) {
-        len -= len % maxc - (extra - 1) * maxc;
-    }
-    point out = {r - 1, len};
+    out.c = min(out.c, getRow(I->E, out.r)->len);
     return out;
 }
 
+/* scroll just enough to bring the cursor's line onto the screen, using *
+ * the wrapped heights (wrap.h) rather than walking the rows */
 void adjustToprow(void) {
+    struct editor *E = I->E;
     if (I->cursor.r < I->toprow) {
         I->toprow = I->cursor.r;
         return;
     }
-    while (pointGreater(getBoundedCursor(), getLargestDisplayedPoint())) {
-        I->toprow++;
+    int width = I->ws.ws_col - I->coloff - 1;
+    int textrows = I->ws.ws_row - 1;
+    setWrapWidth(E, width);
+
+    // the cursor's line inside its row, from the row's layout
+    point cursor = getBoundedCursor();
+    struct erow *row = getRow(E, cursor.r);
+    struct layout *l = rowLayout(I->layout, cursor.r, width);
+    // most likely the row just edited, its height is known from here on
+    setRowHeight(E, cursor.r, width, layoutLines(l, row));
+    struct glyph g;
+    int line = lineOfRow(E, cursor.r);
+    if (glyphAt(l, row, glyphOf(l, row, cursor.c), &g)) {
+        line += g.line;
     }
-}
-
-void writeCharToBuffer(struct abuf* ab, char* to_add, int visual_c) {
-	if (*to_add == '\t') { // tab handling
-		int num_spaces = TAB_WIDTH - (visual_c % TAB_WIDTH);
-		char* tab_string;
-		asprintf(&tab_string, "%*s", num_spaces, ""); // left pads the empty string
-		abAppend(ab, tab_string, num_spaces);
-		free(tab_string);
-	} else {
-		abAppend(ab, to_add, 1);
-	}
-}
-
-void setDefaultFG(struct abuf* ab) {
-	abAppend(ab, szstr("\x1b[38;2;" FG "m"));
-}
-
-void setDefaultBG(struct abuf* ab) {
-	abAppend(ab, szstr("\x1b[48;2;" BG "m"));
+    if (line - lineOfRow(E, I->toprow) < textrows)
+        return;
+    // the first row starting on or after the line that puts cursor last
+    int sub;
+    int r = rowOfLine(E, line - textrows + 1, &sub);
+    I->toprow = min(sub > 0 ? r + 1 : r, cursor.r);
 }
 
 /* ======= DISPLAY ======= */
@@ -99,229 +83,233 @@ void clearScreen(void) {
 	write(STDIN_FILENO, szstr("\x1b[2J"));
 }
 
-void printEditorContents(void) {
-    int maxr = I->ws.ws_row;                 // height
-    int maxc = I->ws.ws_col - I->coloff - 1; // width
+/* draw the rows from toprow into every screen row but the last, returns *
+ * where the cursor goes */
+point printEditorContents(void) {
+    struct screen *s = &I->screen;
+    int maxr = s->rows - 1;              // text rows
+    int maxc = s->cols - I->coloff - 1; // width
 
     struct editor *E = I->E;
-    int visual_r = 1;
+    int visual_r = 0;
 
     point save_cursor;
     save_cursor.r = -1; // default not found
 
-    struct abuf ab = {NULL, 0};        // buffer for the WHOLE screen
-	if (I->mode == VIEW || I->mode == COMMAND) { // cursor type
-		abAppend(&ab, szstr("\x1b[2 q"));
-	} else if (I->mode == INSERT) {
-		abAppend(&ab, szstr("\x1b[5 q"));
-	}
-    abAppend(&ab, szstr("\x1b[?25l")); // hide cursor
-
     point startSel;
     point endSel;
-    bool select = false;
-    if (I->anchor.r != -1) { // selection mode
+    bool select = I->anchor.r != -1;
+    if (select) { // selection mode
         startSel = minPoint(I->cursor, I->anchor);
-        startSel.c = min(E->rowarray[startSel.r]->len - 1, startSel.c);
+        startSel.c = min(getRow(E, startSel.r)->len - 1, startSel.c);
         endSel = maxPoint(I->cursor, I->anchor);
-        endSel.c = min(E->rowarray[endSel.r]->len - 1, endSel.c);
-        select = startSel.r < I->toprow;
+        endSel.c = min(getRow(E, endSel.r)->len - 1, endSel.c);
     }
 
+    // search matches, walked through alongside the rows
+    struct matchIndex *m = I->hlsearch ? I->matches : NULL;
+    int mi = m ? lowerMatch(m, (point){I->toprow, 0}) : 0;
+    struct highlighter *h = I->syntax;
+
     // ITER OVER THE ROWS
     for (int r = I->toprow; visual_r < maxr && r < E->numrows; r++) {
-        struct erow *curr_row = E->rowarray[r];
-        int visual_c = 0; // same as displayed col (starting at coloff)
+        struct erow *curr_row = getRow(E, r);
 
-        /* LINENUM DISPLAY */
-        move(&ab, visual_r, 0);
-        char linenum[I->coloff];
-        sprintf(linenum, "%*d ", I->coloff - 1, r + 1);
-		if (I->cursor.r == r) { // set linenum fg color
-			abAppend(&ab, szstr("\x1b[1m")); // bold
-			abAppend(&ab, szstr("\x1b[38;2;" CURSORLINE_FG "m"));
-		} else {
-        	abAppend(&ab, szstr("\x1b[38;2;" LINENUM_FG "m"));
-		}
-        abAppend(&ab, linenum, I->coloff);
-        abAppend(&ab, szstr("\x1b[m")); // reset all formatting
-		setDefaultFG(&ab);
-		setDefaultBG(&ab);
+        // syntax spans, walked through alongside the characters
+        int numspans = 0;
+        struct hlSpan *spans = h ? rowSpans(h, r, &numspans) : NULL;
+        int si = 0;
 
-        if (select) {
-            abAppend(&ab, szstr("\x1b[48;2;" SELECT_BG "m")); // start sel
+        /* LINENUM DISPLAY */
+        char linenum[16];
+        int len = snprintf(linenum, sizeof(linenum), "%*d ", I->coloff - 1,
+                           r + 1);
+        clearCells(s, visual_r, 0, s->cols, C_BG);
+        if (I->cursor.r == r) {
+            putCells(s, visual_r, 0, linenum, len, C_CURSORLINE_FG, C_BG,
+                     true);
+        } else {
+            putCells(s, visual_r, 0, linenum, len, C_LINENUM_FG, C_BG, false);
         }
 
-        if (curr_row->len == 0) {  // empty line
-            if (startSel.r == r) { // start selection here
-                abAppend(&ab, szstr("\x1b[48;2;" SELECT_BG "m")); // start sel
-                select = true;
-            }
-            abAppend(&ab, szstr(" "));
-            if (endSel.r == r) {                  // end selection here
-				setDefaultBG(&ab);
-                select = false;
+        if (curr_row->len == 0) { // empty line
+            point curr = {r, -1}; // where the selection marks empty rows
+            if (select && !pointLess(curr, startSel) &&
+                !pointLess(endSel, curr)) {
+                clearCells(s, visual_r, I->coloff, 1, C_SELECT_BG);
             }
             if (I->cursor.r == r) { // cursor here
                 save_cursor.r = visual_r;
-                save_cursor.c = I->coloff + 1;
+                save_cursor.c = I->coloff;
             }
         }
-        // ITER OVER EACH CHAR (0-indexed)
-        for (int c = 0; c < curr_row->len && visual_r < maxr; c++) {
+        // ITER OVER EACH GLYPH, laid out by layout.h
+        struct layout *lay = rowLayout(I->layout, r, maxc);
+        int top = visual_r; // where the row starts
+        int ci = I->cursor.r == r ? glyphOf(lay, curr_row, I->cursor.c) : -1;
+        struct glyph g;
+        for (int i = 0; glyphAt(lay, curr_row, i, &g); i++) {
+            int c = g.start;
             point curr = {r, c};
-            /* START SELECTION HIGHLIGHTING */
-            if (pointEqual(curr, startSel)) {
-                abAppend(&ab, szstr("\x1b[48;2;" SELECT_BG "m")); // start sel
-                select = true;
-            }
-            if (pointEqual(curr, endSel)) {
-                select = false;
-            }
-
-            char to_add = curr_row->text[c];
-            int cwidth = 1;
-            if (to_add == '\t') { // tabs are special
-                cwidth = TAB_WIDTH - (visual_c % TAB_WIDTH);
-            }
 
             /* SUBLINE HANDLING */
-            if (visual_c + cwidth >= maxc) { // new subline?
-                abAppend(&ab, szstr("\x1b[m"));       // reset all formatting
-                if (++visual_r >= maxr) break;
-                visual_c = 0;
-				// erase to EOL
-                abAppend(&ab, szstr("\x1b[0K"));
-                move(&ab, visual_r, I->coloff + 1); // move to upcoming subline
-                abAppend(&ab, szstr("\x1b[1K"));    // erase to start of line
-                if (select) {
-					// start sel
-                    abAppend(&ab, szstr("\x1b[48;2;" SELECT_BG "m"));
+            while (visual_r < top + g.line && visual_r < maxr) {
+                if (++visual_r < maxr) {
+                    clearCells(s, visual_r, 0, s->cols, C_BG);
                 }
             }
-
-			visual_c += cwidth;
+            if (visual_r >= maxr) break;
+            int col = g.col + I->coloff;
+            bool tab = curr_row->text[c] == '\t';
 
             /* CURSOR FINDING LOGIC */
-            if (save_cursor.r == -1 && I->cursor.r == r) {
-                if (c == I->cursor.c) {
-                    save_cursor.r = visual_r;
-                    save_cursor.c = visual_c - 1 + I->coloff + 1;
-                } else if (c == curr_row->len - 1) {
-                    save_cursor.r = visual_r;
-                    save_cursor.c = visual_c + I->coloff + 1;
+            if (i == ci) {
+                save_cursor.r = visual_r;
+                save_cursor.c = col;
+                if (I->cursor.c >= curr_row->len) { // just past the end
+                    save_cursor.c += g.width;
+                } else if (tab) { // at the end of it
+                    save_cursor.c += g.width - 1;
+                }
+            }
+
+            /* SELECTION AND MATCH HIGHLIGHTING */
+            int bg = C_BG;
+            if (select && !pointLess(curr, startSel) &&
+                !pointLess(endSel, curr)) {
+                bg = C_SELECT_BG;
+            } else if (m) {
+                struct match *p = m->matches;
+                while (mi < m->nummatches &&
+                       (p[mi].at.r < r ||
+                        (p[mi].at.r == r && p[mi].at.c + p[mi].len <= c))) {
+                    mi++;
                 }
-            }	
+                if (mi < m->nummatches && p[mi].at.r == r && p[mi].at.c <= c) {
+                    bg = C_MATCH_BG;
+                }
+            }
 
-            /* WRITING CHARACTER */
-			writeCharToBuffer(&ab, &to_add, visual_c - cwidth);
+            /* SYNTAX HIGHLIGHTING */
+            while (si < numspans && spans[si].start + spans[si].len <= c) {
+                si++;
+            }
+            int fg = C_FG;
+            if (si < numspans && spans[si].start <= c) {
+                fg = hlColors[spans[si].type];
+            }
 
-            /* END SELECTION HIGHLIGHTING */
-            if (!select) {
-				setDefaultBG(&ab);
+            /* WRITING GLYPH */
+            if (tab) {
+                clearCells(s, visual_r, col, g.width, bg);
+            } else if (!g.shown) {
+                putCell(s, visual_r, col, "?", 1, fg, bg, false);
+            } else {
+                putGlyph(s, visual_r, col, curr_row->text + c, g.len,
+                         g.width == 2, fg, bg);
             }
         }
-        // prepare to start a new row
-		setDefaultBG(&ab);
-        abAppend(&ab, szstr("\x1b[0K"));  // erase to end of line
         visual_r++;
     }
 
     // clear all displayed rows past the end of the file
-    for (int r = visual_r; r < maxr; r++) {
-        move(&ab, r, 0);
-        abAppend(&ab, szstr("\x1b[0K")); // erase to end of line
+    for (; visual_r < maxr; visual_r++) {
+        clearCells(s, visual_r, 0, s->cols, C_BG);
     }
 
-    abAppend(&ab, szstr("\x1b[48;2;" BG "m")); // end selection, in case it was enabled
-
-    // move the cursor to display position
+    // the cursor's display position
     if (I->mode == COMMAND) {
-        move(&ab, maxr, I->cmd.mcol + 1);
-    } else {
-        move(&ab, save_cursor.r, save_cursor.c);
+        return (point){maxr, I->cmd.mcol};
     }
-    abAppend(&ab, szstr("\x1b[?25h")); // show cursor
-
-    write(STDIN_FILENO, ab.buf, ab.size);
-    free(ab.buf);
+    if (save_cursor.r == -1) {
+        return (point){0, 0};
+    }
+    return save_cursor;
 }
 
+// draw the status line into the bottom screen row
 void statusPrintMode(void) { // TODO rename this lol
+    struct screen *s = &I->screen;
+    int r = s->rows - 1;
+    clearCells(s, r, 0, s->cols, C_BG);
     if (I->mode == COMMAND) {
-        abAppend(&I->status, I->cmd.msg.text, I->cmd.msg.len);
+        putCells(s, r, 0, I->cmd.msg.text, I->cmd.msg.len, C_FG, C_BG, false);
         return;
     }
-	abAppend(&I->status, szstr("\x1b[38;2;" STATUSLINE_A_BG "m"));
-	abAppend(&I->status, szstr(""));
-	abAppend(&I->status, szstr("\x1b[48;2;" STATUSLINE_A_BG "m"));
-	abAppend(&I->status, szstr("\x1b[38;2;" STATUSLINE_A_FG "m"));
-	abAppend(&I->status, szstr("\x1b[1m"));
+    int c = putCells(s, r, 0, "\xee\x82\xb6", 3, C_STATUSLINE_A_BG, C_BG,
+                     false);
     switch (I->mode) { // MODE
     case VIEW:
-        abAppend(&I->status, szstr("VIEW"));
+        c = putCells(s, r, c, "VIEW", 4, C_STATUSLINE_A_FG,
+                     C_STATUSLINE_A_BG, true);
         break;
     case INSERT:
-        abAppend(&I->status, szstr("INSERT"));
+        c = putCells(s, r, c, "INSERT", 6, C_STATUSLINE_A_FG,
+                     C_STATUSLINE_A_BG, true);
         break;
     default:
         break;
     }
-	abAppend(&I->status, szstr("\x1b[48;2;" STATUSLINE_BG "m"));
-	abAppend(&I->status, szstr("\x1b[38;2;" STATUSLINE_A_BG "m"));
-	abAppend(&I->status, szstr(" "));
-	abAppend(&I->status, szstr("\x1b[0m"));
-	abAppend(&I->status, szstr("\x1b[48;2;" STATUSLINE_BG "m"));
-	abAppend(&I->status, szstr("\x1b[38;2;" STATUSLINE_FG "m"));
+    c = putCells(s, r, c, "\xee\x82\xb4 ", 4, C_STATUSLINE_A_BG,
+                 C_STATUSLINE_BG, true);
     // filename
-    abAppend(&I->status, I->filename, strlen(I->filename));
+    c = putCells(s, r, c, I->filename, strlen(I->filename), C_STATUSLINE_FG,
+                 C_STATUSLINE_BG, false);
+    if (undoVersion(&I->undo) != I->undo.saved) { // changed since the save
+        c = putCells(s, r, c, " [+]", 4, C_STATUSLINE_FG, C_STATUSLINE_BG,
+                     false);
+    }
     // number of lines, number of bytes
-    char *buf;
+    char buf[64];
     int len;
-    asprintf(&buf, " %dL", I->E->numrows);
-    len = strlen(buf);
-    abAppend(&I->status, buf, len);
-	abAppend(&I->status, szstr("\x1b[48;2;" BG" m"));
-	abAppend(&I->status, szstr("\x1b[38;2;" STATUSLINE_BG "m"));
-	abAppend(&I->status, szstr(" "));
-    abAppend(&I->status, szstr("\x1b[0K")); // erase to end of line
-    free(buf);
-    // cursor coordinates
-    asprintf(&buf, "%d:%d", I->cursor.r + 1, I->cursor.c + 1);
-    len = strlen(buf) + 2;
-    move(&I->status, I->ws.ws_row, I->ws.ws_col - len);
-	abAppend(&I->status, szstr("\x1b[1m"));
-	abAppend(&I->status, szstr("\x1b[38;2;" STATUSLINE_A_BG "m"));
-	abAppend(&I->status, szstr(""));
-	abAppend(&I->status, szstr("\x1b[48;2;" STATUSLINE_A_BG "m"));
-	abAppend(&I->status, szstr("\x1b[38;2;" STATUSLINE_A_FG "m"));
-    abAppend(&I->status, buf, len);
-	abAppend(&I->status, szstr("\x1b[48;2;" BG "m"));
-	abAppend(&I->status, szstr("\x1b[38;2;" STATUSLINE_A_BG "m"));
-	abAppend(&I->status, szstr(""));
-	abAppend(&I->status, szstr("\x1b[m")); // reset all formatting
-    free(buf);
+    int loaded = loadProgress(I->E);
+    if (loaded >= 0) { // still loading, the count is so far
+        len = snprintf(buf, sizeof(buf), " %dL+ loading %d%%", I->E->numrows,
+                       loaded);
+    } else {
+        len = snprintf(buf, sizeof(buf), " %dL", I->E->numrows);
+    }
+    c = putCells(s, r, c, buf, len, C_STATUSLINE_FG, C_STATUSLINE_BG, false);
+    if (I->save) {
+        len = snprintf(buf, sizeof(buf), "  saving %d%%",
+                       saveProgress(I->save));
+        c = putCells(s, r, c, buf, len, C_STATUSLINE_FG, C_STATUSLINE_BG,
+                     false);
+    }
+    // memory held by undo history
+    len = snprintf(buf, sizeof(buf), "  undo %zuK",
+                   (I->undo.bytes + 1023) >> 10);
+    c = putCells(s, r, c, buf, len, C_STATUSLINE_FG, C_STATUSLINE_BG, false);
+    if (I->notice[0] != '\0') {
+        c = putCells(s, r, c, "  ", 2, C_STATUSLINE_FG, C_STATUSLINE_BG,
+                     false);
+        c = putCells(s, r, c, I->notice, strlen(I->notice), C_STATUSLINE_FG,
+                     C_STATUSLINE_BG, false);
+    }
+    putCells(s, r, c, "\xee\x82\xb4", 3, C_STATUSLINE_BG, C_BG, false);
+    // cursor coordinates, one column in from the right
+    len = snprintf(buf, sizeof(buf), "%d:%d", I->cursor.r + 1,
+                   I->cursor.c + 1);
+    c = max(s->cols - len - 3, 0);
+    c = putCells(s, r, c, "\xee\x82\xb6", 3, C_STATUSLINE_A_BG, C_BG, true);
+    c = putCells(s, r, c, buf, len, C_STATUSLINE_A_FG, C_STATUSLINE_A_BG,
+                 true);
+    putCells(s, r, c, "\xee\x82\xb4", 3, C_STATUSLINE_A_BG, C_BG, true);
 }
 
-void printEditorStatus(void) {
-    struct abuf ab = {NULL, 0};
-    abAppend(&ab, szstr("\x1b[?25l")); // hide cursor
-    move(&ab, I->ws.ws_row, 0);
-    abAppend(&ab, I->status.buf, I->status.size); // write the status
-    abAppend(&ab, szstr("\x1b[0K"));              // erase to end of line
-    abAppend(&ab, szstr("\x1b[m"));               // reset all formatting
-    write(STDIN_FILENO, ab.buf, ab.size);
-    free(ab.buf);
+// draw the whole frame, then send the terminal what changed
+void refreshScreen(void) {
+    adjustToprow();
+    statusPrintMode();
+    point cursor = printEditorContents();
+    flushScreen(&I->screen, cursor.r, cursor.c, I->mode == INSERT ? 5 : 2);
 }
 
-void resize(int _ __attribute__((unused))) {
-    ioctl(1, TIOCGWINSZ, &I->ws);
-    point max = {I->ws.ws_row, I->ws.ws_col};
-    point min = {0, 0};
-    I->cursor = maxPoint(minPoint(I->cursor, max), min);
-    I->status.size = 0;
-    statusPrintMode();
-    adjustToprow();
-    printEditorStatus();
-    printEditorContents();
+// take up the terminal's new size, the next refreshScreen redraws it all
+void resize(void) {
+    if (ioctl(1, TIOCGWINSZ, &I->ws) == -1 || I->ws.ws_row == 0) {
+        I->ws.ws_row = 24; // not a terminal, so the usual size of one
+        I->ws.ws_col = 80;
+    }
+    resizeScreen(&I->screen, I->ws.ws_row, I->ws.ws_col);
 }
@@ -4,6 +4,14 @@
 
 #include "command.h"
 #include "editor.h"
+#include "layout.h"
+#include "save.h"
+#include "screen.h"
+#include "search.h"
+#include "syntax.h"
+#include "undo.h"
+#include "watch.h"
+#include "wrap.h"
 
 // RGB
 #define FG "224;222;244"
@@ -18,6 +26,34 @@
 #define STATUSLINE_FG "246;193;119"
 
 #define SELECT_BG "86;82;110"
+#define MATCH_BG "68;65;90"
+
+#define COMMENT_FG "110;106;134"
+#define KEYWORD_FG "62;143;176"
+#define TYPE_FG "156;207;216"
+#define STRING_FG "246;193;119"
+#define NUMBER_FG "234;154;151"
+#define PREPROC_FG "196;167;231"
+
+// the colors above, as indexes into the screen's palette
+enum color {
+    C_FG,
+    C_BG,
+    C_CURSORLINE_FG,
+    C_LINENUM_FG,
+    C_STATUSLINE_A_BG,
+    C_STATUSLINE_A_FG,
+    C_STATUSLINE_BG,
+    C_STATUSLINE_FG,
+    C_SELECT_BG,
+    C_MATCH_BG,
+    C_COMMENT_FG,
+    C_KEYWORD_FG,
+    C_TYPE_FG,
+    C_STRING_FG,
+    C_NUMBER_FG,
+    C_PREPROC_FG
+};
 
 typedef enum Mode { VIEW, INSERT, COMMAND, QUIT } Mode;
 
@@ -26,11 +62,6 @@ struct commandRow { // for selecting
     struct erow msg;
 };
 
-struct abuf {
-    char *buf;
-    int size;
-};
-
 struct editorInterface {
     char *filename;
     struct editor *E;
@@ -46,22 +77,36 @@ struct editorInterface {
     point anchor;
 
     struct commandRow cmd;
-    struct abuf status;
-
-    struct commandStack *cmdStack;
+    char notice[128]; // one-off message for the status line
+
+    struct undoLog undo;
+    struct journal *journal; // undo log, as it goes, for the next session
+    bool askReplay; // the last session left edits, waiting for y/n
+    struct saveJob *save; // being written in the background, NULL if none
+    struct watch *watch; // says when the file changes on disk, or NULL
+    struct fileStamp stamp; // the file as it was last read or written
+    long long changedAt; // when the watch last went off, 0 if it hasn't
+
+    // last / or ? search, see search.h
+    struct matchIndex *matches;
+    bool searchBack;
+    bool hlsearch; // highlight the matches on screen
+    struct highlighter *syntax; // NULL if the file has no syntax we know
+    struct layoutCache *layout; // where the rows' glyphs go on screen
+
+    struct screen screen; // drawn into, then flushed to the terminal
+
+    struct editorInterface *next; // open buffers, most recently used first
 };
 
+extern const char *palette[];
+
 int min(int a, int b);
 int max(int a, int b);
 
-void abAppend(struct abuf *ab, char *s, int len);
-void abFree(struct abuf *ab);
-
-point search(point start, char *needle);
-
 void adjustToprow(void);
 void clearScreen(void);
-void printEditorContents(void);
+point printEditorContents(void);
 void statusPrintMode(void);
-void printEditorStatus(void);
-void resize(int _);
+void refreshScreen(void);
+void resize(void);
@@ -1,12 +1,20 @@
 #include "editor.h"
+#include "lineindex.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include <assert.h>
 
 #define UNUSED(x) (void)(x)
+#define BLOCK_BYTES (ROWBLOCK_MAX * sizeof(struct erow))
 
 int min(int a, int b) { return ((a < b) ? (a) : (b)); }
 int max(int a, int b) { return ((a > b) ? (a) : (b)); }
@@ -50,9 +58,32 @@ point minPoint(point p1, point p2) {
     }
 }
 
+/* ======= ROW TEXT ======= */
+/* rows loaded from a file borrow their text from the file mapping *
+ * (cap == 0) and are not '\0' terminated. the first edit to such a row *
+ * copies it into a buffer of its own (copy on write) */
+static void ownRow(struct erow *row, int len) {
+    if (row->cap > len)
+        return;
+    int cap = max(len + 1, row->cap * 2);
+    if (row->cap == 0) {
+        char *text = malloc(cap);
+        memcpy(text, row->text, row->len);
+        row->text = text;
+    } else {
+        row->text = realloc(row->text, cap);
+    }
+    row->cap = cap;
+}
+
+static void clearRow(struct erow *row) {
+    if (row->cap > 0)
+        free(row->text);
+}
+
 void freeRow(struct erow **ptr) {
     struct erow *row = *ptr;
-    free(row->text);
+    clearRow(row);
     free(row);
     *ptr = NULL;
 }
@@ -63,12 +94,12 @@ void insertChar(struct erow *row, int pos, char c) {
     assert(row);
     assert(pos >= 0 && pos <= row->len);
 
-    row->len++;
-    row->text = realloc(row->text, row->len + 1);
-
+    ownRow(row, row->len + 1);
     memmove(row->text + pos + 1, row->text + pos, row->len - pos);
+    row->len++;
 
     row->text[pos] = c;
+    row->text[row->len] = '\0';
 }
 
 /* insert a string into a line at the specified position *
@@ -84,17 +115,18 @@ void insertString(struct erow *row, int pos, char *str, int len) {
     // whether str overlaps with row->text, if so we need to update the str
     // pointer after realloc'ing row->text
     // -2 hours :)
-    bool overlaps = str >= row->text && str < row->text + row->len;
-    int diff = str - row->text;
+    bool overlaps =
+        row->cap > 0 && str >= row->text && str < row->text + row->len;
+    int diff = overlaps ? str - row->text : 0;
 
-    row->len += len;
-    row->text = realloc(row->text, row->len);
+    ownRow(row, row->len + len);
     if (overlaps) {
         str = row->text + diff;
     }
-    // previous len = row->len - len
-    memmove(row->text + pos + len, row->text + pos, row->len - len - pos);
-    strncpy(row->text + pos, str, len);
+    memmove(row->text + pos + len, row->text + pos, row->len - pos);
+    memcpy(row->text + pos, str, len);
+    row->len += len;
+    row->text[row->len] = '\0';
 }
 
 /* delete a character from a line at the specified position *
@@ -103,46 +135,457 @@ void deleteChar(struct erow *row, int pos) {
     assert(row);
     assert(pos >= 0 && pos < row->len);
 
+    ownRow(row, row->len);
     memmove(row->text + pos, row->text + pos + 1, row->len - pos);
-    // realloc?
     row->len--;
 }
 
+/* ======= SNAPSHOTS ======= */
+// rows the snapshot alone has now, freed along with it
+static void orphanRows(struct snapshot *S, struct erow *rows, int numrows) {
+    if (S->numorphans == S->caporphans) {
+        S->caporphans = S->caporphans ? S->caporphans * 2 : 16;
+        S->orphans =
+            realloc(S->orphans, S->caporphans * sizeof(struct blockView));
+    }
+    S->orphans[S->numorphans++] = (struct blockView){numrows, rows, NULL, 0};
+}
+
+/* b's rows are about to change under the snapshot being saved: the *
+ * editor carries on with a copy of them (text and all), the snapshot *
+ * keeps the originals */
+static void unshareBlock(struct editor *E, struct rowblock *b) {
+    if (!b->shared)
+        return;
+    struct erow *rows = malloc(BLOCK_BYTES);
+    memcpy(rows, b->rows, b->numrows * sizeof(struct erow));
+    for (int i = 0; i < b->numrows; i++) {
+        struct erow *row = &rows[i];
+        if (row->cap > 0) {
+            char *text = malloc(row->len + 1);
+            memcpy(text, row->text, row->len);
+            text[row->len] = '\0';
+            row->text = text;
+            row->cap = row->len + 1;
+        }
+    }
+    orphanRows(E->snapshot, b->rows, b->numrows);
+    b->rows = rows;
+    b->shared = false;
+}
+
+/* freeze the buffer as it is. only the block structure is copied, the *
+ * row arrays are shared until the editor changes them (unshareBlock). *
+ * the rest of a file still loading is taken straight from the map */
+struct snapshot *takeSnapshot(struct editor *E) {
+    assert(E->snapshot == NULL);
+    pollLoad(E);
+    struct snapshot *S = calloc(1, sizeof(struct snapshot));
+    int cap = 0;
+    for (struct rowblock *b = firstBlock(E->root); b; b = nextBlock(b)) {
+        if (S->numviews == cap) {
+            cap = cap ? cap * 2 : 64;
+            S->views = realloc(S->views, cap * sizeof(struct blockView));
+        }
+        S->views[S->numviews++] =
+            (struct blockView){b->numrows, b->rows, b->span, b->spanlen};
+        if (b->rows == NULL) {
+            S->bytes += b->spanlen;
+            continue;
+        }
+        b->shared = true;
+        for (int i = 0; i < b->numrows; i++) {
+            S->bytes += b->rows[i].len + 1;
+        }
+    }
+    S->map = E->map;
+    S->maplen = E->maplen;
+    if (E->loader) {
+        S->tail = E->map + E->indexed;
+        S->taillen = E->maplen - E->indexed;
+        S->bytes += S->taillen;
+    }
+    E->snapshot = S;
+    return S;
+}
+
+// done with the snapshot: the editor has its blocks to itself again
+void releaseSnapshot(struct editor *E) {
+    struct snapshot *S = E->snapshot;
+    if (S == NULL)
+        return;
+    for (struct rowblock *b = firstBlock(E->root); b; b = nextBlock(b)) {
+        b->shared = false;
+    }
+    for (int i = 0; i < S->numorphans; i++) {
+        for (int r = 0; r < S->orphans[i].numrows; r++) {
+            clearRow(&S->orphans[i].rows[r]);
+        }
+        free(S->orphans[i].rows);
+    }
+    free(S->orphans);
+    free(S->views);
+    free(S);
+    E->snapshot = NULL;
+}
+
+/* ======= PAGING ======= */
+/* a block whose rows are exactly the unmodified lines of a stretch of the *
+ * file map can be paged out: its row array is freed and only the stretch *
+ * (span) is kept. it is rescanned the next time one of its rows is needed. *
+ * trimBlocks keeps the resident row arrays within pageBudget, evicting the *
+ * least recently used blocks first */
+size_t pageBudget = PAGE_BUDGET;
+
+/* split up to max rows off the front of [*p, end), borrowing the text *
+ * *p is left at the start of the next row */
+int splitRows(char **p, char *end, struct erow *rows, int max) {
+    int n = 0;
+    char *s = *p;
+    while (n < max && s < end) {
+        char *nl = memchr(s, '\n', end - s);
+        char *eol = nl ? nl : end;
+        if (eol > s && eol[-1] == '\r') { // CRLF
+            eol--;
+        }
+        rows[n].len = eol - s;
+        rows[n].cap = 0;
+        rows[n].text = s;
+        n++;
+        // the last line terminator doesn't start a new line
+        s = nl ? nl + 1 : end;
+    }
+    *p = s;
+    return n;
+}
+
+static void lruUnlink(struct editor *E, struct rowblock *b) {
+    if (b->lruprev) {
+        b->lruprev->lrunext = b->lrunext;
+    } else {
+        E->lruhead = b->lrunext;
+    }
+    if (b->lrunext) {
+        b->lrunext->lruprev = b->lruprev;
+    } else {
+        E->lrutail = b->lruprev;
+    }
+    b->lruprev = b->lrunext = NULL;
+}
+
+static void lruPush(struct editor *E, struct rowblock *b) {
+    b->lruprev = NULL;
+    b->lrunext = E->lruhead;
+    if (E->lruhead) {
+        E->lruhead->lruprev = b;
+    } else {
+        E->lrutail = b;
+    }
+    E->lruhead = b;
+}
+
+// a new, resident block
+static struct rowblock *allocBlock(struct editor *E) {
+    struct rowblock *b = newBlock();
+    b->rows = malloc(BLOCK_BYTES);
+    lruPush(E, b);
+    E->resident++;
+    return b;
+}
+
+// unlink b from the tree and free it
+static void dropBlock(struct editor *E, struct rowblock *b) {
+    if (b->rows) {
+        lruUnlink(E, b);
+        E->resident--;
+    }
+    removeBlock(&E->root, b);
+    freeBlock(b);
+}
+
+/* b's rows, from its span. if the file was changed in place under the *
+ * map (see mapShrank) the span can hold fewer lines than it used to, the *
+ * rest come out empty */
+static void scanSpan(struct rowblock *b, struct erow *rows) {
+    char *p = b->span;
+    int n = splitRows(&p, b->span + b->spanlen, rows, b->numrows);
+    for (; n < b->numrows; n++) {
+        rows[n] = (struct erow){0, 0, ""};
+    }
+}
+
+/* make b resident and the most recently used block. anyone touching it *
+ * may change its rows, so it stops being shared with a snapshot */
+static void touchBlock(struct editor *E, struct rowblock *b) {
+    if (b->rows == NULL) {
+        b->rows = malloc(BLOCK_BYTES);
+        scanSpan(b, b->rows);
+        E->resident++;
+    } else if (E->lruhead == b) {
+        unshareBlock(E, b);
+        return;
+    } else {
+        lruUnlink(E, b);
+    }
+    unshareBlock(E, b);
+    lruPush(E, b);
+}
+
+// findBlock, paging the block in
+static struct rowblock *locate(struct editor *E, int *r) {
+    struct rowblock *b = findBlock(E->root, r);
+    if (b)
+        touchBlock(E, b);
+    return b;
+}
+
+/* the rows of b without paging it in *
+ * scratch needs room for b->numrows rows */
+struct erow *peekBlock(struct rowblock *b, struct erow *scratch) {
+    if (b->rows)
+        return b->rows;
+    scanSpan(b, scratch);
+    return scratch;
+}
+
+void walkTo(struct rowWalk *w, struct editor *E, int row) {
+    w->idx = row;
+    w->b = findBlock(E->root, &w->idx);
+    w->rows = peekBlock(w->b, w->scratch);
+}
+
+// the row after the last one walked, there has to be one
+struct erow *walkNext(struct rowWalk *w) {
+    while (w->idx == w->b->numrows) {
+        w->b = nextBlock(w->b);
+        w->idx = 0;
+        w->rows = peekBlock(w->b, w->scratch);
+    }
+    return &w->rows[w->idx++];
+}
+
+// page b out if rescanning its span would give back the same rows
+static bool evictBlock(struct editor *E, struct rowblock *b) {
+    char *start = b->rows[0].text;
+    char *end = E->map + E->maplen;
+    if (E->map == NULL || start < E->map || start >= end ||
+        (start != E->map && start[-1] != '\n'))
+        return false;
+    struct erow check[ROWBLOCK_MAX];
+    char *p = start;
+    if (splitRows(&p, end, check, b->numrows) != b->numrows)
+        return false;
+    for (int i = 0; i < b->numrows; i++) {
+        if (b->rows[i].cap != 0 || b->rows[i].text != check[i].text ||
+            b->rows[i].len != check[i].len)
+            return false;
+    }
+    b->span = start;
+    b->spanlen = p - start;
+    if (b->shared) { // the snapshot is still reading them
+        orphanRows(E->snapshot, b->rows, b->numrows);
+        b->shared = false;
+    } else {
+        free(b->rows);
+    }
+    b->rows = NULL;
+    lruUnlink(E, b);
+    E->resident--;
+    return true;
+}
+
+/* page out least recently used blocks until the resident rows fit in *
+ * pageBudget. the blocks holding rows keep and keep + keeplen - 1 stay */
+void trimBlocks(struct editor *E, int keep, int keeplen) {
+    int r = min(keep, E->numrows - 1);
+    struct rowblock *first = findBlock(E->root, &r);
+    r = min(keep + keeplen - 1, E->numrows - 1);
+    struct rowblock *last = findBlock(E->root, &r);
+
+    int tries = E->resident;
+    while (E->resident * BLOCK_BYTES > pageBudget && tries-- > 0) {
+        struct rowblock *b = E->lrutail;
+        if (b == first || b == last || !evictBlock(E, b)) {
+            // modified rows stay resident, stop looking at this one
+            lruUnlink(E, b);
+            lruPush(E, b);
+        }
+    }
+}
+
+// heap held by E's rows: resident blocks, and the file if it was read in
+size_t editorBytes(struct editor *E) {
+    return E->resident * BLOCK_BYTES + (E->mapped ? 0 : E->maplen);
+}
+
+/* ======= ROW BLOCKS ======= */
+/* rows live by value in blocks of a treap (rowtree.c), so inserting or *
+ * deleting a row only shifts the rows of one block. pointers returned by *
+ * getRow are invalidated by the next row insertion/deletion or trimBlocks */
+struct erow *getRow(struct editor *E, int rownum) {
+    assert(rownum >= 0 && rownum < E->numrows);
+    struct rowblock *b = locate(E, &rownum);
+    return &b->rows[rownum];
+}
+
+// move the rows [at, numrows) of b to a new block placed after b
+static struct rowblock *splitBlock(struct editor *E, struct rowblock *b,
+                                   int at) {
+    struct rowblock *upper = allocBlock(E);
+    int moved = b->numrows - at;
+    memcpy(upper->rows, b->rows + at, moved * sizeof(struct erow));
+    moveHeights(upper, 0, b, at, moved);
+    resizeBlock(b, -moved);
+    upper->numrows = moved;
+    insertBlockAfter(&E->root, b, upper);
+    return upper;
+}
+
+// drop b if it emptied, or fold its successor into it if both are sparse
+static void settleBlock(struct editor *E, struct rowblock *b) {
+    if (b->numrows == 0) {
+        dropBlock(E, b);
+        return;
+    }
+    if (b->numrows >= ROWBLOCK_MAX / 4)
+        return;
+    struct rowblock *next = nextBlock(b);
+    if (next == NULL || b->numrows + next->numrows > ROWBLOCK_FILL)
+        return;
+    int moved = next->numrows;
+    unshareBlock(E, next); // its rows are about to be b's
+    struct erow *rows = peekBlock(next, b->rows + b->numrows);
+    if (rows != b->rows + b->numrows) {
+        memcpy(b->rows + b->numrows, rows, moved * sizeof(struct erow));
+    }
+    moveHeights(b, b->numrows, next, 0, moved);
+    resizeBlock(next, -moved);
+    resizeBlock(b, moved);
+    dropBlock(E, next);
+}
+
 /* insert a new row in the editor *
  * must be possible (ex. cannot insert row 13 in a 5-row editor) *
  * CAN insert ONE row past the last row(ex. new row 5 into a 5-row editor) */
 void newRow(struct editor *E, int rownum) {
-    assert(rownum <= E->numrows);
+    assert(rownum >= 0 && rownum <= E->numrows);
 
-    E->rowarray =
-        realloc(E->rowarray, (E->numrows + 1) * sizeof(struct erow *));
-    E->rowarray[E->numrows] = NULL;
-    int shift = E->numrows - rownum;
-    memmove(E->rowarray + rownum + 1, E->rowarray + rownum,
-            shift * sizeof(struct erow *));
+    struct rowblock *b;
+    int idx = rownum;
+    if (E->root == NULL) {
+        b = allocBlock(E);
+        insertBlockAfter(&E->root, NULL, b);
+    } else {
+        b = locate(E, &idx);
+    }
+    if (b->numrows == ROWBLOCK_MAX) {
+        struct rowblock *upper = splitBlock(E, b, ROWBLOCK_MAX / 2);
+        if (idx > b->numrows) {
+            idx -= b->numrows;
+            b = upper;
+        }
+    }
+    memmove(b->rows + idx + 1, b->rows + idx,
+            (b->numrows - idx) * sizeof(struct erow));
+    moveHeights(b, idx + 1, b, idx, b->numrows - idx);
+    forgetHeights(b, idx, 1);
 
-    struct erow *new_row = malloc(sizeof(struct erow));
+    struct erow *new_row = &b->rows[idx];
     new_row->len = 0;
-    new_row->text = malloc(sizeof(char));
-    new_row->text[0] = '\0';
+    new_row->cap = 0;
+    new_row->text = "";
 
-    E->rowarray[rownum] = new_row;
+    resizeBlock(b, 1);
     E->numrows++;
 }
 
+/* move count rows into the editor, starting at rownum *
+ * the editor takes ownership of the rows' text */
+void insertRows(struct editor *E, int rownum, struct erow *rows, int count) {
+    assert(rownum >= 0 && rownum <= E->numrows);
+    if (count == 0)
+        return;
+
+    struct rowblock *prev = NULL;
+    if (E->root != NULL) {
+        int idx = rownum;
+        struct rowblock *b = locate(E, &idx);
+        if (b->numrows + count <= ROWBLOCK_MAX) { // fits in place
+            memmove(b->rows + idx + count, b->rows + idx,
+                    (b->numrows - idx) * sizeof(struct erow));
+            memcpy(b->rows + idx, rows, count * sizeof(struct erow));
+            moveHeights(b, idx + count, b, idx, b->numrows - idx);
+            forgetHeights(b, idx, count);
+            resizeBlock(b, count);
+            E->numrows += count;
+            return;
+        }
+        if (idx == 0) {
+            prev = prevBlock(b);
+        } else {
+            if (idx < b->numrows) {
+                splitBlock(E, b, idx);
+            }
+            prev = b;
+        }
+    }
+
+    for (int i = 0; i < count; i += ROWBLOCK_FILL) {
+        struct rowblock *b = allocBlock(E);
+        b->numrows = min(ROWBLOCK_FILL, count - i);
+        memcpy(b->rows, rows + i, b->numrows * sizeof(struct erow));
+        insertBlockAfter(&E->root, prev, b);
+        prev = b;
+    }
+    E->numrows += count;
+}
+
+// delete (and free) count rows starting at rownum
+void deleteRows(struct editor *E, int rownum, int count) {
+    assert(rownum >= 0 && rownum + count <= E->numrows);
+    while (count > 0) {
+        int idx = rownum;
+        struct rowblock *b = findBlock(E->root, &idx);
+        if (b->rows == NULL && idx == 0 && count >= b->numrows) {
+            // a whole paged out block, nothing to free row by row
+            count -= b->numrows;
+            E->numrows -= b->numrows;
+            resizeBlock(b, -b->numrows);
+            dropBlock(E, b);
+            continue;
+        }
+        touchBlock(E, b);
+        int n = min(count, b->numrows - idx);
+        for (int i = idx; i < idx + n; i++) {
+            clearRow(&b->rows[i]);
+        }
+        memmove(b->rows + idx, b->rows + idx + n,
+                (b->numrows - idx - n) * sizeof(struct erow));
+        moveHeights(b, idx, b, idx + n, b->numrows - idx - n);
+        resizeBlock(b, -n);
+        E->numrows -= n;
+        count -= n;
+        settleBlock(E, b);
+    }
+}
+
 /* insert \n at the specified postion *
  * moves everything past the \n to a new row */
 void insertNewline(struct editor *E, int row, int col) {
     assert(row < E->numrows);
-    assert(col <= E->rowarray[row]->len);
+    assert(col <= getRow(E, row)->len);
 
     newRow(E, row + 1);
-    struct erow *curr_row = E->rowarray[row];
-    struct erow *new_row = E->rowarray[row + 1];
+    struct erow *curr_row = getRow(E, row);
+    struct erow *new_row = getRow(E, row + 1);
 
-    new_row->text = realloc(new_row->text, curr_row->len - col + 1);
-    strncpy(new_row->text, curr_row->text + col, curr_row->len - col + 1);
-    new_row->len = curr_row->len - col;
+    if (curr_row->cap == 0) { // borrowed text can be shared by both halves
+        new_row->text = curr_row->text + col;
+        new_row->len = curr_row->len - col;
+        curr_row->len = col;
+        return;
+    }
+    insertString(new_row, 0, curr_row->text + col, curr_row->len - col);
 
     curr_row->text[col] = '\0';
     curr_row->len = col;
@@ -153,12 +596,7 @@ void deleteRow(struct editor *E, int rownum) {
     assert(E->numrows > rownum);
     if (E->numrows == 1)
         return;
-    // realloc?
-    freeRow(E->rowarray + rownum);
-    int shift = E->numrows - 1 - rownum;
-    memmove(E->rowarray + rownum, E->rowarray + rownum + 1,
-            shift * sizeof(struct erow *));
-    E->numrows--;
+    deleteRows(E, rownum, 1);
 }
 
 void freeRowarr(struct erow **rowarr, int len) {
@@ -167,86 +605,96 @@ void freeRowarr(struct erow **rowarr, int len) {
     }
 }
 
-struct erow **copyRange(struct erow **rows, point start, point end) {
+static struct erow *copyOf(char *text, int len) {
+    struct erow *row = malloc(sizeof(struct erow));
+    row->len = len;
+    row->cap = len + 1;
+    row->text = malloc(row->cap);
+    memcpy(row->text, text, len);
+    row->text[len] = '\0';
+    return row;
+}
+
+struct erow **copyRange(struct editor *E, point start, point end) {
     int numrows = end.r - start.r + 1;
     struct erow **ret = calloc(sizeof(struct erow *), numrows);
+    struct erow *row = getRow(E, start.r);
     if (numrows == 1) {
-        ret[0] = malloc(sizeof(struct erow));
-        ret[0]->len = end.c - start.c + 1;
-        ret[0]->text = calloc(sizeof(char), ret[0]->len);
-        strncpy(ret[0]->text, rows[start.r]->text + start.c, ret[0]->len);
+        ret[0] = copyOf(row->text + start.c, end.c - start.c + 1);
         return ret;
     }
     // copy first row starting from start.c
-    ret[0] = malloc(sizeof(struct erow));
-    ret[0]->len = rows[start.r]->len - start.c;
-    ret[0]->text = calloc(sizeof(char), ret[0]->len);
-    strncpy(ret[0]->text, rows[start.r]->text + start.c, ret[0]->len);
+    ret[0] = copyOf(row->text + start.c, row->len - start.c);
     // copy middle rows
     for (int i = 1; i < numrows - 1; i++) {
-        ret[i] = malloc(sizeof(struct erow));
-        ret[i]->len = rows[start.r + i]->len;
-        ret[i]->text = calloc(sizeof(char), ret[i]->len);
-        strncpy(ret[i]->text, rows[start.r + i]->text, ret[i]->len);
+        row = getRow(E, start.r + i);
+        ret[i] = copyOf(row->text, row->len);
     }
     // copy last row ending at end.c
-    ret[numrows - 1] = malloc(sizeof(struct erow));
-    ret[numrows - 1]->len = end.c + 1;
-    ret[numrows - 1]->text = calloc(sizeof(char), ret[numrows - 1]->len);
-    strncpy(ret[numrows - 1]->text, rows[end.r]->text, ret[numrows - 1]->len);
+    row = getRow(E, end.r);
+    ret[numrows - 1] = copyOf(row->text, end.c + 1);
 
     return ret;
 }
 
+struct erow **copyRows(struct erow **rows, int numrows) {
+    struct erow **ret = calloc(sizeof(struct erow *), numrows);
+    for (int i = 0; i < numrows; i++) {
+        ret[i] = copyOf(rows[i]->text, rows[i]->len);
+    }
+    return ret;
+}
+
 void deleteRange(struct editor *E, point start, point end) {
-    struct erow *start_row = E->rowarray[start.r];
-    struct erow *end_row = E->rowarray[end.r];
+    struct erow *start_row = getRow(E, start.r);
+    struct erow *end_row = getRow(E, end.r);
 
-    int shifted = E->numrows - end.r;
     int deleted = end.r - start.r;
 
     // append start_row to the front of end_row
     int insert_pos = min(end_row->len, end.c + 1);
+    if (start.c == 0 && end_row->cap == 0) { // just borrow less of the file
+        end_row->text += insert_pos;
+        end_row->len -= insert_pos;
+        deleteRows(E, start.r, deleted);
+        return;
+    }
+    ownRow(end_row, end_row->len);
     insertString(end_row, insert_pos, start_row->text, start.c);
 
     memmove(end_row->text, end_row->text + insert_pos,
             max(0, end_row->len - insert_pos) * sizeof(char));
     end_row->len -= insert_pos;
     assert(end_row->len >= 0);
+    end_row->text[end_row->len] = '\0';
 
-    // free/delete the locations that will be overwritten
-    freeRowarr(E->rowarray + start.r, deleted);
-    E->numrows -= deleted;
-
-    // shift rows to fill the freed entries
-    memmove(E->rowarray + start.r, E->rowarray + end.r,
-            shifted * sizeof(struct erow *));
+    // free/delete the rows that were merged into end_row
+    deleteRows(E, start.r, deleted);
 }
 
 void insertRange(struct editor *E, point at, struct erow **rows, int numrows) {
     assert(at.r >= 0 && at.r < E->numrows);
 
     if (numrows == 1) {
-        insertString(E->rowarray[at.r], at.c, rows[0]->text, rows[0]->len);
+        insertString(getRow(E, at.r), at.c, rows[0]->text, rows[0]->len);
         return;
     }
 
     insertNewline(E, at.r, at.c);
-    insertString(E->rowarray[at.r], at.c, rows[0]->text, rows[0]->len);
-
-    int shifted = E->numrows - at.r;
-    E->numrows += numrows - 2;
-    E->rowarray = realloc(E->rowarray, E->numrows * sizeof(struct erow *));
-    memmove(E->rowarray + at.r + numrows - 1, E->rowarray + at.r + 1,
-            shifted * sizeof(struct erow *));
-
-    for (int i = 1; i < numrows - 1; i++) {
-        E->rowarray[at.r + i] = malloc(sizeof(struct erow));
-        E->rowarray[at.r + i]->len = 0;
-        insertString(E->rowarray[at.r + i], 0, rows[i]->text, rows[i]->len);
+    insertString(getRow(E, at.r), at.c, rows[0]->text, rows[0]->len);
+
+    int middle = numrows - 2;
+    struct erow *copies = malloc(max(1, middle) * sizeof(struct erow));
+    for (int i = 0; i < middle; i++) {
+        copies[i].len = 0;
+        copies[i].cap = 0;
+        copies[i].text = "";
+        insertString(&copies[i], 0, rows[i + 1]->text, rows[i + 1]->len);
     }
+    insertRows(E, at.r + 1, copies, middle);
+    free(copies);
 
-    insertString(E->rowarray[at.r + numrows - 1], 0, rows[numrows - 1]->text,
+    insertString(getRow(E, at.r + numrows - 1), 0, rows[numrows - 1]->text,
                  rows[numrows - 1]->len);
 }
 
@@ -255,51 +703,303 @@ void copyToClipboard(struct editor *E, point start, point end) {
     free(E->clipboard);
 
     E->clipboard_len = end.r - start.r + 1;
-    E->clipboard = copyRange(E->rowarray, start, end);
+    E->clipboard = copyRange(E, start, end);
+}
+
+/* ======= LISTENERS ======= */
+void addListener(struct editor *E, editListener *fn, void *arg) {
+    struct listener *l = malloc(sizeof(struct listener));
+    l->fn = fn;
+    l->arg = arg;
+    l->next = E->listeners;
+    E->listeners = l;
+}
+
+void removeListener(struct editor *E, editListener *fn, void *arg) {
+    for (struct listener **p = &E->listeners; *p; p = &(*p)->next) {
+        if ((*p)->fn == fn && (*p)->arg == arg) {
+            struct listener *l = *p;
+            *p = l->next;
+            free(l);
+            return;
+        }
+    }
+}
+
+void notifyEdit(struct editor *E, int row, int oldrows, int newrows) {
+    for (struct listener *l = E->listeners; l; l = l->next) {
+        l->fn(l->arg, row, oldrows, newrows);
+    }
+}
+
+// map the file into E->map, or read it onto the heap if it can't be mapped
+static void loadFile(struct editor *E, int fd) {
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        E->maplen = st.st_size;
+        E->map = mmap(NULL, E->maplen, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (E->map != MAP_FAILED) {
+            E->mapped = true;
+            return;
+        }
+    }
+    // pipes, special files, mmap failures
+    size_t cap = 4096;
+    E->map = malloc(cap);
+    E->maplen = 0;
+    ssize_t n;
+    while ((n = read(fd, E->map + E->maplen, cap - E->maplen)) > 0) {
+        E->maplen += n;
+        if (E->maplen == cap) {
+            cap *= 2;
+            E->map = realloc(E->map, cap);
+        }
+    }
+}
+
+/* ======= LOADING ======= */
+/* the file is indexed on a background thread, which hands finished spans *
+ * over in batches. only the main thread touches the row tree: it adopts *
+ * them as blocks at the end of the buffer (see pollLoad) */
+struct loader {
+    pthread_t thread;
+    bool joined; // thread has ended (or never started)
+    pthread_mutex_t lock;
+    struct indexer *ix; // loader thread only
+
+    // under lock
+    struct span *spans; // indexed, not yet adopted
+    int numspans;
+    int capspans;
+    size_t done; // bytes indexed
+    bool finished;
+    bool cancel;
+};
+
+// bytes indexed before the first screen is drawn, and per batch after it
+#define LOAD_FIRST (1 << 20)
+#define LOAD_BATCH (64 << 20)
+
+// append spans to the end of the buffer, as paged out blocks
+static void adoptSpans(struct editor *E, struct span *spans, int numspans) {
+    struct rowblock *prev = lastBlock(E->root);
+    for (int i = 0; i < numspans; i++) {
+        struct rowblock *b = newBlock();
+        b->span = spans[i].start;
+        b->spanlen = spans[i].len;
+        b->numrows = spans[i].numrows;
+        insertBlockAfter(&E->root, prev, b);
+        E->numrows += b->numrows;
+        E->indexed = spans[i].start + spans[i].len - E->map;
+        prev = b;
+    }
+}
+
+static void *loadThread(void *arg) {
+    struct loader *L = arg;
+    bool finished = false;
+    while (!finished) {
+        struct span *spans;
+        int numspans = indexMore(L->ix, LOAD_BATCH, &spans);
+        finished = indexDone(L->ix);
+
+        pthread_mutex_lock(&L->lock);
+        if (L->numspans + numspans > L->capspans) {
+            L->capspans = max(L->capspans * 2, L->numspans + numspans);
+            L->spans = realloc(L->spans, L->capspans * sizeof(struct span));
+        }
+        memcpy(L->spans + L->numspans, spans, numspans * sizeof(struct span));
+        L->numspans += numspans;
+        L->done = indexedBytes(L->ix);
+        L->finished = finished;
+        if (L->cancel)
+            finished = true;
+        pthread_mutex_unlock(&L->lock);
+        free(spans);
+    }
+    return NULL;
+}
+
+static void joinLoader(struct loader *L) {
+    if (!L->joined) {
+        pthread_join(L->thread, NULL);
+        L->joined = true;
+    }
+}
+
+static void endLoad(struct editor *E) {
+    struct loader *L = E->loader;
+    joinLoader(L);
+    pthread_mutex_destroy(&L->lock);
+    freeIndexer(L->ix);
+    free(L->spans);
+    free(L);
+    E->loader = NULL;
+}
+
+/* adopt whatever the loader has indexed since the last call *
+ * returns true if rows were added */
+bool pollLoad(struct editor *E) {
+    struct loader *L = E->loader;
+    if (L == NULL)
+        return false;
+    pthread_mutex_lock(&L->lock);
+    int numspans = L->numspans;
+    adoptSpans(E, L->spans, numspans);
+    L->numspans = 0;
+    bool finished = L->finished;
+    pthread_mutex_unlock(&L->lock);
+    if (finished) {
+        endLoad(E);
+    }
+    return numspans > 0;
+}
+
+// wait for the rest of the file, for anything that needs all of it
+void finishLoad(struct editor *E) {
+    if (E->loader == NULL)
+        return;
+    joinLoader(E->loader);
+    pollLoad(E);
+}
+
+// percentage of the file loaded so far, -1 once it is all in
+int loadProgress(struct editor *E) {
+    struct loader *L = E->loader;
+    if (L == NULL)
+        return -1;
+    pthread_mutex_lock(&L->lock);
+    int percent = L->done * 100 / E->maplen;
+    pthread_mutex_unlock(&L->lock);
+    return percent;
 }
 
 struct editor *editorFromFile(char *filename) {
     struct editor *E = malloc(sizeof(struct editor));
     E->numrows = 0;
-    E->rowarray = NULL;
-    FILE *fp = fopen(filename, "r");
-    newRow(E, 0);
-    if (!fp) { // NEW FILE
+    E->root = NULL;
+    E->clipboard_len = 0;
+    E->clipboard = NULL;
+    E->map = NULL;
+    E->maplen = 0;
+    E->mapped = false;
+    E->resident = 0;
+    E->lruhead = NULL;
+    E->lrutail = NULL;
+    E->loader = NULL;
+    E->listeners = NULL;
+    E->wrapwidth = 0;
+    E->indexed = 0;
+    E->snapshot = NULL;
+
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) { // NEW FILE
+        newRow(E, 0);
         return E;
     }
-
-    int c;
-    while ((c = fgetc(fp)) != EOF) {
-        struct erow *curr_row = E->rowarray[E->numrows - 1];
-        if (c == '\n') {
-            newRow(E, E->numrows);
-        } else if (c != '\r') {
-            insertChar(curr_row, curr_row->len, c);
+    loadFile(E, fd);
+    close(fd);
+
+    // blocks start out paged out, as spans of the map
+    // index enough for the first screen here, the rest in the background
+    struct indexer *ix = newIndexer(E->map, E->maplen);
+    while (E->numrows == 0 && !indexDone(ix)) {
+        struct span *spans;
+        int numspans = indexMore(ix, LOAD_FIRST, &spans);
+        adoptSpans(E, spans, numspans);
+        free(spans);
+    }
+    if (indexDone(ix)) {
+        freeIndexer(ix);
+    } else {
+        struct loader *L = calloc(1, sizeof(struct loader));
+        pthread_mutex_init(&L->lock, NULL);
+        L->ix = ix;
+        L->done = indexedBytes(ix);
+        E->loader = L;
+        if (pthread_create(&L->thread, NULL, loadThread, L) != 0) {
+            L->joined = true;
+            loadThread(L); // no thread, load it all now
+            pollLoad(E);
         }
     }
-    // don't create a new line for the last line terminator
-    // for a non-empty file
-    if (E->numrows > 1 && E->rowarray[E->numrows - 1]->len == 0) {
-        deleteRow(E, E->numrows - 1);
+    if (E->numrows == 0) { // empty file
+        newRow(E, 0);
     }
-    fclose(fp);
     return E;
 }
 
-void editorSaveFile(struct editor *E, char *filename) {
-    FILE *fp = fopen(filename, "w");
-    for (int i = 0; i < E->numrows; i++) {
-        fprintf(fp, "%.*s\n", E->rowarray[i]->len, E->rowarray[i]->text);
+/* copy the mapped file onto the heap and repoint the rows borrowing it *
+ * truncating a mapped file would pull the pages out from under them. *
+ * not while a snapshot of the buffer is being saved */
+void unmapFile(struct editor *E) {
+    if (!E->mapped)
+        return;
+    assert(E->snapshot == NULL);
+    finishLoad(E); // the loader reads the map
+    char *copy = malloc(E->maplen);
+    memcpy(copy, E->map, E->maplen);
+    for (struct rowblock *b = firstBlock(E->root); b; b = nextBlock(b)) {
+        if (b->rows == NULL) {
+            b->span = copy + (b->span - E->map);
+            continue;
+        }
+        for (int i = 0; i < b->numrows; i++) {
+            struct erow *row = &b->rows[i];
+            if (row->cap == 0 && row->text >= E->map &&
+                row->text < E->map + E->maplen) {
+                row->text = copy + (row->text - E->map);
+            }
+        }
+    }
+    munmap(E->map, E->maplen);
+    E->map = copy;
+    E->mapped = false;
+}
+
+/* the file was cut down to size bytes in place, under the map. touching *
+ * the pages past its new end would fault (SIGBUS), so zeroed ones are put *
+ * there instead. rows still borrowing the map read whatever it holds now *
+ * until the buffer is reloaded */
+void mapShrank(struct editor *E, long long size) {
+    if (!E->mapped || size >= (long long)E->maplen)
+        return;
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t from = (size + page - 1) / page * page;
+    if (from < E->maplen) {
+        mmap(E->map + from, E->maplen - from, PROT_READ,
+             MAP_PRIVATE | MAP_ANON | MAP_FIXED, -1, 0);
     }
-    fclose(fp);
 }
 
 void destroyEditor(struct editor **ptr) {
     struct editor *E = *ptr;
-    freeRowarr(E->rowarray, E->numrows);
+    assert(E->snapshot == NULL); // the save using it has to end first
+    if (E->loader) {
+        pthread_mutex_lock(&E->loader->lock);
+        E->loader->cancel = true;
+        pthread_mutex_unlock(&E->loader->lock);
+        endLoad(E);
+    }
+    for (struct rowblock *b = firstBlock(E->root); b; b = nextBlock(b)) {
+        for (int i = 0; b->rows && i < b->numrows; i++) {
+            clearRow(&b->rows[i]);
+        }
+    }
+    freeBlockTree(E->root);
     freeRowarr(E->clipboard, E->clipboard_len);
+    while (E->listeners) {
+        struct listener *next = E->listeners->next;
+        free(E->listeners);
+        E->listeners = next;
+    }
+
+    if (E->mapped) {
+        munmap(E->map, E->maplen);
+    } else {
+        free(E->map);
+    }
 
-    free(E->rowarray);
     free(E->clipboard);
 
     free(E);
@@ -1,6 +1,9 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stddef.h>
+
+#include "rowtree.h"
 
 typedef struct point {
     int r, c;
@@ -19,32 +22,122 @@ point minPoint(point p1, point p2);
 
 struct erow {
     int len;
+    int cap; // bytes allocated for text, 0 if borrowed from the file map
     char *text;
 };
 
+/* told about every edit made through a command: rows [row, row + oldrows) *
+ * were replaced by [row, row + newrows) */
+typedef void editListener(void *arg, int row, int oldrows, int newrows);
+
+struct listener {
+    editListener *fn;
+    void *arg;
+    struct listener *next;
+};
+
+// a block's rows as a snapshot found them
+struct blockView {
+    int numrows;
+    struct erow *rows; // NULL if the block was paged out
+    char *span; // where the rows are in the map, if so
+    size_t spanlen;
+};
+
+/* the buffer frozen as it was at one point, to write out while editing *
+ * carries on. resident blocks are shared with the editor rather than *
+ * copied: the first change to one after the snapshot gives the editor a *
+ * copy and leaves the original rows to the snapshot */
+struct snapshot {
+    struct blockView *views;
+    int numviews;
+    char *map; // the editor's, for telling which rows borrow it
+    size_t maplen;
+    char *tail; // the end of the file, not indexed into rows yet
+    size_t taillen;
+    size_t bytes; // roughly what writing it all out comes to
+    struct blockView *orphans; // rows the editor has moved on from
+    int numorphans;
+    int caporphans;
+};
+
 struct editor {
     int numrows;
-    struct erow **rowarray;
+    struct rowblock *root; // rows, in blocks (see rowtree.h)
     int clipboard_len; // # of rows in the clipboard
     struct erow **clipboard;
+
+    char *map; // contents of the file, unmodified rows point into it
+    size_t maplen;
+    bool mapped; // map came from mmap (or was read onto the heap)
+
+    int resident; // blocks with their rows in memory
+    struct rowblock *lruhead;
+    struct rowblock *lrutail;
+
+    struct loader *loader; // indexing the rest of the file, NULL when done
+
+    struct listener *listeners;
+
+    int wrapwidth; // width the blocks' heights are for, 0 if not kept
+
+    size_t indexed; // bytes of the map adopted as blocks
+    struct snapshot *snapshot; // being saved, NULL if none
+};
+
+/* rows in order from walkTo on, peeked so going through them doesn't page *
+ * the file in. the rows are good until the buffer is next edited */
+struct rowWalk {
+    struct rowblock *b;
+    int idx;
+    struct erow *rows;
+    struct erow scratch[ROWBLOCK_MAX];
 };
 
+// bytes of row arrays kept in memory before blocks are paged out
+#define PAGE_BUDGET (64 << 20)
+extern size_t pageBudget;
+
 void freeRowarr(struct erow **rowarr, int len);
 
+int splitRows(char **p, char *end, struct erow *rows, int max);
+
+struct erow *getRow(struct editor *E, int rownum);
+struct erow *peekBlock(struct rowblock *b, struct erow *scratch);
+void walkTo(struct rowWalk *w, struct editor *E, int row);
+struct erow *walkNext(struct rowWalk *w);
+void trimBlocks(struct editor *E, int keep, int keeplen);
+size_t editorBytes(struct editor *E);
+
 void deleteChar(struct erow *row, int pos);
 void insertChar(struct erow *row, int pos, char c);
 void insertString(struct erow *row, int pos, char *str, int len);
 
+void newRow(struct editor *E, int rownum);
 void deleteRow(struct editor *E, int rownum);
+void insertRows(struct editor *E, int rownum, struct erow *rows, int count);
+void deleteRows(struct editor *E, int rownum, int count);
 void insertNewline(struct editor *E, int row, int col);
 
-struct erow **copyRange(struct erow **rows, point start, point end);
+struct erow **copyRange(struct editor *E, point start, point end);
+struct erow **copyRows(struct erow **rows, int numrows);
 
 void deleteRange(struct editor *E, point start, point end);
 void insertRange(struct editor *E, point at, struct erow **rows, int numrows);
 
 void copyToClipboard(struct editor *E, point start, point end);
 
+void addListener(struct editor *E, editListener *fn, void *arg);
+void removeListener(struct editor *E, editListener *fn, void *arg);
+void notifyEdit(struct editor *E, int row, int oldrows, int newrows);
+
+struct snapshot *takeSnapshot(struct editor *E);
+void releaseSnapshot(struct editor *E);
+
 struct editor *editorFromFile(char *filename);
-void editorSaveFile(struct editor *E, char *filename);
+bool pollLoad(struct editor *E);
+void finishLoad(struct editor *E);
+int loadProgress(struct editor *E);
+void unmapFile(struct editor *E);
+void mapShrank(struct editor *E, long long size);
 void destroyEditor(struct editor **ptr);
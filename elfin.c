@@ -1,24 +1,50 @@
+#include "diff.h"
 #include "display.h"
 #include "editor.h"
+#include "journal.h"
+#include "save.h"
+#include "search.h"
 
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include <fcntl.h>
+#include <poll.h>
 #include <signal.h>
 #include <sys/errno.h>
 #include <sys/ioctl.h>
 #include <termios.h>
+#include <time.h>
 #include <unistd.h>
 
-#define szstr(str) str, sizeof(str)
+#ifdef BENCH // linked into bench.c, which has its own main
+#define main elfinMain
+#endif
+
+#define szstr(str) str, sizeof(str) - 1
 #define UNUSED(x) (void)(x)
+// bytes of input read at a time
+#define INPUT_SIZE 4096
+// how long the rest of an escape sequence gets to turn up
+#define ESC_WAIT_MS 50
+// how often the screen is redrawn while loading or saving in the background
+#define PROGRESS_MS 100
+// memory the buffers off screen can hold before the least recently used close
+#define BUFFER_BUDGET (256 << 20)
+// how long a paste can stall before it's taken to be over
+#define PASTE_WAIT_MS 1000
+// least time between frames, however fast keys or resizes come in
+#define FRAME_MS 16
+// how long the file has to be left alone after changing to be reloaded
+#define WATCH_SETTLE_MS 100
 
 enum KEY_ACTION {
     KEY_NULL = 0,
     TAB = 9,
     ENTER = 13,
+    CTRL_R = 18,
     ESC = 27,
     BACKSPACE = 127,
     ARROW_LEFT = 1000,
@@ -29,10 +55,11 @@ enum KEY_ACTION {
     HOME_KEY,
     END_KEY,
     PAGE_UP,
-    PAGE_DOWN
+    PAGE_DOWN,
+    PASTE // ESC [ 200 ~, the start of a bracketed paste
 };
 
-struct editorInterface *I;          // THE editor used across all files
+struct editorInterface *I; // the buffer on screen, first of the open ones
 static struct termios orig_termios; // restore at exit
 
 /* ======= terminal setup ======= */
@@ -49,10 +76,139 @@ int countDigits(int n) {
     return out;
 }
 
+static long long nowMs(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000LL + t.tv_nsec / 1000000;
+}
+
+/* ======= JOURNAL ======= */
+// do the journal over again, then carry on journaling to it
+void replay(void) {
+    finishLoad(I->E);
+    point cursor = {0, 0};
+    if (!replayJournal(I->journal, I->E, &I->undo, &cursor)) {
+        snprintf(I->notice, sizeof(I->notice),
+                 "journal cut short, replayed what was there");
+    }
+    I->cursor.r = min(cursor.r, I->E->numrows - 1);
+    I->cursor.c = min(cursor.c, getRow(I->E, I->cursor.r)->len);
+    I->undo.journal = I->journal;
+}
+
+// pick up what the last session left, if anything
+void startJournal(void) {
+    I->journal = openJournal(I->filename);
+    I->askReplay = false;
+    switch (checkJournal(I->journal)) {
+    case JOURNAL_EDITS: // journaling starts once they've answered
+        I->askReplay = true;
+        snprintf(I->notice, sizeof(I->notice),
+                 "found unsaved edits, replay them? (y/n)");
+        return;
+    case JOURNAL_HISTORY:
+        replay();
+        return;
+    case JOURNAL_STALE:
+        snprintf(I->notice, sizeof(I->notice),
+                 "journal is for another version of the file, ignored");
+        break;
+    case JOURNAL_NONE:
+        break;
+    }
+    I->undo.journal = I->journal;
+}
+
+void answerReplay(int c) {
+    if (c == 'y') {
+        replay();
+    } else if (c == 'n') {
+        discardJournal(I->journal);
+        I->undo.journal = I->journal;
+    } else {
+        snprintf(I->notice, sizeof(I->notice),
+                 "found unsaved edits, replay them? (y/n)");
+        return;
+    }
+    I->askReplay = false;
+}
+
+/* ======= SAVING ======= */
+// human readable byte count
+void formatSize(char *buf, size_t size, double bytes) {
+    const char *units[] = {"B", "KB", "MB", "GB", "TB"};
+    int u = 0;
+    while (bytes >= 1024 && u < 4) {
+        bytes /= 1024;
+        u++;
+    }
+    snprintf(buf, size, u == 0 ? "%.0f%s" : "%.1f%s", bytes, units[u]);
+}
+
+/* start saving to I->filename in the background. the buffer is saved as *
+ * it is now, edits made meanwhile are left for the next save */
+void saveBuffer(void) {
+    if (I->save) {
+        snprintf(I->notice, sizeof(I->notice), "still writing the last save");
+        return;
+    }
+    sealUndo(&I->undo); // so the state saved stays a record of its own
+    I->undo.saving = undoVersion(&I->undo);
+    I->save = startSave(I->E, I->filename);
+}
+
+// wait for the save to end, reporting the outcome in the status line
+bool endSave(void) {
+    struct saveResult res = finishSave(I->E, I->save);
+    I->save = NULL;
+    if (res.error != 0) {
+        snprintf(I->notice, sizeof(I->notice), "save failed (%s): %s",
+                 res.step, strerror(res.error));
+        return false;
+    }
+    char size[16];
+    char rate[16];
+    formatSize(size, sizeof(size), res.bytes);
+    formatSize(rate, sizeof(rate),
+               res.seconds > 0 ? res.bytes / res.seconds : res.bytes);
+    snprintf(I->notice, sizeof(I->notice), "written %s in %.0fms (%s/s)",
+             size, res.seconds * 1000, rate);
+    I->undo.saved = I->undo.saving;
+    // a replayed journal starts off sealed, so the run typed so far ends here
+    sealUndo(&I->undo);
+    journalSaved(I->journal, &I->undo);
+    stampFile(I->filename, &I->stamp); // so the watch going off isn't news
+    return true;
+}
+
+// see if the saves in the background have finished, in any buffer
+void pollSave(void) {
+    struct editorInterface *shown = I;
+    for (I = shown; I; I = I->next) {
+        if (I->save && saveDone(I->save)) {
+            endSave();
+        }
+    }
+    I = shown;
+}
+
+bool saving(void) {
+    for (struct editorInterface *b = I; b; b = b->next) {
+        if (b->save)
+            return true;
+    }
+    return false;
+}
+
 void init_I(char* filename) {
 	I = malloc(sizeof(struct editorInterface));
     I->filename = strdup(filename);
+    stampFile(I->filename, &I->stamp);
+    I->watch = watchFile(I->filename);
+    I->changedAt = 0;
     I->E = editorFromFile(I->filename);
+    I->syntax = openHighlighter(I->E, I->filename);
+    I->layout = openLayouts(I->E);
     I->toprow = 0;
     I->mode = VIEW;
     I->coloff = max(4, countDigits(I->E->numrows) + 2);
@@ -60,21 +216,287 @@ void init_I(char* filename) {
     I->cursor.c = 0;
     I->anchor.r = -1;
     I->cmd.msg.text = strdup("");
-    I->cmdStack = NULL;
-    resize(0);
+    I->cmd.msg.cap = 1;
+    initUndo(&I->undo);
+    I->notice[0] = '\0';
+    I->matches = NULL;
+    I->searchBack = false;
+    I->hlsearch = false;
+    I->save = NULL;
+    initScreen(&I->screen, palette);
+    I->next = NULL;
+    startJournal();
+    resize();
 }
 
 void destroy_I(void) {
+    if (I->save) { // quitting (or closing the buffer) waits for it
+        endSave();
+    }
+    freeMatches(I->matches);
+    closeWatch(I->watch);
+    closeHighlighter(I->syntax);
+    closeLayouts(I->layout);
     destroyEditor(&I->E);
     free(I->cmd.msg.text);
-    free(I->status.buf);
+    freeScreen(&I->screen);
 	free(I->filename);
-    while (I->cmdStack != NULL) {
-        I->cmdStack = remove_node(I->cmdStack);
-    }
+    I->undo.journal = NULL;
+    closeJournal(I->journal);
+    freeUndo(&I->undo);
     free(I);
 }
 
+/* ======= BUFFERS ======= */
+/* files opened with :e stay open, undo history, cursor and all, so going *
+ * back to one is just a redraw. the ones off screen are closed least *
+ * recently used first once they hold more than BUFFER_BUDGET, unless *
+ * they have edits that haven't been saved */
+static bool sameFile(char *a, char *b) {
+    char *pa = realpath(a, NULL);
+    char *pb = realpath(b, NULL);
+    bool same = pa && pb ? !strcmp(pa, pb) : !strcmp(a, b);
+    free(pa);
+    free(pb);
+    return same;
+}
+
+static bool unsaved(struct editorInterface *b) {
+    return b->save || undoVersion(&b->undo) != b->undo.saved;
+}
+
+static size_t bufferBytes(struct editorInterface *b) {
+    return editorBytes(b->E) + b->undo.bytes;
+}
+
+// close b, on screen or not
+static void closeBuffer(struct editorInterface *b) {
+    struct editorInterface *shown = I == b ? b->next : I;
+    I = b;
+    destroy_I();
+    I = shown;
+}
+
+static void trimBuffers(void) {
+    size_t total = 0;
+    for (struct editorInterface *b = I->next; b; b = b->next) {
+        total += bufferBytes(b);
+    }
+    while (total > BUFFER_BUDGET) {
+        struct editorInterface **oldest = NULL;
+        for (struct editorInterface **p = &I->next; *p; p = &(*p)->next) {
+            if (!unsaved(*p)) {
+                oldest = p;
+            }
+        }
+        if (oldest == NULL)
+            return;
+        struct editorInterface *b = *oldest;
+        *oldest = b->next;
+        total -= bufferBytes(b);
+        closeBuffer(b);
+    }
+}
+
+// put b on screen, it becomes the most recently used
+static void switchTo(struct editorInterface *b) {
+    struct editorInterface **p = &I->next;
+    while (*p != b) {
+        p = &(*p)->next;
+    }
+    *p = b->next;
+    b->next = I;
+    I = b;
+    I->mode = VIEW;
+    I->changedAt = 1; // look at the file now, it may have changed meanwhile
+    resize(); // the terminal has the other buffer on it, redraw everything
+}
+
+// :e, filename's buffer if it's open, opened if not. # is the last one
+void editFile(char *filename) {
+    struct editorInterface *b = I;
+    if (!strcmp(filename, "#")) {
+        b = I->next;
+        if (b == NULL) {
+            snprintf(I->notice, sizeof(I->notice), "no other buffer");
+            return;
+        }
+    } else {
+        while (b && !sameFile(b->filename, filename)) {
+            b = b->next;
+        }
+    }
+    if (b == I)
+        return;
+    if (b) {
+        switchTo(b);
+    } else {
+        struct editorInterface *shown = I;
+        init_I(filename);
+        I->next = shown;
+    }
+    trimBuffers();
+}
+
+// :ls, the open buffers in the status line, most recently used first
+void listBuffers(void) {
+    int size = sizeof(I->notice);
+    int len = 0;
+    for (struct editorInterface *b = I; b && len < size; b = b->next) {
+        len += snprintf(I->notice + len, size - len, "%s%s%s",
+                        b == I ? "" : "  ", b->filename,
+                        unsaved(b) ? " [+]" : "");
+    }
+}
+
+/* ======= DISK ======= */
+/* a file that changes on disk while it's open is reloaded into its buffer, *
+ * through commands like any edit, so the change can be undone. if it just *
+ * grew and its old end is still what the buffer has, only what was added *
+ * is read, otherwise it's diffed line by line (see diff.h) */
+static void runCommand(struct command *cmd) {
+    doCommand(I->E, cmd);
+    recordCommand(&I->undo, cmd);
+}
+
+static void deleteText(point start, point end) {
+    struct command cmd = {start, copyRange(I->E, start, end),
+                          end.r - start.r + 1, DELETE};
+    runCommand(&cmd);
+    freeRowarr(cmd.rows, cmd.numrows);
+    free(cmd.rows);
+}
+
+// rows [h->at, h->at + h->oldrows) become the hunk's new ones
+static void applyHunk(struct fileDiff *d, struct hunk *h) {
+    struct editor *E = I->E;
+    struct erow empty = {0, 0, ""};
+    struct erow **rows = malloc((h->newrows + 1) * sizeof(struct erow *));
+    struct command cmd = {{h->at, 0}, rows, h->newrows, ADD};
+    for (int i = 0; i < h->newrows; i++) {
+        rows[i] = &d->rows[h->from + i];
+    }
+    if (h->oldrows == 0) { // lines in before row at, or after the last row
+        if (h->at < E->numrows) {
+            rows[cmd.numrows++] = &empty;
+        } else {
+            memmove(rows + 1, rows, h->newrows * sizeof(struct erow *));
+            rows[0] = &empty;
+            cmd.numrows++;
+            cmd.at.r--;
+            cmd.at.c = getRow(E, cmd.at.r)->len;
+        }
+        runCommand(&cmd);
+    } else if (h->newrows == 0) { // lines gone, with a line break
+        point start = {h->at, 0};
+        point end = {h->at + h->oldrows, -1};
+        if (end.r == E->numrows) { // the last ones, with the break before
+            start = (point){h->at - 1, getRow(E, h->at - 1)->len};
+            end = (point){E->numrows - 1, getRow(E, E->numrows - 1)->len - 1};
+        }
+        deleteText(start, end);
+    } else {
+        // a line that only got longer, like a log's last, is just added to
+        struct erow *row = getRow(E, h->at);
+        struct erow head = *rows[0];
+        if (h->oldrows == 1 && row->len <= head.len &&
+            !memcmp(row->text, head.text, row->len)) {
+            cmd.at.c = row->len;
+            head.text += row->len;
+            head.len -= row->len;
+            rows[0] = &head;
+        } else {
+            int last = h->at + h->oldrows - 1;
+            deleteText(cmd.at, (point){last, getRow(E, last)->len - 1});
+        }
+        runCommand(&cmd);
+    }
+    free(rows);
+}
+
+// where row r ends up once h is applied, the hunk's first if it was in it
+static int rowAfter(int r, struct hunk *h) {
+    if (r >= h->at + h->oldrows)
+        return r + h->newrows - h->oldrows;
+    return min(r, h->at);
+}
+
+/* make the buffer match the file again. all of it is diffed if whole, *
+ * otherwise appending is tried first */
+static void reload(bool whole) {
+    finishLoad(I->E);
+    struct fileDiff d;
+    bool appended = !whole && diffAppended(I->E, I->filename, &I->stamp, &d);
+    if (!appended && !diffFile(I->E, I->filename, &d)) {
+        snprintf(I->notice, sizeof(I->notice), "can't reload %s: %s",
+                 I->filename, strerror(errno));
+        return;
+    }
+    // a cursor on the last row follows it down, like tail -f
+    int numrows = I->E->numrows;
+    bool tail = I->cursor.r == numrows - 1;
+    sealUndo(&I->undo);
+    for (int i = d.numhunks - 1; i >= 0; i--) {
+        applyHunk(&d, &d.hunks[i]);
+        I->cursor.r = rowAfter(I->cursor.r, &d.hunks[i]);
+        I->toprow = rowAfter(I->toprow, &d.hunks[i]);
+    }
+    sealUndo(&I->undo);
+    if (tail || I->cursor.r >= I->E->numrows) {
+        I->cursor.r = I->E->numrows - 1;
+    }
+    I->toprow = min(I->toprow, I->cursor.r);
+    I->cursor.c = min(I->cursor.c, getRow(I->E, I->cursor.r)->len);
+    I->anchor.r = -1;
+    I->undo.saved = undoVersion(&I->undo);
+    journalSaved(I->journal, &I->undo);
+    I->stamp = d.stamp;
+    if (d.numhunks > 0) {
+        snprintf(I->notice, sizeof(I->notice),
+                 "reloaded from disk, %d change%s (%+d lines)", d.numhunks,
+                 d.numhunks == 1 ? "" : "s", I->E->numrows - numrows);
+    }
+    freeDiff(&d);
+}
+
+/* once the file's been left alone for WATCH_SETTLE_MS after changing, see *
+ * what changed. a buffer with edits of its own isn't touched, :e! does it */
+static void pollDisk(void) {
+    if (I->changedAt == 0 || nowMs() - I->changedAt < WATCH_SETTLE_MS ||
+        I->save || I->askReplay)
+        return;
+    I->changedAt = 0;
+    struct fileStamp now;
+    stampFile(I->filename, &now);
+    if (sameStamp(&now, &I->stamp))
+        return;
+    if (!now.exists) {
+        snprintf(I->notice, sizeof(I->notice), "%s was deleted on disk",
+                 I->filename);
+        I->stamp = now;
+    } else if (unsaved(I)) {
+        snprintf(I->notice, sizeof(I->notice),
+                 "%s changed on disk, :e! loads it over your edits",
+                 I->filename);
+    } else {
+        reload(false);
+    }
+}
+
+/* the watch went off. a file cut short in place is seen to straight away, *
+ * before anything reads the map past its new end */
+static void diskChanged(void) {
+    if (I->changedAt == 0) { // a file written to nonstop still gets reloaded
+        I->changedAt = nowMs();
+    }
+    struct fileStamp now;
+    stampFile(I->filename, &now);
+    if (now.exists && now.dev == I->stamp.dev && now.ino == I->stamp.ino &&
+        now.size < I->stamp.size) {
+        mapShrank(I->E, now.size);
+    }
+}
+
 void die(const char *s) {
     perror(s);
     exit(1);
@@ -94,61 +516,294 @@ void enableRawMode(void) {
     raw.c_oflag &= ~(OPOST);
     raw.c_cflag |= (CS8);
     raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
-    raw.c_cc[VMIN] = 0;
-    raw.c_cc[VTIME] = 1;
+    raw.c_cc[VMIN] = 0; // poll says when there's something to read
+    raw.c_cc[VTIME] = 0;
     if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) == -1)
         die("tcsetattr");
 }
 
-int readKey(void) {
-    int nread;
-    char c;
-    while ((nread = read(STDIN_FILENO, &c, 1)) != 1) {
-        if (nread == -1 && errno != EAGAIN)
-            die("readKey()");
-    }
-    if (c == ESC) {
-        char seq[3];
-        if (!read(STDIN_FILENO, &seq[0], 1) || !read(STDIN_FILENO, &seq[1], 1))
-            return c;
-
-        if (seq[0] == '[') {
-            switch (seq[1]) {
-            case 'A':
-                return ARROW_UP;
-            case 'B':
-                return ARROW_DOWN;
-            case 'C':
-                return ARROW_RIGHT;
-            case 'D':
-                return ARROW_LEFT;
-            }
+/* ======= INPUT ======= */
+/* input is read in as big a gulp as the terminal has ready, then made *
+ * into keys from the buffer, so the main loop can go through everything *
+ * typed (or pasted) since it last drew before drawing again */
+static unsigned char input[INPUT_SIZE];
+static int inputLen;
+static int inputPos; // the next byte to make a key of
+/* SIGWINCH just writes a byte here (a self-pipe), the main loop wakes up *
+ * to it and resizes before it next draws */
+static int winchPipe[2] = {-1, -1};
+
+static void onWinch(int sig) {
+    UNUSED(sig);
+    int saved = errno;
+    write(winchPipe[1], "", 1);
+    errno = saved;
+}
+
+void watchResize(void) {
+    if (pipe(winchPipe) == -1)
+        die("pipe");
+    for (int i = 0; i < 2; i++) {
+        fcntl(winchPipe[i], F_SETFL, O_NONBLOCK);
+        fcntl(winchPipe[i], F_SETFD, FD_CLOEXEC);
+    }
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = onWinch;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGWINCH, &sa, NULL);
+}
+
+static bool winched; // the pipe had something in it
+
+static void drainWinch(void) {
+    char buf[64];
+    while (read(winchPipe[0], buf, sizeof(buf)) > 0) {
+        winched = true;
+    }
+}
+
+// whether the terminal was resized since this was last asked
+static bool takeResize(void) {
+    drainWinch();
+    bool resized = winched;
+    winched = false;
+    return resized;
+}
+
+/* wait up to timeout ms (-1 for as long as it takes) for input, then read *
+ * all there is. false if none came */
+static bool fillInput(int timeout) {
+    memmove(input, input + inputPos, inputLen - inputPos);
+    inputLen -= inputPos;
+    inputPos = 0;
+    if (inputLen == INPUT_SIZE)
+        return false;
+    struct pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+    long long deadline = nowMs() + timeout;
+    int ready;
+    while ((ready = poll(&pfd, 1, timeout)) == -1 && errno == EINTR) {
+        if (timeout > 0) { // a resize, keep waiting out the rest
+            timeout = max(0, deadline - nowMs());
         }
     }
-    return c;
+    if (ready <= 0)
+        return false;
+    ssize_t n = read(STDIN_FILENO, input + inputLen, INPUT_SIZE - inputLen);
+    if (n == -1 && errno != EAGAIN && errno != EINTR && errno != EIO)
+        die("read");
+    if (n <= 0) {
+        if (pfd.revents & (POLLHUP | POLLERR) || n == -1) {
+            I->mode = QUIT; // the terminal is gone, the journal has the rest
+        }
+        return false;
+    }
+    inputLen += n;
+    return true;
+}
+
+// whether there's input to make a key of, without waiting for it
+bool inputPending(void) { return inputPos < inputLen || fillInput(0); }
+
+/* sleep until there's input, a resize or the file changing on disk, or *
+ * timeout ms (-1 for as long as it takes) pass */
+static void waitInput(int timeout) {
+    if (inputPos < inputLen)
+        return;
+    struct pollfd pfds[3] = {{STDIN_FILENO, POLLIN, 0},
+                             {winchPipe[0], POLLIN, 0},
+                             {I->watch ? watchFd(I->watch) : -1, POLLIN, 0}};
+    if (poll(pfds, 3, timeout) <= 0)
+        return;
+    // or they would keep waking us up until the next frame
+    if (pfds[1].revents) {
+        drainWinch();
+    }
+    if (pfds[2].revents && watchFired(I->watch)) {
+        diskChanged();
+    }
+}
+
+/* the next key, KEY_NULL if none comes within timeout ms (-1 to wait for *
+ * one) or it's a key elfin doesn't know */
+int readKey(int timeout) {
+    if (inputPos == inputLen && !fillInput(timeout))
+        return KEY_NULL;
+    int c = input[inputPos++];
+    if (c != ESC)
+        return c;
+
+    // an escape sequence arrives all at once, or close enough to it
+    if (inputPos == inputLen) {
+        fillInput(ESC_WAIT_MS);
+    }
+    if (inputPos == inputLen || input[inputPos] != '[')
+        return ESC;
+    // ESC [, parameters, then the final byte
+    int i = 1;
+    while (true) {
+        while (inputPos + i < inputLen && input[inputPos + i] >= 0x20 &&
+               input[inputPos + i] < 0x40) {
+            i++;
+        }
+        if (inputPos + i < inputLen || !fillInput(ESC_WAIT_MS))
+            break;
+    }
+    if (inputPos + i == inputLen) // never finished, so just an ESC
+        return ESC;
+    int final = input[inputPos + i];
+    bool paste =
+        i == 4 && final == '~' && !memcmp(input + inputPos, "[200", 4);
+    inputPos += i + 1;
+    if (paste)
+        return PASTE;
+    if (i > 1)
+        return KEY_NULL;
+    switch (final) {
+    case 'A':
+        return ARROW_UP;
+    case 'B':
+        return ARROW_DOWN;
+    case 'C':
+        return ARROW_RIGHT;
+    case 'D':
+        return ARROW_LEFT;
+    }
+    return KEY_NULL;
+}
+
+/* after PASTE, the pasted text up to the ESC [ 201 ~ that ends it. it's *
+ * added to ab as is, escapes and all */
+void readPaste(struct abuf *ab) {
+    static const char end[] = "\x1b[201~";
+    int endlen = sizeof(end) - 1;
+    while (true) {
+        char *p = (char *)input + inputPos;
+        int n = inputLen - inputPos;
+        char *esc = memchr(p, ESC, n);
+        int take = esc ? esc - p : n;
+        abAppend(ab, p, take);
+        inputPos += take;
+        n -= take;
+        if (esc && n >= endlen && !memcmp(esc, end, endlen)) {
+            inputPos += endlen;
+            return;
+        }
+        if (esc && (n >= endlen || memcmp(esc, end, n) != 0)) {
+            abAppend(ab, esc, 1); // just an ESC in the text
+            inputPos++;
+            continue;
+        }
+        // out of input, maybe partway into the end marker
+        if (!fillInput(PASTE_WAIT_MS))
+            return; // the end never came
+    }
 }
 
 void cleanup(void) {
-	destroy_I();
+    while (I) {
+        closeBuffer(I);
+    }
     disableRawMode();
 }
 
+/* ======= MOTION ======= */
+/* the cursor moves a glyph at a time (layout.h), so never into the middle *
+ * of a character */
+static struct layout *layoutOf(int r) {
+    return rowLayout(I->layout, r, I->screen.cols - I->coloff - 1);
+}
+
+// the glyph of row r byte c is part of, the last if c is past the end
+static int glyphIndex(int r, int c) {
+    return glyphOf(layoutOf(r), getRow(I->E, r), c);
+}
+
+// the byte glyph i of row r starts at, the end of the row past the last
+static int glyphStart(int r, int i) {
+    struct erow *row = getRow(I->E, r);
+    struct glyph g;
+    return glyphAt(layoutOf(r), row, max(i, 0), &g) ? g.start : row->len;
+}
+
+// the start of the glyph byte c of row r is in, c itself past the end
+static int snapToGlyph(int r, int c) {
+    return c < getRow(I->E, r)->len ? glyphStart(r, glyphIndex(r, c)) : c;
+}
+
+static void cursorLeft(void) {
+    int i = glyphIndex(I->cursor.r, I->cursor.c);
+    if (I->cursor.c < getRow(I->E, I->cursor.r)->len) {
+        i--;
+    }
+    I->cursor.c = glyphStart(I->cursor.r, i);
+}
+
+// as far as just past the end
+static void cursorRight(void) {
+    if (I->cursor.c < getRow(I->E, I->cursor.r)->len) {
+        I->cursor.c = glyphStart(I->cursor.r,
+                                 glyphIndex(I->cursor.r, I->cursor.c) + 1);
+    }
+}
+
+/* up or down to row r, onto the glyph at the cursor's column on screen. *
+ * if r is too short for that the cursor is left past its end, as far as *
+ * it was, to get its column back on the next row that's long enough */
+static void cursorToRow(int r) {
+    struct erow *row = getRow(I->E, I->cursor.r);
+    struct glyph from;
+    struct layout *l = layoutOf(I->cursor.r);
+    if (I->cursor.c >= row->len ||
+        !glyphAt(l, row, glyphOf(l, row, I->cursor.c), &from)) {
+        I->cursor.r = r;
+        I->cursor.c = snapToGlyph(r, I->cursor.c);
+        return;
+    }
+    I->cursor.r = r;
+    row = getRow(I->E, r);
+    l = layoutOf(r);
+    int i = glyphAtColumn(l, row, from.line, from.col);
+    struct glyph to;
+    struct glyph next;
+    if (!glyphAt(l, row, i, &to)) { // an empty row
+        return;
+    }
+    if (!glyphAt(l, row, i + 1, &next) &&
+        (to.line < from.line ||
+         (to.line == from.line && to.col + to.width <= from.col))) {
+        I->cursor.c = max(I->cursor.c, row->len);
+    } else {
+        I->cursor.c = to.start;
+    }
+}
+
 /* ======= IO utils ======= */
 void View(int c);
 void Insert(int c);
 void Command(int c);
 void doUserCommand(struct erow cmd);
+void jumpToMatch(bool backward);
 
 void View(int c) {
-    struct erow *curr_row = I->E->rowarray[I->cursor.r];
+    struct erow *curr_row = getRow(I->E, I->cursor.r);
     switch (c) {
     case ESC:
         I->anchor.r = -1;
+        I->hlsearch = false;
+        break;
+    case 'n':
+        jumpToMatch(I->searchBack);
+        break;
+    case 'N':
+        jumpToMatch(!I->searchBack);
         break;
     case '.':
         doUserCommand(I->cmd.msg);
         break;
     case '/':
+    case '?':
     case ':':
         I->mode = COMMAND;
         I->cmd.msg.len = 0;
@@ -164,7 +819,7 @@ void View(int c) {
         I->mode = INSERT;
         break;
     case 'a':
-        I->cursor.c = I->cursor.c + (I->cursor.c < curr_row->len ? 1 : 0);
+        cursorRight();
         I->mode = INSERT;
         break;
     case 'A':
@@ -184,19 +839,19 @@ void View(int c) {
         break;
     case ARROW_DOWN:
     case 'j':
-        I->cursor.r = min(I->E->numrows - 1, I->cursor.r + 1);
+        cursorToRow(min(I->E->numrows - 1, I->cursor.r + 1));
         break;
     case ARROW_UP:
     case 'k':
-        I->cursor.r = max(0, I->cursor.r - 1);
+        cursorToRow(max(0, I->cursor.r - 1));
         break;
     case ARROW_LEFT:
     case 'h':
-        I->cursor.c = max(0, min(I->cursor.c - 1, curr_row->len - 1));
+        cursorLeft();
         break;
     case ARROW_RIGHT:
     case 'l':
-        I->cursor.c = I->cursor.c + (I->cursor.c < curr_row->len ? 1 : 0);
+        cursorRight();
         break;
     case '0':
         I->cursor.c = 0;
@@ -217,44 +872,51 @@ void View(int c) {
         if (I->anchor.r != -1) {
             start = minPoint(I->cursor, I->anchor);
             end = maxPoint(I->cursor, I->anchor);
-            start.c = min(start.c, I->E->rowarray[start.r]->len - 1);
-            end.c = min(end.c, I->E->rowarray[end.r]->len - 1);
+            start.c = min(start.c, getRow(I->E, start.r)->len - 1);
+            end.c = min(end.c, getRow(I->E, end.r)->len - 1);
+            if (end.c >= 0) { // all of the last glyph
+                end.c = glyphStart(end.r, glyphIndex(end.r, end.c) + 1) - 1;
+            }
         }
         copyToClipboard(I->E, start, end);
     } break;
     case 'p':
         if (I->E->clipboard_len > 0) {
-            struct command *cmd = malloc(sizeof(struct command));
-            cmd->at = I->cursor;
-            cmd->at.c = min(cmd->at.c, max(0, I->E->rowarray[cmd->at.r]->len));
-            point cb_start = {0, 0};
-            point cb_end = {I->E->clipboard_len - 1,
-                            I->E->clipboard[I->E->clipboard_len - 1]->len - 1};
-            cmd->rows = copyRange(I->E->clipboard, cb_start, cb_end);
-            cmd->numrows = cb_end.r + 1;
-            cmd->type = ADD;
+            struct command cmd;
+            cmd.at = I->cursor;
+            cmd.at.c = min(cmd.at.c, max(0, getRow(I->E, cmd.at.r)->len));
+            cmd.rows = I->E->clipboard;
+            cmd.numrows = I->E->clipboard_len;
+            cmd.type = ADD;
 
-            I->cmdStack = push(cmd, I->cmdStack);
-            doCommand(I->E, cmd);
+            doCommand(I->E, &cmd);
+            recordCommand(&I->undo, &cmd);
+            sealUndo(&I->undo);
         }
         break;
     case 'd':
         if (I->anchor.r != -1) {
             point start = minPoint(I->cursor, I->anchor);
             point end = maxPoint(I->cursor, I->anchor);
-            start.c = min(start.c, I->E->rowarray[start.r]->len - 1);
+            start.c = min(start.c, getRow(I->E, start.r)->len - 1);
             start.c = max(0, start.c);
-            end.c = min(end.c, I->E->rowarray[end.r]->len - 1);
+            end.c = min(end.c, getRow(I->E, end.r)->len - 1);
+            if (end.c >= 0) { // all of the last glyph
+                end.c = glyphStart(end.r, glyphIndex(end.r, end.c) + 1) - 1;
+            }
             end.c = max(0, end.c);
 
-            struct command *cmd = malloc(sizeof(struct command));
-            cmd->at = start;
-            cmd->rows = copyRange(I->E->rowarray, start, end);
-            cmd->numrows = end.r - start.r + 1;
-            cmd->type = DELETE;
+            struct command cmd;
+            cmd.at = start;
+            cmd.rows = copyRange(I->E, start, end);
+            cmd.numrows = end.r - start.r + 1;
+            cmd.type = DELETE;
 
-            I->cmdStack = push(cmd, I->cmdStack);
-            doCommand(I->E, cmd);
+            doCommand(I->E, &cmd);
+            recordCommand(&I->undo, &cmd);
+            sealUndo(&I->undo);
+            freeRowarr(cmd.rows, cmd.numrows);
+            free(cmd.rows);
 
             I->cursor = minPoint(I->anchor, I->cursor);
             I->anchor.r = -1;
@@ -262,58 +924,65 @@ void View(int c) {
         break;
     case 'G':
         I->cursor.r = I->E->numrows - 1;
-        I->cursor.c = max(0, I->E->rowarray[I->cursor.r]->len - 1);
+        I->cursor.c = max(0, getRow(I->E, I->cursor.r)->len - 1);
+        I->cursor.c = snapToGlyph(I->cursor.r, I->cursor.c);
         break;
-    case 'g':
-        if (readKey() == 'g') {
+    case 'g': {
+        int next;
+        while ((next = readKey(-1)) == KEY_NULL && I->mode != QUIT)
+            ;
+        if (next == 'g') {
             I->cursor.r = 0;
             I->cursor.c = 0;
+        } else if (next == '-' || next == '+') { // through history, in time
+            if (!undoTime(&I->undo, I->E, &I->cursor, next == '-')) {
+                snprintf(I->notice, sizeof(I->notice), "already at %s change",
+                         next == '-' ? "oldest" : "newest");
+            }
         }
         break;
+    }
     case 'u':
-        if (I->cmdStack != NULL) {
-            struct command *cmd = I->cmdStack->command;
-            undoCommand(I->E, cmd);
-
-            I->cursor = cmd->at;
-            if (cmd->type == DELROW) {
-                I->cursor.c = 0;
-            }
-
-            I->cmdStack = remove_node(I->cmdStack);
+        if (!undoLast(&I->undo, I->E, &I->cursor)) {
+            snprintf(I->notice, sizeof(I->notice), "already at oldest change");
+        }
+        break;
+    case CTRL_R:
+        if (!redoNext(&I->undo, I->E, &I->cursor)) {
+            snprintf(I->notice, sizeof(I->notice), "already at newest change");
         }
         break;
     }
 }
 
 void Insert(int c) {
-    struct erow *curr_row = I->E->rowarray[I->cursor.r];
+    struct erow *curr_row = getRow(I->E, I->cursor.r);
     I->anchor.r = -1;
+    if (c == ESC || c == ARROW_DOWN || c == ARROW_UP || c == ARROW_LEFT ||
+        c == ARROW_RIGHT) // moving away starts a new undo step
+        sealUndo(&I->undo);
     switch (c) {
     case ESC:
         I->mode = VIEW;
         break;
     case ARROW_DOWN:
-        I->cursor.r = min(I->E->numrows - 1, I->cursor.r + 1);
+        cursorToRow(min(I->E->numrows - 1, I->cursor.r + 1));
         break;
     case ARROW_UP:
-        I->cursor.r = max(0, I->cursor.r - 1);
+        cursorToRow(max(0, I->cursor.r - 1));
         break;
     case ARROW_LEFT:
-        I->cursor.c = max(0, min(I->cursor.c - 1, curr_row->len - 1));
+        cursorLeft();
         break;
     case ARROW_RIGHT:
-        I->cursor.c = I->cursor.c + (I->cursor.c < curr_row->len ? 1 : 0);
+        cursorRight();
         break;
     case ENTER:
         I->cursor.c = min(I->cursor.c, curr_row->len);
         {
-            struct command *cmd = malloc(sizeof(struct command));
-            cmd->type = NEWROW;
-            cmd->at = I->cursor;
-
-            I->cmdStack = push(cmd, I->cmdStack);
-            doCommand(I->E, cmd);
+            struct command cmd = {I->cursor, NULL, 0, NEWROW};
+            doCommand(I->E, &cmd);
+            recordCommand(&I->undo, &cmd);
         }
 
         I->cursor.c = 0;
@@ -322,100 +991,251 @@ void Insert(int c) {
     case BACKSPACE:
         I->cursor.c = min(I->cursor.c, curr_row->len);
         {
-            struct command *cmd = malloc(sizeof(struct command));
-            cmd->at = I->cursor;
+            // the deleted glyph, lent to the command for the undo log
+            char text[GLYPH_MAX];
+            struct erow deleted = {0, 0, text};
+            struct erow *rows[1] = {&deleted};
+            struct command cmd = {I->cursor, rows, 1, DELETE};
             if (I->cursor.c == 0 && I->cursor.r > 0) {
-                cmd->type = DELROW;
-                cmd->at.c = curr_row->len;
+                cmd.type = DELROW;
+                cmd.at.c = curr_row->len;
                 I->cursor.r--;
-                I->cursor.c = I->E->rowarray[I->cursor.r]->len;
+                I->cursor.c = getRow(I->E, I->cursor.r)->len;
             } else if (I->cursor.c > 0) {
-                cmd->type = DELETE;
-                cmd->at.c--;
-                cmd->rows = malloc(sizeof(struct erow *));
-                cmd->rows[0] = malloc(sizeof(struct erow));
-                cmd->rows[0]->text = malloc(sizeof(char));
-                cmd->rows[0]->text[0] =
-                    I->E->rowarray[cmd->at.r]->text[cmd->at.c];
-                cmd->rows[0]->len = 1;
-                cmd->numrows = 1;
-                I->cursor.c--;
+                cmd.at.c = snapToGlyph(cmd.at.r, I->cursor.c - 1);
+                deleted.len = I->cursor.c - cmd.at.c;
+                memcpy(text, curr_row->text + cmd.at.c, deleted.len);
+                I->cursor.c = cmd.at.c;
             } else
                 break;
-            I->cmdStack = push(cmd, I->cmdStack);
-            doCommand(I->E, cmd);
+            doCommand(I->E, &cmd);
+            recordCommand(&I->undo, &cmd);
         }
         break;
 
     default: // add character
         I->cursor.c = min(I->cursor.c, curr_row->len);
         {
-            struct command *cmd = malloc(sizeof(struct command));
-            cmd->at = I->cursor;
-            cmd->type = ADD;
-            cmd->rows = malloc(sizeof(struct erow *));
-            cmd->rows[0] = malloc(sizeof(struct erow));
-            cmd->rows[0]->text = malloc(sizeof(char));
-            cmd->rows[0]->len = 1;
-            cmd->rows[0]->text[0] = c;
-            cmd->numrows = 1;
+            char ch = c;
+            struct erow added = {1, 0, &ch};
+            struct erow *rows[1] = {&added};
+            struct command cmd = {I->cursor, rows, 1, ADD};
 
             I->cursor.c++;
-            I->cmdStack = push(cmd, I->cmdStack);
-            doCommand(I->E, cmd);
+            doCommand(I->E, &cmd);
+            recordCommand(&I->undo, &cmd);
         }
     }
 }
 
+/* put pasted text in at the cursor, as a single command (and undo step). *
+ * lines end in \r, \n or \r\n, depending on the terminal */
+void pasteText(char *text, int len) {
+    if (len == 0)
+        return;
+    if (I->mode == COMMAND) { // just the first line
+        int n = 0;
+        while (n < len && text[n] != '\r' && text[n] != '\n') {
+            n++;
+        }
+        insertString(&I->cmd.msg, I->cmd.mcol, text, n);
+        I->cmd.mcol += n;
+        return;
+    }
+
+    int numrows = 1;
+    for (int i = 0; i < len; i++) {
+        if (text[i] == '\n' ||
+            (text[i] == '\r' && (i + 1 == len || text[i + 1] != '\n'))) {
+            numrows++;
+        }
+    }
+    // the rows borrow the text, the command copies what it keeps
+    struct erow *rows = malloc(numrows * sizeof(struct erow));
+    struct erow **ptrs = malloc(numrows * sizeof(struct erow *));
+    char *start = text;
+    int r = 0;
+    for (char *p = text; p <= text + len; p++) {
+        if (p < text + len && *p != '\n' && *p != '\r')
+            continue;
+        rows[r].len = p - start;
+        rows[r].cap = 0;
+        rows[r].text = start;
+        ptrs[r] = &rows[r];
+        r++;
+        if (p < text + len - 1 && p[0] == '\r' && p[1] == '\n') {
+            p++;
+        }
+        start = p + 1;
+    }
+
+    struct command cmd = {I->cursor, ptrs, numrows, ADD};
+    cmd.at.c = min(cmd.at.c, getRow(I->E, cmd.at.r)->len);
+    sealUndo(&I->undo);
+    doCommand(I->E, &cmd);
+    recordCommand(&I->undo, &cmd);
+    sealUndo(&I->undo);
+
+    I->anchor.r = -1;
+    I->cursor.r = cmd.at.r + numrows - 1;
+    I->cursor.c = (numrows == 1 ? cmd.at.c : 0) + rows[numrows - 1].len;
+    if (I->mode == VIEW) { // on the last character pasted
+        I->cursor.c = snapToGlyph(I->cursor.r, max(0, I->cursor.c - 1));
+    }
+    free(rows);
+    free(ptrs);
+}
+
 /* ======= USER COMMANDS ======= */
-point search(point start, char *needle) {
-    start.c++;
-    // search from start
-    for (int i = start.r; i < I->E->numrows; i++) {
-        struct erow *curr_row = I->E->rowarray[i];
-        int start_c = i == start.r ? start.c : 0;
-        char *loc =
-            strnstr(curr_row->text + start_c, needle, curr_row->len - start_c);
-        if (loc) {
-            point ret = {i, loc - curr_row->text};
-            return ret;
+// jump to the next match of the last search and select it
+void jumpToMatch(bool backward) {
+    struct matchIndex *m = I->matches;
+    if (m == NULL)
+        return;
+    int i = nextMatch(m, I->cursor, backward);
+    if (i == -1) {
+        snprintf(I->notice, sizeof(I->notice), "not found: %.*s", m->n->len,
+                 m->n->text);
+        I->anchor.r = -1;
+        return;
+    }
+    I->cursor = m->matches[i].at;
+    I->anchor = I->cursor;
+    I->anchor.c += max(m->matches[i].len, 1) - 1;
+    I->hlsearch = true;
+    snprintf(I->notice, sizeof(I->notice), "match %d/%d", i + 1,
+             m->nummatches);
+}
+
+/* index every match of a / (or ? backward) pattern and jump to the next *
+ * one. leading \c makes the search ignore case, \v makes it a regex */
+void findPattern(char *pattern, int len, bool backward) {
+    bool icase = false;
+    bool regex = false;
+    while (len >= 2 && pattern[0] == '\\' &&
+           (pattern[1] == 'c' || pattern[1] == 'v')) {
+        if (pattern[1] == 'c') {
+            icase = true;
+        } else {
+            regex = true;
         }
+        pattern += 2;
+        len -= 2;
+    }
+    if (len == 0)
+        return;
+    struct needle *n;
+    if (regex) {
+        const char *error;
+        n = regexNeedle(pattern, len, icase, &error);
+        if (n == NULL) {
+            snprintf(I->notice, sizeof(I->notice), "bad pattern: %s", error);
+            return;
+        }
+    } else {
+        n = compileNeedle(pattern, len, icase);
+    }
+    finishLoad(I->E);
+    freeMatches(I->matches);
+    I->matches = indexMatches(I->E, n);
+    I->searchBack = backward;
+    jumpToMatch(backward);
+}
+
+// parse a byte count with an optional K/M/G suffix, -1 if malformed
+long long parseSize(char *str) {
+    char *end;
+    long long n = strtoll(str, &end, 10);
+    if (end == str || n < 0)
+        return -1;
+    switch (*end) {
+    case 'g':
+    case 'G':
+        n <<= 10;
+        // fallthrough
+    case 'm':
+    case 'M':
+        n <<= 10;
+        // fallthrough
+    case 'k':
+    case 'K':
+        n <<= 10;
+        end++;
+    }
+    return *end == '\0' ? n : -1;
+}
+
+// :set name=value
+void setOption(char *opt) {
+    char *value = strchr(opt, '=');
+    if (value == NULL) {
+        snprintf(I->notice, sizeof(I->notice), "usage: set name=value");
+        return;
     }
-    // search from beginning
-    for (int i = 0; i < I->E->numrows; i++) {
-        struct erow *curr_row = I->E->rowarray[i];
-        char *loc = strnstr(curr_row->text, needle, curr_row->len);
-        if (loc) {
-            point ret = {i, loc - curr_row->text};
-            return ret;
+    *value++ = '\0';
+    if (!strcmp(opt, "pagebudget")) {
+        long long size = parseSize(value);
+        if (size < 0) {
+            snprintf(I->notice, sizeof(I->notice), "bad size: %s", value);
+            return;
         }
+        pageBudget = size;
+    } else if (!strcmp(opt, "undobudget")) {
+        long long size = parseSize(value);
+        if (size < 0) {
+            snprintf(I->notice, sizeof(I->notice), "bad size: %s", value);
+            return;
+        }
+        setUndoBudget(&I->undo, size);
+    } else {
+        snprintf(I->notice, sizeof(I->notice), "unknown option: %s", opt);
     }
-    start.c--;
-    return start;
 }
 
 void doUserCommand(struct erow cmd) {
     if (cmd.len <= 1)
         return;
 
-    if (cmd.text[0] == '/') {
-        I->cursor = search(I->cursor, cmd.text + 1);
-        I->anchor = I->cursor;
-        I->anchor.c += cmd.len - 2;
+    if (cmd.text[0] == '/' || cmd.text[0] == '?') {
+        findPattern(cmd.text + 1, cmd.len - 1, cmd.text[0] == '?');
+    } else if (cmd.len == 3 && !strncmp(cmd.text, ":e!", 3)) {
+        if (I->save) {
+            snprintf(I->notice, sizeof(I->notice),
+                     "still writing the last save");
+        } else if (!I->askReplay) {
+            reload(true);
+        }
 	} else if (!strncmp(cmd.text, ":e ", 3)) {
 		if (cmd.len > 3) {
 			char* text = strndup(cmd.text+3, cmd.len - 3);
-			destroy_I();
-			init_I(text);
+			editFile(text);
 			free(text);
 		}
+    } else if (!strncmp(cmd.text, ":set ", 5)) {
+        char *opt = strndup(cmd.text + 5, cmd.len - 5);
+        setOption(opt);
+        free(opt);
+    } else if (!strncmp(cmd.text, ":ls", cmd.len)) {
+        listBuffers();
+    } else if (!strncmp(cmd.text, ":stats", cmd.len)) {
+        struct screen *s = &I->screen;
+        snprintf(I->notice, sizeof(I->notice),
+                 "%ld frames, %ld screen allocations, last frame %d bytes, "
+                 "%ld rows lexed, %ld laid out",
+                 s->frames, s->allocs, s->out.size,
+                 I->syntax ? I->syntax->lexed : 0, I->layout->laidOut);
     } else if (!strncmp(cmd.text, ":w", cmd.len)) {
-        editorSaveFile(I->E, I->filename);
+        saveBuffer();
     } else if (!strncmp(cmd.text, ":q", cmd.len)) {
         I->mode = QUIT;
     } else if (!strncmp(cmd.text, ":wq", cmd.len)) {
-        editorSaveFile(I->E, I->filename);
-        I->mode = QUIT;
+        if (I->save) {
+            endSave();
+        }
+        saveBuffer();
+        if (endSave()) {
+            I->mode = QUIT;
+        }
     }
 }
 
@@ -454,7 +1274,19 @@ void Command(int c) {
 }
 
 void editorProcessKey(int c) {
-    if (I->mode == VIEW) {
+    if (c == KEY_NULL)
+        return;
+    I->notice[0] = '\0';
+    if (c == PASTE) {
+        struct abuf text = {NULL, 0, 0, 0};
+        readPaste(&text);
+        if (!I->askReplay) { // not until they've answered
+            pasteText(text.buf, text.size);
+        }
+        abFree(&text);
+    } else if (I->askReplay) {
+        answerReplay(c);
+    } else if (I->mode == VIEW) {
         View(c);
     } else if (I->mode == INSERT) {
         Insert(c);
@@ -472,26 +1304,46 @@ int main(int argc, char *argv[]) {
 	
     /* terminal setup */
 	write(STDIN_FILENO, szstr("\x1b[?1049h")); // start new buffer
+    write(STDIN_FILENO, szstr("\x1b[?2004h")); // bracket pastes
     enableRawMode();
 
     /* signal stuff */
-    signal(SIGWINCH, resize);
+    watchResize();
 
 	/* editor init */
 	init_I(argv[1]);
 
-    /* main IO loop */
+    /* main IO loop: draw, sleep until there's input or a resize, then take *
+     * every key waiting, and any more that come before the next frame is *
+     * due, before drawing again */
     while (I->mode != QUIT) {
-        I->status.size = 0; // this "clears" the status
+        pollLoad(I->E);
+        pollSave();
+        pollDisk();
+        if (takeResize()) {
+            resize();
+        }
         I->coloff = max(4, countDigits(I->E->numrows) + 2);
-        statusPrintMode();
-        adjustToprow();
-        printEditorStatus();
-        printEditorContents();
-        editorProcessKey(readKey());
+        refreshScreen();
+        long long frame = nowMs();
+        trimBlocks(I->E, I->toprow, I->ws.ws_row);
+        /* wake up now and then to show how a load or save is coming along, *
+         * or to see to the file once it's settled after changing */
+        bool busy = loadProgress(I->E) >= 0 || saving() || I->changedAt;
+        waitInput(busy ? PROGRESS_MS : -1);
+        while (I->mode != QUIT) {
+            while (I->mode != QUIT && inputPending()) {
+                editorProcessKey(readKey(0));
+            }
+            int wait = FRAME_MS - (nowMs() - frame);
+            if (wait <= 0 || I->mode == QUIT)
+                break;
+            waitInput(wait);
+        }
     }
 
-	write(STDIN_FILENO, szstr("\x1b[?1049l")); // restore old buffer
+    write(STDIN_FILENO, szstr("\x1b[?2004l"));
+	write(STDIN_FILENO, szstr("\x1b[m\x1b[?1049l")); // restore old buffer
 	cleanup();
     return 0;
 }
@@ -0,0 +1,648 @@
+#include "journal.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#define JOURNAL_MAGIC "elfinJ1\n"
+// magic, then the base: size + 1, mtime, mtime nanoseconds
+#define HEADER_SIZE (8 + 3 * 8)
+// every frame starts with its payload's length and checksum
+#define FRAME_HEADER 8
+// first allocation for an event buffer, doubled from there as needed
+#define JBUF_MIN 4096
+
+/* ======= ENCODING ======= */
+static void reserve(struct jbuf *b, size_t n) {
+    if (b->size + n <= b->cap)
+        return;
+    size_t cap = b->cap ? b->cap : JBUF_MIN;
+    while (cap < b->size + n) {
+        cap *= 2;
+    }
+    b->buf = realloc(b->buf, cap);
+    b->cap = cap;
+}
+
+static void putBytes(struct jbuf *b, const void *p, size_t n) {
+    reserve(b, n);
+    memcpy(b->buf + b->size, p, n);
+    b->size += n;
+}
+
+static void putByte(struct jbuf *b, int c) {
+    unsigned char byte = c;
+    putBytes(b, &byte, 1);
+}
+
+// 7 bits at a time, low first, the top bit set on all but the last
+static void putVarint(struct jbuf *b, unsigned long long n) {
+    unsigned char bytes[10];
+    int len = 0;
+    do {
+        bytes[len++] = (n & 0x7f) | (n > 0x7f ? 0x80 : 0);
+        n >>= 7;
+    } while (n != 0);
+    putBytes(b, bytes, len);
+}
+
+static void putFixed(unsigned char *p, unsigned long long n, int bytes) {
+    for (int i = 0; i < bytes; i++) {
+        p[i] = n >> (8 * i);
+    }
+}
+
+struct reader {
+    const unsigned char *p;
+    const unsigned char *end;
+    bool bad; // ran off the end or read nonsense
+};
+
+static unsigned long long getVarint(struct reader *r) {
+    unsigned long long n = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (r->p == r->end) {
+            r->bad = true;
+            return 0;
+        }
+        unsigned char byte = *r->p++;
+        n |= (unsigned long long)(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return n;
+    }
+    r->bad = true;
+    return 0;
+}
+
+static int getByte(struct reader *r) {
+    if (r->p == r->end) {
+        r->bad = true;
+        return 0;
+    }
+    return *r->p++;
+}
+
+static const char *getBytes(struct reader *r, size_t n) {
+    if ((size_t)(r->end - r->p) < n) {
+        r->bad = true;
+        return NULL;
+    }
+    const char *p = (const char *)r->p;
+    r->p += n;
+    return p;
+}
+
+static unsigned long long getFixed(const unsigned char *p, int bytes) {
+    unsigned long long n = 0;
+    for (int i = 0; i < bytes; i++) {
+        n |= (unsigned long long)p[i] << (8 * i);
+    }
+    return n;
+}
+
+// FNV-1a, enough to notice a frame torn by a crash
+static uint32_t checksum(const char *p, size_t n) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < n; i++) {
+        h = (h ^ (unsigned char)p[i]) * 16777619u;
+    }
+    return h;
+}
+
+// a small int (line, column, count) that can't be negative
+static int getCount(struct reader *r) {
+    unsigned long long n = getVarint(r);
+    if (n > INT_MAX) {
+        r->bad = true;
+        return 0;
+    }
+    return n;
+}
+
+/* ======= FILE ======= */
+static struct journalBase statBase(char *filename) {
+    struct journalBase base = {-1, 0, 0};
+    struct stat st;
+    if (stat(filename, &st) == 0) {
+        base.size = st.st_size;
+        base.mtime = st.st_mtime;
+#ifdef __APPLE__
+        base.mtimeNsec = st.st_mtimespec.tv_nsec;
+#else
+        base.mtimeNsec = st.st_mtim.tv_nsec;
+#endif
+    }
+    return base;
+}
+
+static bool sameBase(struct journalBase *a, struct journalBase *b) {
+    return a->size == b->size && a->mtime == b->mtime &&
+           a->mtimeNsec == b->mtimeNsec;
+}
+
+static void encodeHeader(unsigned char *p, struct journalBase *base) {
+    memcpy(p, JOURNAL_MAGIC, 8);
+    putFixed(p + 8, base->size + 1, 8);
+    putFixed(p + 16, base->mtime, 8);
+    putFixed(p + 24, base->mtimeNsec, 8);
+}
+
+// write all of it, retrying short writes
+static int writeAll(int fd, struct iovec *iov, int cnt) {
+    while (cnt > 0) {
+        ssize_t n = writev(fd, iov, cnt);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        while (cnt > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            cnt--;
+        }
+        if (cnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+static int writeFrame(int fd, struct jbuf *b) {
+    if (b->size == 0)
+        return 0;
+    unsigned char head[FRAME_HEADER];
+    putFixed(head, b->size, 4);
+    putFixed(head + 4, checksum(b->buf, b->size), 4);
+    struct iovec iov[2] = {{head, FRAME_HEADER}, {b->buf, b->size}};
+    return writeAll(fd, iov, 2);
+}
+
+static int createJournal(struct journal *j) {
+    int fd = open(j->path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd == -1)
+        return -1;
+    unsigned char head[HEADER_SIZE];
+    encodeHeader(head, &j->base);
+    struct iovec iov = {head, HEADER_SIZE};
+    if (writeAll(fd, &iov, 1) == -1) {
+        close(fd);
+        return -1;
+    }
+    j->fd = fd;
+    return 0;
+}
+
+/* the undo tree (then whatever came after it) as a new journal for base, *
+ * swapped in with a rename so a crash leaves the old one or the new one */
+static int rewriteJournal(struct journal *j, struct journalBase *base,
+                          struct jbuf *tree, struct jbuf *after) {
+    char tmp[PATH_MAX + 16];
+    snprintf(tmp, sizeof(tmp), "%s-XXXXXX", j->path);
+    int fd = mkstemp(tmp);
+    if (fd == -1)
+        return -1;
+    fchmod(fd, 0600);
+    unsigned char head[HEADER_SIZE];
+    encodeHeader(head, base);
+    struct iovec iov = {head, HEADER_SIZE};
+    if (writeAll(fd, &iov, 1) == -1 || writeFrame(fd, tree) == -1 ||
+        writeFrame(fd, after) == -1 || fsync(fd) == -1 ||
+        rename(tmp, j->path) == -1) {
+        int err = errno;
+        close(fd);
+        unlink(tmp);
+        errno = err;
+        return -1;
+    }
+    if (j->fd != -1) {
+        close(j->fd);
+    }
+    j->fd = fd;
+    j->base = *base;
+    return 0;
+}
+
+/* ======= WRITER ======= */
+static struct timespec deadline(int ms) {
+    struct timespec t;
+    clock_gettime(CLOCK_REALTIME, &t);
+    t.tv_sec += ms / 1000;
+    t.tv_nsec += (ms % 1000) * 1000000L;
+    if (t.tv_nsec >= 1000000000L) {
+        t.tv_sec++;
+        t.tv_nsec -= 1000000000L;
+    }
+    return t;
+}
+
+/* wait for events, let them pile up for an interval, then write them out *
+ * as one frame and sync. the editor's thread only ever waits on the lock *
+ * while buffers are swapped */
+static void *writeEvents(void *arg) {
+    struct journal *j = arg;
+    pthread_mutex_lock(&j->lock);
+    while (true) {
+        while (!j->stop && !j->rewrite && j->pending.size == 0) {
+            pthread_cond_wait(&j->wake, &j->lock);
+        }
+        struct timespec until = deadline(JOURNAL_INTERVAL_MS);
+        while (!j->stop && !j->rewrite &&
+               pthread_cond_timedwait(&j->wake, &j->lock, &until) == 0)
+            ;
+
+        struct jbuf events = j->pending;
+        j->pending = j->writing;
+        j->writing = events;
+        struct jbuf tree = j->tree;
+        bool rewrite = j->rewrite;
+        struct journalBase base = j->newBase;
+        j->tree = (struct jbuf){NULL, 0, 0};
+        j->rewrite = false;
+        bool stop = j->stop;
+        pthread_mutex_unlock(&j->lock);
+
+        int err = 0;
+        if (rewrite) {
+            err = rewriteJournal(j, &base, &tree, &j->writing);
+            free(tree.buf);
+        } else if (j->writing.size > 0) {
+            err = j->fd == -1 ? createJournal(j) : 0;
+            if (err == 0) {
+                err = writeFrame(j->fd, &j->writing);
+            }
+            if (err == 0) {
+                err = fsync(j->fd);
+            }
+        }
+        j->writing.size = 0;
+
+        pthread_mutex_lock(&j->lock);
+        if (err == -1) {
+            j->error = errno;
+        }
+        if (stop && !j->rewrite && j->pending.size == 0)
+            break;
+    }
+    pthread_mutex_unlock(&j->lock);
+    return NULL;
+}
+
+// take the lock to add an event, starting the writer the first time
+static struct jbuf *beginEvent(struct journal *j) {
+    if (!j->running) {
+        j->running = pthread_create(&j->writer, NULL, writeEvents, j) == 0;
+    }
+    pthread_mutex_lock(&j->lock);
+    return &j->pending;
+}
+
+// wake the writer if it's waiting for something to do
+static void endEvent(struct journal *j, bool wake) {
+    if (wake) {
+        pthread_cond_signal(&j->wake);
+    }
+    pthread_mutex_unlock(&j->lock);
+}
+
+/* ======= EVENTS ======= */
+static void encodeAt(struct jbuf *b, cmdType type, point at) {
+    putByte(b, type);
+    putVarint(b, at.r);
+    putVarint(b, at.c);
+}
+
+void journalCommand(struct journal *j, struct command *cmd) {
+    struct jbuf *b = beginEvent(j);
+    bool wake = b->size == 0;
+    putByte(b, J_COMMAND);
+    encodeAt(b, cmd->type, cmd->at);
+    bool hasRows = cmd->type == ADD || cmd->type == DELETE;
+    int numrows = hasRows ? cmd->numrows : 0;
+    putVarint(b, numrows);
+    for (int i = 0; i < numrows; i++) {
+        putVarint(b, cmd->rows[i]->len);
+        putBytes(b, cmd->rows[i]->text, cmd->rows[i]->len);
+    }
+    endEvent(j, wake);
+}
+
+// an event with no arguments, or J_BUDGET and its size, or J_GOTO and seq
+void journalEvent(struct journal *j, enum journalEvent ev, long long arg) {
+    struct jbuf *b = beginEvent(j);
+    bool wake = b->size == 0;
+    putByte(b, ev);
+    if (ev == J_BUDGET || ev == J_GOTO) {
+        putVarint(b, arg);
+    }
+    endEvent(j, wake);
+}
+
+/* the file was just saved (as of record log->saved): write the undo tree *
+ * down relative to it, in place of everything journaled so far. if the *
+ * buffer has moved on since, getting back to where it is comes after the *
+ * tree, as an edit */
+void journalSaved(struct journal *j, struct undoLog *log) {
+    if (log->saved < 0) // no longer in the tree, the old journal goes stale
+        return;
+    struct jbuf tree = {NULL, 0, 0};
+    putByte(&tree, J_TREE);
+    putByte(&tree, J_BUDGET);
+    putVarint(&tree, log->budget);
+    for (struct undoRecord *r = nextUndoRecord(log, NULL); r;
+         r = nextUndoRecord(log, r)) {
+        struct undoRecord *redo = r->parent ? r->parent->redo : log->redo;
+        putByte(&tree, J_RECORD);
+        putVarint(&tree, r->parent ? r->parent->seq : 0);
+        putVarint(&tree, r->seq);
+        putByte(&tree, redo == r);
+        encodeAt(&tree, r->type, r->at);
+        putVarint(&tree, r->numrows);
+        putVarint(&tree, r->len);
+        putBytes(&tree, r->text, r->len);
+    }
+    putByte(&tree, J_CURRENT);
+    putVarint(&tree, log->saved);
+
+    struct journalBase base = statBase(j->filename);
+    beginEvent(j);
+    free(j->tree.buf);
+    j->tree = tree;
+    j->newBase = base;
+    j->rewrite = true;
+    j->pending.size = 0; // all in the tree
+    if (undoVersion(log) != log->saved) {
+        putByte(&j->pending, J_GOTO);
+        putVarint(&j->pending, undoVersion(log));
+    }
+    endEvent(j, true);
+}
+
+/* ======= REPLAY ======= */
+/* read the journal, returning the bytes of frames that check out (the *
+ * rest was cut short by a crash) after the header. -1 if there's no *
+ * journal for this base */
+static long long loadJournal(struct journal *j, struct jbuf *out,
+                             bool *stale) {
+    *stale = false;
+    int fd = open(j->path, O_RDONLY);
+    if (fd == -1)
+        return -1;
+    ssize_t n;
+    char chunk[1 << 16];
+    while ((n = read(fd, chunk, sizeof(chunk))) > 0) {
+        putBytes(out, chunk, n);
+    }
+    close(fd);
+
+    const unsigned char *p = (const unsigned char *)out->buf;
+    if (out->size < HEADER_SIZE || memcmp(p, JOURNAL_MAGIC, 8) != 0)
+        return -1;
+    struct journalBase base = {(long long)getFixed(p + 8, 8) - 1,
+                               getFixed(p + 16, 8), getFixed(p + 24, 8)};
+    if (!sameBase(&base, &j->base)) {
+        *stale = true;
+        return -1;
+    }
+    size_t end = HEADER_SIZE;
+    while (out->size - end >= FRAME_HEADER) {
+        size_t len = getFixed(p + end, 4);
+        if (out->size - end - FRAME_HEADER < len ||
+            checksum(out->buf + end + FRAME_HEADER, len) !=
+                getFixed(p + end + 4, 4))
+            break;
+        end += FRAME_HEADER + len;
+    }
+    return end;
+}
+
+// whether a journaled command fits the buffer it's about to be done to
+static bool validCommand(struct editor *E, struct command *cmd) {
+    point at = cmd->at;
+    if (at.r >= E->numrows)
+        return false;
+    switch (cmd->type) {
+    case ADD:
+        return cmd->numrows > 0 && at.c <= getRow(E, at.r)->len;
+    case DELETE: {
+        if (cmd->numrows == 0 || at.r + cmd->numrows > E->numrows)
+            return false;
+        int last = at.r + cmd->numrows - 1;
+        int end = cmd->rows[cmd->numrows - 1]->len + (last == at.r ? at.c : 0);
+        return at.c <= getRow(E, at.r)->len && end <= getRow(E, last)->len;
+    }
+    case NEWROW:
+        return at.c <= getRow(E, at.r)->len;
+    case DELROW:
+        return at.r > 0 && at.c == getRow(E, at.r)->len;
+    }
+    return false;
+}
+
+// do one event from a journal, false if it makes no sense
+static bool replayEvent(struct reader *r, struct editor *E,
+                        struct undoLog *log, point *cursor) {
+    int ev = getByte(r);
+    switch (ev) {
+    case J_COMMAND: {
+        struct command cmd;
+        cmd.type = getByte(r);
+        cmd.at.r = getCount(r);
+        cmd.at.c = getCount(r);
+        cmd.numrows = getCount(r);
+        if (r->bad || cmd.type > DELROW ||
+            cmd.numrows > (r->end - r->p)) // every row takes a byte at least
+            return false;
+        struct erow *rows = malloc(max(cmd.numrows, 1) * sizeof(struct erow));
+        cmd.rows = malloc(max(cmd.numrows, 1) * sizeof(struct erow *));
+        for (int i = 0; i < cmd.numrows; i++) {
+            rows[i].len = getCount(r);
+            rows[i].cap = 0;
+            rows[i].text = (char *)getBytes(r, rows[i].len);
+            cmd.rows[i] = &rows[i];
+        }
+        bool ok = !r->bad && validCommand(E, &cmd);
+        if (ok) {
+            doCommand(E, &cmd);
+            recordCommand(log, &cmd);
+            *cursor = cmd.at;
+        }
+        free(rows);
+        free(cmd.rows);
+        return ok;
+    }
+    case J_TREE:
+        return log->child == NULL; // only ever at the start
+    case J_SEAL:
+        sealUndo(log);
+        return true;
+    case J_UNDO:
+        return undoLast(log, E, cursor);
+    case J_REDO:
+        return redoNext(log, E, cursor);
+    case J_BACK:
+    case J_FORWARD:
+        return undoTime(log, E, cursor, ev == J_BACK);
+    case J_BUDGET: {
+        unsigned long long budget = getVarint(r);
+        if (!r->bad) {
+            setUndoBudget(log, budget);
+        }
+        return !r->bad;
+    }
+    case J_RECORD: {
+        long parent = getVarint(r);
+        long seq = getVarint(r);
+        bool redo = getByte(r);
+        cmdType type = getByte(r);
+        point at;
+        at.r = getCount(r);
+        at.c = getCount(r);
+        int numrows = getCount(r);
+        int len = getCount(r);
+        const char *text = getBytes(r, len);
+        if (r->bad || type > DELROW)
+            return false;
+        restoreRecord(log, parent, seq, redo, type, at, numrows, text, len);
+        return true;
+    }
+    case J_CURRENT: {
+        long seq = getVarint(r);
+        if (!r->bad) {
+            restoreCurrent(log, seq);
+            *cursor = log->cur ? log->cur->at : *cursor;
+        }
+        return !r->bad;
+    }
+    case J_GOTO: {
+        long seq = getVarint(r);
+        return !r->bad && undoTo(log, E, cursor, seq);
+    }
+    }
+    return false;
+}
+
+/* the journal (if there is one) for the buffer as it was just opened, *
+ * read only when it's replayed */
+struct journal *openJournal(char *filename) {
+    struct journal *j = calloc(1, sizeof(struct journal));
+    // next to the file itself, through symlinks, like a save
+    char target[PATH_MAX];
+    if (realpath(filename, target) == NULL) {
+        snprintf(target, sizeof(target), "%s", filename);
+    }
+    char *dir = strdup(target);
+    char *name = strdup(target);
+    size_t size = strlen(target) + 32;
+    j->path = malloc(size);
+    snprintf(j->path, size, "%s/.%s.elfin-journal", dirname(dir),
+             basename(name));
+    free(dir);
+    free(name);
+    j->filename = strdup(target);
+    j->base = statBase(j->filename);
+    j->fd = -1;
+    pthread_mutex_init(&j->lock, NULL);
+    pthread_cond_init(&j->wake, NULL);
+    return j;
+}
+
+// what a journal left from last time holds
+enum journalState checkJournal(struct journal *j) {
+    struct jbuf data = {NULL, 0, 0};
+    bool stale;
+    long long end = loadJournal(j, &data, &stale);
+    enum journalState state = stale ? JOURNAL_STALE : JOURNAL_NONE;
+    if (end > HEADER_SIZE) {
+        // edits are any frame but the undo tree a save left
+        state = JOURNAL_HISTORY;
+        size_t at = HEADER_SIZE;
+        while (at < (size_t)end) {
+            size_t len = getFixed((unsigned char *)data.buf + at, 4);
+            struct reader r = {(unsigned char *)data.buf + at + FRAME_HEADER,
+                               (unsigned char *)data.buf + at + FRAME_HEADER +
+                                   len,
+                               false};
+            if (r.p == r.end || *r.p != J_TREE)
+                state = JOURNAL_EDITS;
+            at += FRAME_HEADER + len;
+        }
+    }
+    free(data.buf);
+    return state;
+}
+
+/* do everything in the journal over again, to E (as loaded from the file) *
+ * and to an empty undo log, then carry on appending to it. false if it *
+ * broke off early */
+bool replayJournal(struct journal *j, struct editor *E, struct undoLog *log,
+                   point *cursor) {
+    struct jbuf data = {NULL, 0, 0};
+    bool stale;
+    long long end = loadJournal(j, &data, &stale);
+    if (end < 0) {
+        free(data.buf);
+        return false;
+    }
+    bool ok = true;
+    size_t at = HEADER_SIZE;
+    while (ok && at < (size_t)end) {
+        size_t len = getFixed((unsigned char *)data.buf + at, 4);
+        struct reader r = {(unsigned char *)data.buf + at + FRAME_HEADER,
+                           (unsigned char *)data.buf + at + FRAME_HEADER + len,
+                           false};
+        while (ok && r.p < r.end) {
+            ok = replayEvent(&r, E, log, cursor);
+        }
+        if (ok) {
+            at += FRAME_HEADER + len;
+        }
+    }
+    free(data.buf);
+
+    // later events go after the last good frame
+    int fd = open(j->path, O_WRONLY);
+    if (fd != -1 && ftruncate(fd, at) == 0 && lseek(fd, 0, SEEK_END) != -1) {
+        j->fd = fd;
+    } else if (fd != -1) {
+        close(fd);
+    }
+    return ok;
+}
+
+// throw away what's left from last time, it's started over on the next edit
+void discardJournal(struct journal *j) { unlink(j->path); }
+
+// write out whatever is still waiting, then stop the writer
+void closeJournal(struct journal *j) {
+    if (j == NULL)
+        return;
+    if (j->running) {
+        pthread_mutex_lock(&j->lock);
+        j->stop = true;
+        pthread_cond_signal(&j->wake);
+        pthread_mutex_unlock(&j->lock);
+        pthread_join(j->writer, NULL);
+    }
+    if (j->fd != -1) {
+        close(j->fd);
+    }
+    pthread_mutex_destroy(&j->lock);
+    pthread_cond_destroy(&j->wake);
+    free(j->pending.buf);
+    free(j->writing.buf);
+    free(j->tree.buf);
+    free(j->path);
+    free(j->filename);
+    free(j);
+}
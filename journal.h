@@ -0,0 +1,82 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "command.h"
+#include "undo.h"
+
+// how long events wait in memory before they're written out and synced
+#define JOURNAL_INTERVAL_MS 200
+
+enum journalEvent {
+    J_COMMAND = 1, // recordCommand
+    J_SEAL,        // sealUndo
+    J_UNDO,        // undoLast
+    J_REDO,        // redoNext
+    J_BACK,        // undoTime backward
+    J_FORWARD,     // undoTime forward
+    J_BUDGET,      // setUndoBudget
+    J_TREE,        // the undo tree follows, as of the last save
+    J_RECORD,      // one record of it
+    J_CURRENT,     // the record the saved file is at
+    J_GOTO         // undoTo
+};
+
+enum journalState {
+    JOURNAL_NONE,    // nothing to replay
+    JOURNAL_STALE,   // it's for another version of the file
+    JOURNAL_HISTORY, // undo history, the file is as it left it
+    JOURNAL_EDITS    // edits that never got saved
+};
+
+// identity of the file a journal applies to
+struct journalBase {
+    long long size; // -1 if there was no file
+    long long mtime;
+    long long mtimeNsec;
+};
+
+struct jbuf {
+    char *buf;
+    size_t size;
+    size_t cap;
+};
+
+/* everything that goes into a buffer's undo log, appended to a file next *
+ * to it (.name.elfin-journal), so a crash loses at most the last interval *
+ * of edits and the undo history outlives the session. the file starts *
+ * with the base it applies to, then checksummed frames of events. a save *
+ * rewrites it as the undo tree, relative to the new file. the editor's *
+ * thread only copies events into memory, a writer thread writes them out *
+ * in batches and syncs */
+struct journal {
+    char *path;
+    char *filename; // the buffer's, symlinks resolved
+    struct journalBase base;
+    int fd; // -1 until the first event
+
+    pthread_t writer;
+    bool running;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    bool stop;
+    struct jbuf pending; // events the writer hasn't taken yet
+    struct jbuf writing; // the writer's, swapped with pending
+    struct jbuf tree; // a rewrite waiting for the writer
+    bool rewrite;
+    struct journalBase newBase; // base of the rewrite
+    int error; // errno of the last failed write, 0 if none
+};
+
+struct journal *openJournal(char *filename);
+void closeJournal(struct journal *j);
+enum journalState checkJournal(struct journal *j);
+bool replayJournal(struct journal *j, struct editor *E, struct undoLog *log,
+                   point *cursor);
+void discardJournal(struct journal *j);
+
+void journalCommand(struct journal *j, struct command *cmd);
+void journalEvent(struct journal *j, enum journalEvent ev, long long arg);
+void journalSaved(struct journal *j, struct undoLog *log);
@@ -0,0 +1,409 @@
+#include "layout.h"
+#include "wrap.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* ======= CHARACTERS ======= */
+struct range {
+    int first;
+    int last;
+};
+
+// marks and the like that go on the character before them, taking no room
+static const struct range extenders[] = {
+    {0x0300, 0x036f},   {0x0483, 0x0489},   {0x0591, 0x05bd},
+    {0x05bf, 0x05bf},   {0x05c1, 0x05c2},   {0x05c4, 0x05c5},
+    {0x05c7, 0x05c7},   {0x0610, 0x061a},   {0x064b, 0x065f},
+    {0x0670, 0x0670},   {0x06d6, 0x06dc},   {0x06df, 0x06e4},
+    {0x06e7, 0x06e8},   {0x06ea, 0x06ed},   {0x0711, 0x0711},
+    {0x0730, 0x074a},   {0x07a6, 0x07b0},   {0x07eb, 0x07f3},
+    {0x0816, 0x0819},   {0x081b, 0x0823},   {0x0825, 0x0827},
+    {0x0829, 0x082d},   {0x0859, 0x085b},   {0x08d3, 0x08e1},
+    {0x08e3, 0x0903},   {0x093a, 0x093c},   {0x093e, 0x094f},
+    {0x0951, 0x0957},   {0x0962, 0x0963},   {0x0981, 0x0983},
+    {0x09bc, 0x09bc},   {0x09be, 0x09cd},   {0x09d7, 0x09d7},
+    {0x09e2, 0x09e3},   {0x0a01, 0x0a03},   {0x0a3c, 0x0a51},
+    {0x0a70, 0x0a71},   {0x0a75, 0x0a75},   {0x0a81, 0x0a83},
+    {0x0abc, 0x0abc},   {0x0abe, 0x0acd},   {0x0ae2, 0x0ae3},
+    {0x0b01, 0x0b03},   {0x0b3c, 0x0b3c},   {0x0b3e, 0x0b57},
+    {0x0b62, 0x0b63},   {0x0b82, 0x0b82},   {0x0bbe, 0x0bcd},
+    {0x0bd7, 0x0bd7},   {0x0c00, 0x0c04},   {0x0c3e, 0x0c56},
+    {0x0c62, 0x0c63},   {0x0c81, 0x0c83},   {0x0cbc, 0x0cbc},
+    {0x0cbe, 0x0cd6},   {0x0ce2, 0x0ce3},   {0x0d00, 0x0d03},
+    {0x0d3b, 0x0d3c},   {0x0d3e, 0x0d4d},   {0x0d57, 0x0d57},
+    {0x0d62, 0x0d63},   {0x0d82, 0x0d83},   {0x0dca, 0x0ddf},
+    {0x0df2, 0x0df3},   {0x0e31, 0x0e31},   {0x0e34, 0x0e3a},
+    {0x0e47, 0x0e4e},   {0x0eb1, 0x0eb1},   {0x0eb4, 0x0ebc},
+    {0x0ec8, 0x0ecd},   {0x0f18, 0x0f19},   {0x0f35, 0x0f35},
+    {0x0f37, 0x0f37},   {0x0f39, 0x0f39},   {0x0f3e, 0x0f3f},
+    {0x0f71, 0x0f84},   {0x0f86, 0x0f87},   {0x0f8d, 0x0fbc},
+    {0x0fc6, 0x0fc6},   {0x102b, 0x103e},   {0x1056, 0x1059},
+    {0x105e, 0x1060},   {0x1062, 0x1064},   {0x1067, 0x106d},
+    {0x1071, 0x1074},   {0x1082, 0x108d},   {0x108f, 0x108f},
+    {0x109a, 0x109d},   {0x1160, 0x11ff},   {0x135d, 0x135f},
+    {0x1712, 0x1714},   {0x1732, 0x1734},   {0x1752, 0x1753},
+    {0x1772, 0x1773},   {0x17b4, 0x17d3},   {0x17dd, 0x17dd},
+    {0x180b, 0x180d},   {0x1885, 0x1886},   {0x18a9, 0x18a9},
+    {0x1920, 0x193b},   {0x1a17, 0x1a1b},   {0x1a55, 0x1a7f},
+    {0x1ab0, 0x1aff},   {0x1b00, 0x1b04},   {0x1b34, 0x1b44},
+    {0x1b6b, 0x1b73},   {0x1b80, 0x1b82},   {0x1ba1, 0x1bad},
+    {0x1be6, 0x1bf3},   {0x1c24, 0x1c37},   {0x1cd0, 0x1cd2},
+    {0x1cd4, 0x1ce8},   {0x1ced, 0x1ced},   {0x1cf4, 0x1cf4},
+    {0x1cf7, 0x1cf9},   {0x1dc0, 0x1dff},   {0x200c, 0x200d},
+    {0x20d0, 0x20f0},   {0x2cef, 0x2cf1},   {0x2d7f, 0x2d7f},
+    {0x2de0, 0x2dff},   {0x302a, 0x302f},   {0x3099, 0x309a},
+    {0xa66f, 0xa672},   {0xa674, 0xa67d},   {0xa69e, 0xa69f},
+    {0xa6f0, 0xa6f1},   {0xa802, 0xa802},   {0xa806, 0xa806},
+    {0xa80b, 0xa80b},   {0xa823, 0xa827},   {0xa880, 0xa881},
+    {0xa8b4, 0xa8c5},   {0xa8e0, 0xa8f1},   {0xa8ff, 0xa8ff},
+    {0xa926, 0xa92d},   {0xa947, 0xa953},   {0xa980, 0xa983},
+    {0xa9b3, 0xa9c0},   {0xa9e5, 0xa9e5},   {0xaa29, 0xaa36},
+    {0xaa43, 0xaa43},   {0xaa4c, 0xaa4d},   {0xaa7b, 0xaa7d},
+    {0xaab0, 0xaab0},   {0xaab2, 0xaab4},   {0xaab7, 0xaab8},
+    {0xaabe, 0xaabf},   {0xaac1, 0xaac1},   {0xaaeb, 0xaaef},
+    {0xaaf5, 0xaaf6},   {0xabe3, 0xabea},   {0xabec, 0xabed},
+    {0xd7b0, 0xd7ff},   {0xfb1e, 0xfb1e},   {0xfe00, 0xfe0f},
+    {0xfe20, 0xfe2f},   {0x101fd, 0x101fd}, {0x1d165, 0x1d169},
+    {0x1d16d, 0x1d172}, {0x1d17b, 0x1d182}, {0x1d185, 0x1d18b},
+    {0x1d1aa, 0x1d1ad}, {0x1e000, 0x1e02a}, {0x1e8d0, 0x1e8d6},
+    {0x1e944, 0x1e94a}, {0x1f3fb, 0x1f3ff}, {0xe0020, 0xe007f},
+    {0xe0100, 0xe01ef},
+};
+
+// two columns wide: CJK, Hangul, fullwidth forms, emoji
+static const struct range wide[] = {
+    {0x1100, 0x115f},   {0x231a, 0x231b},   {0x2329, 0x232a},
+    {0x23e9, 0x23ec},   {0x23f0, 0x23f0},   {0x23f3, 0x23f3},
+    {0x25fd, 0x25fe},   {0x2614, 0x2615},   {0x2648, 0x2653},
+    {0x267f, 0x267f},   {0x2693, 0x2693},   {0x26a1, 0x26a1},
+    {0x26aa, 0x26ab},   {0x26bd, 0x26be},   {0x26c4, 0x26c5},
+    {0x26ce, 0x26ce},   {0x26d4, 0x26d4},   {0x26ea, 0x26ea},
+    {0x26f2, 0x26f3},   {0x26f5, 0x26f5},   {0x26fa, 0x26fa},
+    {0x26fd, 0x26fd},   {0x2705, 0x2705},   {0x270a, 0x270b},
+    {0x2728, 0x2728},   {0x274c, 0x274c},   {0x274e, 0x274e},
+    {0x2753, 0x2755},   {0x2757, 0x2757},   {0x2795, 0x2797},
+    {0x27b0, 0x27b0},   {0x27bf, 0x27bf},   {0x2b1b, 0x2b1c},
+    {0x2b50, 0x2b50},   {0x2b55, 0x2b55},   {0x2e80, 0x303e},
+    {0x3041, 0x33ff},   {0x3400, 0x4dbf},   {0x4e00, 0x9fff},
+    {0xa000, 0xa4cf},   {0xa960, 0xa97f},   {0xac00, 0xd7a3},
+    {0xf900, 0xfaff},   {0xfe10, 0xfe19},   {0xfe30, 0xfe6f},
+    {0xff00, 0xff60},   {0xffe0, 0xffe6},   {0x16fe0, 0x16fe4},
+    {0x17000, 0x18aff}, {0x1b000, 0x1b2ff}, {0x1f004, 0x1f004},
+    {0x1f0cf, 0x1f0cf}, {0x1f18e, 0x1f18e}, {0x1f191, 0x1f19a},
+    {0x1f200, 0x1f202}, {0x1f210, 0x1f23b}, {0x1f240, 0x1f248},
+    {0x1f250, 0x1f251}, {0x1f260, 0x1f265}, {0x1f300, 0x1f320},
+    {0x1f32d, 0x1f335}, {0x1f337, 0x1f37c}, {0x1f37e, 0x1f393},
+    {0x1f3a0, 0x1f3ca}, {0x1f3cf, 0x1f3d3}, {0x1f3e0, 0x1f3f0},
+    {0x1f3f4, 0x1f3f4}, {0x1f3f8, 0x1f43e}, {0x1f440, 0x1f440},
+    {0x1f442, 0x1f4fc}, {0x1f4ff, 0x1f53d}, {0x1f54b, 0x1f54e},
+    {0x1f550, 0x1f567}, {0x1f57a, 0x1f57a}, {0x1f595, 0x1f596},
+    {0x1f5a4, 0x1f5a4}, {0x1f5fb, 0x1f64f}, {0x1f680, 0x1f6c5},
+    {0x1f6cc, 0x1f6cc}, {0x1f6d0, 0x1f6d2}, {0x1f6d5, 0x1f6d7},
+    {0x1f6eb, 0x1f6ec}, {0x1f6f4, 0x1f6fc}, {0x1f7e0, 0x1f7eb},
+    {0x1f90c, 0x1f93a}, {0x1f93c, 0x1f945}, {0x1f947, 0x1f9ff},
+    {0x1fa70, 0x1faff}, {0x20000, 0x2fffd}, {0x30000, 0x3fffd},
+};
+
+// invisible, or there to reorder text: the terminal can't be trusted with
+static const struct range hidden[] = {
+    {0x0080, 0x009f}, {0x200b, 0x200b}, {0x200e, 0x200f},
+    {0x2028, 0x202e}, {0x2060, 0x2064}, {0x2066, 0x206f},
+    {0xfeff, 0xfeff}, {0xfff9, 0xfffb},
+};
+
+static bool inRanges(const struct range *r, int n, int cp) {
+    if (cp < r[0].first || cp > r[n - 1].last)
+        return false;
+    int lo = 0;
+    int hi = n - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (cp > r[mid].last) {
+            lo = mid + 1;
+        } else if (cp < r[mid].first) {
+            hi = mid - 1;
+        } else {
+            return true;
+        }
+    }
+    return false;
+}
+
+#define IN(table, cp) inRanges(table, sizeof(table) / sizeof(table[0]), cp)
+
+static bool isRegional(int cp) { return cp >= 0x1f1e6 && cp <= 0x1f1ff; }
+
+/* the character at the start of s[0, len) into *cp, returns its bytes. *
+ * *cp is -1 for a byte that doesn't start a well formed one */
+static int decode(const unsigned char *s, int len, int *cp) {
+    *cp = -1;
+    int n;
+    int least;
+    if (s[0] < 0x80) {
+        *cp = s[0];
+        return 1;
+    } else if (s[0] >= 0xc2 && s[0] <= 0xdf) {
+        n = 2;
+        least = 0x80;
+    } else if (s[0] >= 0xe0 && s[0] <= 0xef) {
+        n = 3;
+        least = 0x800;
+    } else if (s[0] >= 0xf0 && s[0] <= 0xf4) {
+        n = 4;
+        least = 0x10000;
+    } else {
+        return 1;
+    }
+    if (n > len)
+        return 1;
+    int c = s[0] & (0x7f >> n);
+    for (int i = 1; i < n; i++) {
+        if ((s[i] & 0xc0) != 0x80)
+            return 1;
+        c = c << 6 | (s[i] & 0x3f);
+    }
+    // too long a way to write it, a surrogate, or past the last character
+    if (c < least || (c >= 0xd800 && c <= 0xdfff) || c > 0x10ffff)
+        return 1;
+    *cp = c;
+    return n;
+}
+
+/* the glyph at the start of text[0, len), col columns into a screen line: *
+ * returns its bytes, and the columns it takes into *width. *shown is set *
+ * false if it can't be shown as it is: control bytes other than tabs, *
+ * broken UTF-8, invisible characters, or marks with nothing to go on. *
+ * those are drawn as '?' */
+int glyphLen(const char *text, int len, int col, int *width, bool *shown) {
+    const unsigned char *t = (const unsigned char *)text;
+    int cp;
+    int n = decode(t, len, &cp);
+    *width = 1;
+    *shown = false;
+    if (cp == '\t') {
+        *width = TAB_WIDTH - (col % TAB_WIDTH);
+        *shown = true;
+        return 1;
+    }
+    if (cp < 0x20 || cp == 0x7f || IN(hidden, cp))
+        return n;
+    *shown = !IN(extenders, cp);
+    if (IN(wide, cp)) {
+        *width = 2;
+        *shown = true;
+    }
+    bool regional = isRegional(cp);
+    bool joined = false; // after a zero width joiner
+    while (n < len) {
+        int next;
+        int m = decode(t + n, len - n, &next);
+        if (next < 0 || n + m > GLYPH_MAX)
+            break;
+        if (joined && next >= 0x80 && !IN(hidden, next)) {
+            joined = false; // emoji sequences, all drawn as the first
+        } else if (IN(extenders, next)) {
+            joined = next == 0x200d;
+        } else if (regional && isRegional(next)) {
+            regional = false; // a pair of them is a flag
+            *width = 2;
+        } else {
+            break;
+        }
+        n += m;
+    }
+    return n;
+}
+
+/* ======= LAYING OUT ======= */
+// printable ASCII all the way, so bytes are glyphs are columns
+static bool isPlain(struct erow *row) {
+    for (int i = 0; i < row->len; i++) {
+        unsigned char ch = row->text[i];
+        if (ch < 0x20 || ch >= 0x7f)
+            return false;
+    }
+    return true;
+}
+
+// lay out the glyph at l->end, the same way sublineOf counts (wrap.h)
+static void layOne(struct layout *l, struct erow *row) {
+    int width;
+    bool shown;
+    int len = glyphLen(row->text + l->end, row->len - l->end, l->col, &width,
+                       &shown);
+    if (l->col + width >= l->wrap) { // new subline
+        l->line++;
+        l->col = 0;
+    }
+    if (l->numglyphs == l->capglyphs) {
+        l->capglyphs = l->capglyphs ? l->capglyphs * 2 : 64;
+        l->glyphs = realloc(l->glyphs, l->capglyphs * sizeof(struct glyph));
+    }
+    l->glyphs[l->numglyphs++] =
+        (struct glyph){l->end, len, l->line, l->col, width, shown};
+    l->col += width;
+    l->end += len;
+}
+
+/* glyph i of row into *g, laying out as far as that if need be. false if *
+ * the row has fewer */
+bool glyphAt(struct layout *l, struct erow *row, int i, struct glyph *g) {
+    if (l->plain) {
+        if (i < 0 || i >= row->len)
+            return false;
+        int w = l->wrap - 1;
+        *g = (struct glyph){i, 1, w > 0 ? i / w : i + 1, w > 0 ? i % w : 0, 1,
+                            true};
+        return true;
+    }
+    while (l->numglyphs <= i && l->end < row->len) {
+        layOne(l, row);
+    }
+    if (i < 0 || i >= l->numglyphs)
+        return false;
+    *g = l->glyphs[i];
+    return true;
+}
+
+/* the glyph byte c is part of, the last one if c is past the end. -1 for *
+ * an empty row */
+int glyphOf(struct layout *l, struct erow *row, int c) {
+    if (l->plain)
+        return min(c, row->len - 1);
+    while (l->end <= c && l->end < row->len) {
+        layOne(l, row);
+    }
+    int lo = 0;
+    int hi = l->numglyphs - 1;
+    while (lo < hi) { // the last glyph starting at or before c
+        int mid = (lo + hi + 1) / 2;
+        if (l->glyphs[mid].start <= c) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return hi;
+}
+
+static bool pastColumn(struct glyph *g, int line, int col) {
+    return g->line > line || (g->line == line && g->col > col);
+}
+
+/* the last glyph starting at or before column col of screen line line, *
+ * for moving up and down. -1 for an empty row */
+int glyphAtColumn(struct layout *l, struct erow *row, int line, int col) {
+    if (l->plain) {
+        int w = l->wrap - 1;
+        int c = w > 0 ? line * w + max(min(col, w - 1), 0) : line - 1;
+        return min(max(c, 0), row->len - 1);
+    }
+    while (l->end < row->len &&
+           (l->numglyphs == 0 ||
+            !pastColumn(&l->glyphs[l->numglyphs - 1], line, col))) {
+        layOne(l, row);
+    }
+    int lo = 0;
+    int hi = l->numglyphs - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (pastColumn(&l->glyphs[mid], line, col)) {
+            hi = mid - 1;
+        } else {
+            lo = mid;
+        }
+    }
+    return hi;
+}
+
+/* screen lines the row takes up, laying out the rest of it if need be. *
+ * the same as rowHeight, without going over the row again once it's laid *
+ * out */
+int layoutLines(struct layout *l, struct erow *row) {
+    if (l->plain) {
+        int w = l->wrap - 1;
+        if (row->len == 0)
+            return 1;
+        return w > 0 ? (row->len - 1) / w + 1 : row->len + 1;
+    }
+    while (l->end < row->len) {
+        layOne(l, row);
+    }
+    return l->line + 1;
+}
+
+/* ======= CACHE ======= */
+struct layoutCache *openLayouts(struct editor *E) {
+    struct layoutCache *lc = calloc(1, sizeof(struct layoutCache));
+    lc->E = E;
+    for (int i = 0; i < LAYOUT_CACHE; i++) {
+        lc->cache[i].row = -1;
+    }
+    addListener(E, layoutEdited, lc);
+    return lc;
+}
+
+void closeLayouts(struct layoutCache *lc) {
+    if (lc == NULL)
+        return;
+    removeListener(lc->E, layoutEdited, lc);
+    for (int i = 0; i < LAYOUT_CACHE; i++) {
+        free(lc->cache[i].glyphs);
+    }
+    free(lc);
+}
+
+// row's layout for a width, good until the next call for another row
+struct layout *rowLayout(struct layoutCache *lc, int row, int width) {
+    struct layout *l = &lc->cache[row % LAYOUT_CACHE];
+    if (l->row != row || l->wrap != width) {
+        struct erow *r = getRow(lc->E, row);
+        l->row = row;
+        l->wrap = width;
+        l->plain = isPlain(r);
+        l->numglyphs = 0;
+        l->end = 0;
+        l->line = 0;
+        l->col = 0;
+        lc->laidOut++;
+    }
+    return l;
+}
+
+/* edit listener: the replaced rows' layouts go, the ones after them move *
+ * to the slots for their new row numbers */
+void layoutEdited(void *arg, int row, int oldrows, int newrows) {
+    struct layoutCache *lc = arg;
+    int shift = newrows - oldrows;
+    for (int i = 0; i < LAYOUT_CACHE; i++) {
+        struct layout *l = &lc->cache[i];
+        if (l->row >= row && l->row < row + oldrows) {
+            l->row = -1;
+        } else if (l->row >= row + oldrows) {
+            l->row += shift;
+        }
+    }
+    if (shift % LAYOUT_CACHE == 0)
+        return;
+
+    struct layout moved[LAYOUT_CACHE];
+    int nummoved = 0;
+    for (int i = 0; i < LAYOUT_CACHE; i++) {
+        struct layout *l = &lc->cache[i];
+        if (l->row >= row + newrows) {
+            moved[nummoved++] = *l;
+            *l = (struct layout){.row = -1};
+        }
+    }
+    // the rows before the edit keep their slots, a moved one can't take it
+    for (int i = 0; i < nummoved; i++) {
+        struct layout *l = &lc->cache[moved[i].row % LAYOUT_CACHE];
+        if (l->row == -1) {
+            free(l->glyphs);
+            *l = moved[i];
+        } else {
+            free(moved[i].glyphs);
+        }
+    }
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "editor.h"
+
+// rows whose layouts are kept, by row number modulo this
+#define LAYOUT_CACHE 256
+// most bytes in a glyph, marks past that start glyphs of their own
+#define GLYPH_MAX 32
+
+/* what's drawn in a cell or two: a character with the marks, joiners and *
+ * modifiers that go on it, close enough to a grapheme cluster for text *
+ * the terminal can show. broken UTF-8 and control bytes are a glyph each */
+int glyphLen(const char *text, int len, int col, int *width, bool *shown);
+
+// where a glyph of a row goes on screen
+struct glyph {
+    int start; // its first byte
+    int len;
+    int line; // screen line of the row's own
+    int col; // column on that line
+    int width; // columns it takes up, a tab's depends on where it is
+    bool shown; // false if it'd throw the terminal off, drawn as '?'
+};
+
+/* the glyphs of a row wrapped to a width, worked out only as far along the *
+ * row as has been asked for. rows of printable ASCII don't keep any, every *
+ * byte is a glyph a column wide */
+struct layout {
+    int row; // -1 if empty
+    int wrap; // the width it was laid out for
+    bool plain;
+    struct glyph *glyphs;
+    int numglyphs;
+    int capglyphs;
+    int end; // bytes laid out so far
+    int line; // where the next glyph goes
+    int col;
+};
+
+/* layouts for the rows of a buffer that get drawn or moved around in. an *
+ * edit forgets those of the rows it replaced, the ones below it only move */
+struct layoutCache {
+    struct editor *E;
+    struct layout cache[LAYOUT_CACHE];
+    long laidOut; // rows laid out, for :stats
+};
+
+struct layoutCache *openLayouts(struct editor *E);
+void closeLayouts(struct layoutCache *lc);
+struct layout *rowLayout(struct layoutCache *lc, int row, int width);
+bool glyphAt(struct layout *l, struct erow *row, int i, struct glyph *g);
+int glyphOf(struct layout *l, struct erow *row, int c);
+int glyphAtColumn(struct layout *l, struct erow *row, int line, int col);
+int layoutLines(struct layout *l, struct erow *row);
+void layoutEdited(void *arg, int row, int oldrows, int newrows);
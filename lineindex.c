@@ -0,0 +1,243 @@
+#include "lineindex.h"
+#include "pool.h"
+#include "rowtree.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define HAVE_AVX2
+#endif
+
+// bytes indexed by one job
+#define INDEX_CHUNK (4 << 20)
+
+/* the newlines of one chunk of the file. rows only end at \n (a \r before *
+ * it is stripped when the rows are scanned in), so nothing else is looked *
+ * for here */
+struct chunk {
+    char *start;
+    char *end;
+    int count;  // newlines in the chunk
+    char *last; // just past the last one
+    // just past every ROWBLOCK_FILL-th one, counted from the chunk start
+    char **ends;
+    int numends;
+    int capends;
+};
+
+typedef void scanner(struct chunk *c, char *p, char *end);
+
+/* ======= SCANNING ======= */
+static void addEnd(struct chunk *c, char *end) {
+    if (c->numends == c->capends) {
+        c->capends = c->capends ? c->capends * 2 : 16;
+        c->ends = realloc(c->ends, c->capends * sizeof(char *));
+    }
+    c->ends[c->numends++] = end;
+}
+
+// take in the newlines set in mask, bit i standing for base[i]
+static inline void takeMask(struct chunk *c, char *base, uint64_t mask) {
+    int n = __builtin_popcountll(mask);
+    if (c->count % ROWBLOCK_FILL + n < ROWBLOCK_FILL) {
+        c->count += n;
+        c->last = base + 64 - __builtin_clzll(mask);
+        return;
+    }
+    while (mask) { // a block boundary is in here, find it
+        char *p = base + __builtin_ctzll(mask) + 1;
+        mask &= mask - 1;
+        if (++c->count % ROWBLOCK_FILL == 0) {
+            addEnd(c, p);
+        }
+        c->last = p;
+    }
+}
+
+static void scanScalar(struct chunk *c, char *p, char *end) {
+    while ((p = memchr(p, '\n', end - p)) != NULL) {
+        p++;
+        if (++c->count % ROWBLOCK_FILL == 0) {
+            addEnd(c, p);
+        }
+        c->last = p;
+    }
+}
+
+#if defined(__SSE2__)
+static void scanSSE2(struct chunk *c, char *p, char *end) {
+    const __m128i nl = _mm_set1_epi8('\n');
+    for (; end - p >= 64; p += 64) {
+        uint64_t mask = 0;
+        for (int i = 0; i < 4; i++) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(p + i * 16));
+            uint64_t m = (uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+            mask |= m << (i * 16);
+        }
+        if (mask)
+            takeMask(c, p, mask);
+    }
+    scanScalar(c, p, end);
+}
+#endif
+
+#if defined(HAVE_AVX2)
+__attribute__((target("avx2"))) static void scanAVX2(struct chunk *c, char *p,
+                                                     char *end) {
+    const __m256i nl = _mm256_set1_epi8('\n');
+    for (; end - p >= 64; p += 64) {
+        __m256i lo = _mm256_loadu_si256((const __m256i *)p);
+        __m256i hi = _mm256_loadu_si256((const __m256i *)(p + 32));
+        uint64_t mask =
+            (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, nl)) |
+            (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, nl))
+                << 32;
+        if (mask)
+            takeMask(c, p, mask);
+    }
+    scanScalar(c, p, end);
+}
+#endif
+
+// the widest scanner this cpu runs. elsewhere memchr is vectorized by libc
+static scanner *pickScanner(void) {
+#if defined(HAVE_AVX2)
+    if (__builtin_cpu_supports("avx2"))
+        return scanAVX2;
+#endif
+#if defined(__SSE2__)
+    return scanSSE2;
+#else
+    return scanScalar;
+#endif
+}
+
+struct indexJob {
+    struct chunk *chunks;
+    scanner *scan;
+};
+
+static void indexChunk(void *arg, int i) {
+    struct indexJob *job = arg;
+    struct chunk *c = &job->chunks[i];
+    job->scan(c, c->start, c->end);
+}
+
+/* ======= MERGING ======= */
+// stitches the chunks' newlines back together into block sized spans
+struct merger {
+    struct span *spans;
+    int numspans;
+    int capspans;
+
+    char *start; // of the span being built
+    char *end;
+    int numrows;
+};
+
+static void flushSpan(struct merger *m) {
+    if (m->numrows == 0)
+        return;
+    if (m->numspans == m->capspans) {
+        m->capspans = m->capspans ? m->capspans * 2 : 64;
+        m->spans = realloc(m->spans, m->capspans * sizeof(struct span));
+    }
+    struct span *s = &m->spans[m->numspans++];
+    s->start = m->start;
+    s->len = m->end - m->start;
+    s->numrows = m->numrows;
+    m->start = m->end;
+    m->numrows = 0;
+}
+
+// numrows more rows, ending at end
+static void addRows(struct merger *m, char *end, int numrows) {
+    if (numrows == 0)
+        return;
+    if (m->numrows + numrows > ROWBLOCK_MAX) {
+        flushSpan(m);
+    }
+    m->numrows += numrows;
+    m->end = end;
+}
+
+/* ======= INDEXER ======= */
+// indexes a text a stretch at a time, see indexMore
+struct indexer {
+    char *text;
+    size_t len;
+    size_t pos; // indexed up to here
+    scanner *scan;
+    struct merger m;
+};
+
+struct indexer *newIndexer(char *text, size_t len) {
+    struct indexer *ix = calloc(1, sizeof(struct indexer));
+    ix->text = text;
+    ix->len = len;
+    ix->scan = pickScanner();
+    ix->m.start = ix->m.end = text;
+    return ix;
+}
+
+void freeIndexer(struct indexer *ix) {
+    free(ix->m.spans);
+    free(ix);
+}
+
+size_t indexedBytes(struct indexer *ix) { return ix->pos; }
+
+bool indexDone(struct indexer *ix) { return ix->pos == ix->len; }
+
+/* split (at least) the next maxbytes of the text into spans of whole *
+ * lines, at most ROWBLOCK_MAX rows each. chunks of the stretch are *
+ * scanned for newlines in parallel, then merged. returns the number of *
+ * spans finished, *spans must be freed. the span still being built is *
+ * held back until the next call (or the end of the text) */
+int indexMore(struct indexer *ix, size_t maxbytes, struct span **spans) {
+    size_t left = ix->len - ix->pos;
+    size_t todo = maxbytes < left ? maxbytes : left;
+    int numchunks = (todo + INDEX_CHUNK - 1) / INDEX_CHUNK;
+    struct chunk *chunks = calloc(numchunks + 1, sizeof(struct chunk));
+    char *p = ix->text + ix->pos;
+    for (int i = 0; i < numchunks; i++) {
+        size_t n = todo < INDEX_CHUNK ? todo : INDEX_CHUNK;
+        chunks[i].start = p;
+        chunks[i].end = p + n;
+        p += n;
+        todo -= n;
+    }
+    struct indexJob job = {chunks, ix->scan};
+    poolRun(indexChunk, &job, numchunks);
+
+    struct merger *m = &ix->m;
+    for (int i = 0; i < numchunks; i++) {
+        struct chunk *c = &chunks[i];
+        for (int j = 0; j < c->numends; j++) {
+            addRows(m, c->ends[j], ROWBLOCK_FILL);
+        }
+        addRows(m, c->last, c->count - c->numends * ROWBLOCK_FILL);
+        free(c->ends);
+    }
+    free(chunks);
+    ix->pos = p - ix->text;
+
+    if (indexDone(ix)) {
+        if (m->end < ix->text + ix->len) { // last line has no newline
+            addRows(m, ix->text + ix->len, 1);
+        }
+        flushSpan(m);
+    }
+    int numspans = m->numspans;
+    *spans = m->spans;
+    m->spans = NULL;
+    m->numspans = m->capspans = 0;
+    return numspans;
+}
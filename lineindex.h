@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// a run of whole lines of a file, one row block's worth
+struct span {
+    char *start;
+    size_t len;
+    int numrows;
+};
+
+struct indexer;
+
+struct indexer *newIndexer(char *text, size_t len);
+void freeIndexer(struct indexer *ix);
+
+int indexMore(struct indexer *ix, size_t maxbytes, struct span **spans);
+size_t indexedBytes(struct indexer *ix);
+bool indexDone(struct indexer *ix);
@@ -0,0 +1,109 @@
+#include "pool.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define MAX_WORKERS 63
+
+struct batch {
+    void (*job)(void *arg, int i);
+    void *arg;
+    int njobs;
+    int next; // next job to hand out
+    int done;
+    struct batch *link;
+};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queued = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t finished = PTHREAD_COND_INITIALIZER;
+static pthread_once_t started = PTHREAD_ONCE_INIT;
+
+static struct batch *queue; // batches with jobs left to hand out
+static int numworkers;
+
+static void unlinkBatch(struct batch *b) {
+    struct batch **p = &queue;
+    while (*p != b)
+        p = &(*p)->link;
+    *p = b->link;
+}
+
+// hand out the next job of b, lock must be held
+static int claim(struct batch *b) {
+    int i = b->next++;
+    if (b->next == b->njobs) {
+        unlinkBatch(b);
+    }
+    return i;
+}
+
+// run job i of b, lock must be held (and is again on return)
+static void runJob(struct batch *b, int i) {
+    pthread_mutex_unlock(&lock);
+    b->job(b->arg, i);
+    pthread_mutex_lock(&lock);
+    if (++b->done == b->njobs) {
+        pthread_cond_broadcast(&finished);
+    }
+}
+
+static void *worker(void *arg __attribute__((unused))) {
+    pthread_mutex_lock(&lock);
+    for (;;) {
+        while (queue == NULL) {
+            pthread_cond_wait(&queued, &lock);
+        }
+        struct batch *b = queue;
+        runJob(b, claim(b));
+    }
+    return NULL;
+}
+
+static void startWorkers(void) {
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    int want = ncpu > 1 ? (ncpu - 1 < MAX_WORKERS ? ncpu - 1 : MAX_WORKERS) : 0;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    for (int i = 0; i < want; i++) {
+        pthread_t tid;
+        if (pthread_create(&tid, &attr, worker, NULL) == 0) {
+            numworkers++;
+        }
+    }
+    pthread_attr_destroy(&attr);
+}
+
+int poolThreads(void) {
+    pthread_once(&started, startWorkers);
+    return numworkers + 1;
+}
+
+void poolRun(void (*job)(void *arg, int i), void *arg, int njobs) {
+    if (njobs <= 0)
+        return;
+    if (njobs == 1 || poolThreads() == 1) {
+        for (int i = 0; i < njobs; i++) {
+            job(arg, i);
+        }
+        return;
+    }
+
+    struct batch b = {job, arg, njobs, 0, 0, NULL};
+    pthread_mutex_lock(&lock);
+    struct batch **tail = &queue;
+    while (*tail)
+        tail = &(*tail)->link;
+    *tail = &b;
+    pthread_cond_broadcast(&queued);
+
+    while (b.next < b.njobs) { // help out with our own jobs
+        runJob(&b, claim(&b));
+    }
+    while (b.done < b.njobs) {
+        pthread_cond_wait(&finished, &lock);
+    }
+    pthread_mutex_unlock(&lock);
+}
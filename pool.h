@@ -0,0 +1,8 @@
+#pragma once
+
+/* run job(arg, i) for every i in [0, njobs) across the worker threads *
+ * (the calling thread helps), returns once every job has finished. *
+ * safe to call from several threads at once */
+void poolRun(void (*job)(void *arg, int i), void *arg, int njobs);
+
+int poolThreads(void);
@@ -0,0 +1,715 @@
+#include "regex.h"
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// DFA states a matcher caches before it throws them all away and restarts
+#define DFA_MAX_STATES 1024
+#define DFA_TABLE (DFA_MAX_STATES * 4) // hash slots, a power of two
+
+typedef unsigned char charset[32];
+
+static void setAdd(unsigned char *set, int c) { set[c >> 3] |= 1 << (c & 7); }
+
+static bool setHas(unsigned char *set, int c) {
+    return set[c >> 3] & (1 << (c & 7));
+}
+
+/* ======= PARSING ======= */
+enum nodeType { N_SET, N_CAT, N_ALT, N_STAR, N_PLUS, N_QUEST, N_BOL, N_EOL,
+                N_EMPTY };
+
+struct node {
+    enum nodeType type;
+    int left;
+    int right;
+    int set; // index into the sets, for N_SET
+};
+
+struct parser {
+    char *p;
+    char *end;
+    bool icase;
+    const char *error;
+
+    struct node *nodes;
+    int numnodes;
+    int capnodes;
+
+    charset *sets;
+    int numsets;
+    int capsets;
+};
+
+static int newNode(struct parser *ps, enum nodeType type, int left,
+                   int right) {
+    if (ps->numnodes == ps->capnodes) {
+        ps->capnodes = ps->capnodes ? ps->capnodes * 2 : 16;
+        ps->nodes = realloc(ps->nodes, ps->capnodes * sizeof(struct node));
+    }
+    struct node *n = &ps->nodes[ps->numnodes];
+    n->type = type;
+    n->left = left;
+    n->right = right;
+    n->set = -1;
+    return ps->numnodes++;
+}
+
+// a node matching one byte out of a fresh (empty) set
+static int newSetNode(struct parser *ps) {
+    if (ps->numsets == ps->capsets) {
+        ps->capsets = ps->capsets ? ps->capsets * 2 : 16;
+        ps->sets = realloc(ps->sets, ps->capsets * sizeof(charset));
+    }
+    memset(ps->sets[ps->numsets], 0, sizeof(charset));
+    int n = newNode(ps, N_SET, -1, -1);
+    ps->nodes[n].set = ps->numsets++;
+    return n;
+}
+
+static unsigned char *nodeSet(struct parser *ps, int n) {
+    return ps->sets[ps->nodes[n].set];
+}
+
+// let the set match either case of every letter in it
+static void foldSet(unsigned char *set) {
+    for (int c = 'a'; c <= 'z'; c++) {
+        if (setHas(set, c) || setHas(set, toupper(c))) {
+            setAdd(set, c);
+            setAdd(set, toupper(c));
+        }
+    }
+}
+
+// \d \w \s and negations, false if e isn't one of them
+static bool addClassEscape(unsigned char *set, int e) {
+    charset class = {0};
+    switch (tolower(e)) {
+    case 'd':
+        for (int c = '0'; c <= '9'; c++)
+            setAdd(class, c);
+        break;
+    case 'w':
+        for (int c = 0; c < 256; c++) {
+            if (isalnum(c) || c == '_')
+                setAdd(class, c);
+        }
+        break;
+    case 's':
+        for (int c = 0; c < 256; c++) {
+            if (isspace(c))
+                setAdd(class, c);
+        }
+        break;
+    default:
+        return false;
+    }
+    for (int i = 0; i < 32; i++) {
+        set[i] |= isupper(e) ? ~class[i] : class[i];
+    }
+    return true;
+}
+
+static int escapedChar(int e) { return e == 't' ? '\t' : e; }
+
+static int parseClass(struct parser *ps) {
+    int n = newSetNode(ps);
+    unsigned char *set = nodeSet(ps, n);
+    bool negate = ps->p < ps->end && *ps->p == '^';
+    if (negate)
+        ps->p++;
+    bool first = true; // a ] right at the start is taken literally
+    while (ps->p < ps->end && (*ps->p != ']' || first)) {
+        first = false;
+        int lo = (unsigned char)*ps->p++;
+        if (lo == '\\' && ps->p < ps->end) {
+            int e = (unsigned char)*ps->p++;
+            if (addClassEscape(set, e))
+                continue;
+            lo = escapedChar(e);
+        }
+        int hi = lo;
+        if (ps->end - ps->p >= 2 && ps->p[0] == '-' && ps->p[1] != ']') {
+            hi = (unsigned char)ps->p[1];
+            ps->p += 2;
+            if (hi == '\\' && ps->p < ps->end)
+                hi = escapedChar((unsigned char)*ps->p++);
+        }
+        if (hi < lo) {
+            ps->error = "bad range";
+            return n;
+        }
+        for (int c = lo; c <= hi; c++)
+            setAdd(set, c);
+    }
+    if (ps->p == ps->end) {
+        ps->error = "missing ]";
+        return n;
+    }
+    ps->p++;
+    if (ps->icase)
+        foldSet(set);
+    if (negate) {
+        for (int i = 0; i < 32; i++)
+            set[i] = ~set[i];
+    }
+    return n;
+}
+
+static int parseAlt(struct parser *ps);
+
+static int parseAtom(struct parser *ps) {
+    int c = (unsigned char)*ps->p++;
+    int n;
+    switch (c) {
+    case '(':
+        n = parseAlt(ps);
+        if (ps->p == ps->end || *ps->p != ')') {
+            ps->error = "missing )";
+        } else {
+            ps->p++;
+        }
+        return n;
+    case '*':
+    case '+':
+    case '?':
+        ps->error = "nothing to repeat";
+        return newNode(ps, N_EMPTY, -1, -1);
+    case '[':
+        return parseClass(ps);
+    case '^':
+        return newNode(ps, N_BOL, -1, -1);
+    case '$':
+        return newNode(ps, N_EOL, -1, -1);
+    case '.':
+        n = newSetNode(ps);
+        memset(nodeSet(ps, n), 0xff, sizeof(charset));
+        return n;
+    case '\\':
+        if (ps->p == ps->end) {
+            ps->error = "trailing \\";
+            return newNode(ps, N_EMPTY, -1, -1);
+        }
+        c = (unsigned char)*ps->p++;
+        n = newSetNode(ps);
+        if (addClassEscape(nodeSet(ps, n), c))
+            return n;
+        c = escapedChar(c);
+        break;
+    default:
+        n = newSetNode(ps);
+    }
+    setAdd(nodeSet(ps, n), c);
+    if (ps->icase)
+        foldSet(nodeSet(ps, n));
+    return n;
+}
+
+static int parseRepeat(struct parser *ps) {
+    int n = parseAtom(ps);
+    while (ps->p < ps->end && !ps->error) {
+        char c = *ps->p;
+        enum nodeType type;
+        if (c == '*') {
+            type = N_STAR;
+        } else if (c == '+') {
+            type = N_PLUS;
+        } else if (c == '?') {
+            type = N_QUEST;
+        } else {
+            break;
+        }
+        ps->p++;
+        n = newNode(ps, type, n, -1);
+    }
+    return n;
+}
+
+static int parseCat(struct parser *ps) {
+    int n = -1;
+    while (ps->p < ps->end && *ps->p != '|' && *ps->p != ')' && !ps->error) {
+        int next = parseRepeat(ps);
+        n = n == -1 ? next : newNode(ps, N_CAT, n, next);
+    }
+    return n == -1 ? newNode(ps, N_EMPTY, -1, -1) : n;
+}
+
+static int parseAlt(struct parser *ps) {
+    int n = parseCat(ps);
+    while (ps->p < ps->end && *ps->p == '|' && !ps->error) {
+        ps->p++;
+        n = newNode(ps, N_ALT, n, parseCat(ps));
+    }
+    return n;
+}
+
+/* ======= COMPILING ======= */
+// the Thompson NFA, as a program of instructions
+enum op { I_SET, I_SPLIT, I_JMP, I_MATCH, I_BOL, I_EOL };
+
+struct inst {
+    enum op op;
+    int x; // SPLIT and JMP targets
+    int y;
+    int set; // for I_SET
+};
+
+struct program {
+    struct inst *inst;
+    int len;
+    int cap;
+};
+
+/* the pattern forwards, and backwards to find where matches start from *
+ * where they end. both are the same length */
+struct regex {
+    struct program fwd;
+    struct program rev;
+    charset *sets;
+};
+
+static int emit(struct program *p, enum op op, int x, int y, int set) {
+    if (p->len == p->cap) {
+        p->cap = p->cap ? p->cap * 2 : 16;
+        p->inst = realloc(p->inst, p->cap * sizeof(struct inst));
+    }
+    p->inst[p->len] = (struct inst){op, x, y, set};
+    return p->len++;
+}
+
+/* reversed, concatenations come out right to left. ^ and $ stay as they *
+ * are, they're about where in the row a position is, not the direction */
+static void compileNode(struct program *p, struct node *nodes, int i,
+                        bool reversed) {
+    struct node *n = &nodes[i];
+    int split, jmp, start;
+    switch (n->type) {
+    case N_SET:
+        emit(p, I_SET, 0, 0, n->set);
+        break;
+    case N_BOL:
+        emit(p, I_BOL, 0, 0, -1);
+        break;
+    case N_EOL:
+        emit(p, I_EOL, 0, 0, -1);
+        break;
+    case N_EMPTY:
+        break;
+    case N_CAT:
+        compileNode(p, nodes, reversed ? n->right : n->left, reversed);
+        compileNode(p, nodes, reversed ? n->left : n->right, reversed);
+        break;
+    case N_ALT:
+        split = emit(p, I_SPLIT, p->len + 1, 0, -1);
+        compileNode(p, nodes, n->left, reversed);
+        jmp = emit(p, I_JMP, 0, 0, -1);
+        p->inst[split].y = p->len;
+        compileNode(p, nodes, n->right, reversed);
+        p->inst[jmp].x = p->len;
+        break;
+    case N_STAR:
+        split = emit(p, I_SPLIT, p->len + 1, 0, -1);
+        compileNode(p, nodes, n->left, reversed);
+        emit(p, I_JMP, split, 0, -1);
+        p->inst[split].y = p->len;
+        break;
+    case N_PLUS:
+        start = p->len;
+        compileNode(p, nodes, n->left, reversed);
+        emit(p, I_SPLIT, start, p->len + 1, -1);
+        break;
+    case N_QUEST:
+        split = emit(p, I_SPLIT, p->len + 1, 0, -1);
+        compileNode(p, nodes, n->left, reversed);
+        p->inst[split].y = p->len;
+        break;
+    }
+}
+
+/* compile a pattern, NULL with *error set if it is malformed *
+ * with icase, letters match either case */
+struct regex *compileRegex(char *pattern, int len, bool icase,
+                           const char **error) {
+    struct parser ps = {0};
+    ps.p = pattern;
+    ps.end = pattern + len;
+    ps.icase = icase;
+    int root = parseAlt(&ps);
+    if (!ps.error && ps.p < ps.end)
+        ps.error = "unmatched )";
+    if (ps.error) {
+        *error = ps.error;
+        free(ps.nodes);
+        free(ps.sets);
+        return NULL;
+    }
+
+    struct regex *re = calloc(1, sizeof(struct regex));
+    re->sets = ps.sets;
+    compileNode(&re->fwd, ps.nodes, root, false);
+    emit(&re->fwd, I_MATCH, 0, 0, -1);
+    compileNode(&re->rev, ps.nodes, root, true);
+    emit(&re->rev, I_MATCH, 0, 0, -1);
+    free(ps.nodes);
+    return re;
+}
+
+void freeRegex(struct regex *re) {
+    if (re == NULL)
+        return;
+    free(re->fwd.inst);
+    free(re->rev.inst);
+    free(re->sets);
+    free(re);
+}
+
+/* ======= MATCHER ======= */
+/* a DFA state: the NFA instructions (SET, MATCH and pending EOL) the *
+ * unanchored search can be at. built the first time it is reached */
+struct dstate {
+    int *pcs;
+    int numpcs;
+    bool match;      // a match has ended here
+    bool matchAtEnd; // or would if the row ended here
+    int next[256];   // -1 until worked out
+};
+
+struct threadList {
+    int *pc;
+    int *end; // where the thread's match ends, it runs backwards
+    int n;
+};
+
+struct matcher {
+    struct regex *re;
+    unsigned *mark; // per instruction, == gen if already visited
+    unsigned gen;
+    struct threadList lists[2];
+
+    struct dstate *states;
+    int numstates;
+    int *table; // hash of the states by their pcs, index + 1 (0 is empty)
+    int start[2]; // start state, by whether it is at the row start (-1)
+    int *buf;     // pcs of a state being built
+    int numbuf;
+
+    // the row regexRow was last given
+    int len;
+    bool *ends; // per position in it, whether a match ends there
+    int caprow;
+    int *found; // start and end pairs of the longest match from a position,
+    int numfound; // backwards from the row end
+    int next;     // the pair regexNext looks at first
+    int lastEnd;  // of the last match regexNext gave
+};
+
+struct matcher *newMatcher(struct regex *re) {
+    struct matcher *m = calloc(1, sizeof(struct matcher));
+    m->re = re;
+    int len = re->fwd.len;
+    m->mark = calloc(len, sizeof(unsigned));
+    for (int i = 0; i < 2; i++) {
+        m->lists[i].pc = malloc(len * sizeof(int));
+        m->lists[i].end = malloc(len * sizeof(int));
+    }
+    m->states = malloc(DFA_MAX_STATES * sizeof(struct dstate));
+    m->table = calloc(DFA_TABLE, sizeof(int));
+    m->start[0] = m->start[1] = -1;
+    m->buf = malloc(len * sizeof(int));
+    return m;
+}
+
+static void flushStates(struct matcher *m) {
+    for (int i = 0; i < m->numstates; i++) {
+        free(m->states[i].pcs);
+    }
+    m->numstates = 0;
+    memset(m->table, 0, DFA_TABLE * sizeof(int));
+    m->start[0] = m->start[1] = -1;
+}
+
+void freeMatcher(struct matcher *m) {
+    if (m == NULL)
+        return;
+    flushStates(m);
+    free(m->mark);
+    for (int i = 0; i < 2; i++) {
+        free(m->lists[i].pc);
+        free(m->lists[i].end);
+    }
+    free(m->states);
+    free(m->table);
+    free(m->buf);
+    free(m->ends);
+    free(m->found);
+    free(m);
+}
+
+// start a new round of marks
+static void nextGen(struct matcher *m) {
+    if (++m->gen == 0) {
+        memset(m->mark, 0, m->re->fwd.len * sizeof(unsigned));
+        m->gen = 1;
+    }
+}
+
+/* ======= LAZY DFA ======= */
+// the empty transitions from pc, into m->buf. EOL is left pending
+static void closure(struct matcher *m, int pc, bool bol) {
+    if (m->mark[pc] == m->gen)
+        return;
+    m->mark[pc] = m->gen;
+    struct inst *in = &m->re->fwd.inst[pc];
+    switch (in->op) {
+    case I_JMP:
+        closure(m, in->x, bol);
+        break;
+    case I_SPLIT:
+        closure(m, in->x, bol);
+        closure(m, in->y, bol);
+        break;
+    case I_BOL:
+        if (bol)
+            closure(m, pc + 1, bol);
+        break;
+    default:
+        m->buf[m->numbuf++] = pc;
+    }
+}
+
+/* can a match be reached from pc if the row ends here. bol if it's the row *
+ * start too, which only an empty row has */
+static bool matchesAtEnd(struct matcher *m, int pc, bool bol) {
+    if (m->mark[pc] == m->gen)
+        return false;
+    m->mark[pc] = m->gen;
+    struct inst *in = &m->re->fwd.inst[pc];
+    switch (in->op) {
+    case I_MATCH:
+        return true;
+    case I_JMP:
+        return matchesAtEnd(m, in->x, bol);
+    case I_SPLIT:
+        return matchesAtEnd(m, in->x, bol) || matchesAtEnd(m, in->y, bol);
+    case I_EOL:
+        return matchesAtEnd(m, pc + 1, bol);
+    case I_BOL:
+        return bol && matchesAtEnd(m, pc + 1, bol);
+    default:
+        return false;
+    }
+}
+
+static int comparePc(const void *a, const void *b) {
+    return *(const int *)a - *(const int *)b;
+}
+
+// the state for the pcs in m->buf, added to the cache if it is new
+static int internState(struct matcher *m) {
+    qsort(m->buf, m->numbuf, sizeof(int), comparePc);
+    uint32_t h = 2166136261u; // FNV-1a
+    for (int i = 0; i < m->numbuf; i++) {
+        h = (h ^ m->buf[i]) * 16777619u;
+    }
+    size_t bytes = m->numbuf * sizeof(int);
+    unsigned slot = h & (DFA_TABLE - 1);
+    for (; m->table[slot]; slot = (slot + 1) & (DFA_TABLE - 1)) {
+        struct dstate *d = &m->states[m->table[slot] - 1];
+        if (d->numpcs == m->numbuf && !memcmp(d->pcs, m->buf, bytes))
+            return m->table[slot] - 1;
+    }
+
+    if (m->numstates == DFA_MAX_STATES) { // full, start over
+        flushStates(m);
+        slot = h & (DFA_TABLE - 1);
+    }
+    struct dstate *d = &m->states[m->numstates];
+    d->pcs = malloc(bytes);
+    memcpy(d->pcs, m->buf, bytes);
+    d->numpcs = m->numbuf;
+    d->match = false;
+    d->matchAtEnd = false;
+    nextGen(m);
+    for (int i = 0; i < d->numpcs; i++) {
+        enum op op = m->re->fwd.inst[d->pcs[i]].op;
+        d->match |= op == I_MATCH;
+        if (op == I_EOL && matchesAtEnd(m, d->pcs[i] + 1, false))
+            d->matchAtEnd = true;
+    }
+    d->matchAtEnd |= d->match;
+    memset(d->next, -1, sizeof(d->next));
+    m->table[slot] = m->numstates + 1;
+    return m->numstates++;
+}
+
+static int startState(struct matcher *m, bool bol) {
+    if (m->start[bol] == -1) {
+        nextGen(m);
+        m->numbuf = 0;
+        closure(m, 0, bol);
+        int s = internState(m);
+        m->start[bol] = s;
+    }
+    return m->start[bol];
+}
+
+// the state after s reads c. a new match may start at every byte
+static int stepState(struct matcher *m, int s, unsigned char c) {
+    nextGen(m);
+    m->numbuf = 0;
+    struct dstate *d = &m->states[s];
+    for (int i = 0; i < d->numpcs; i++) {
+        struct inst *in = &m->re->fwd.inst[d->pcs[i]];
+        if (in->op == I_SET && setHas(m->re->sets[in->set], c))
+            closure(m, d->pcs[i] + 1, false);
+    }
+    closure(m, 0, false);
+    int numstates = m->numstates;
+    int t = internState(m);
+    if (m->numstates >= numstates) // s survived, remember the way
+        m->states[s].next[c] = t;
+    return t;
+}
+
+/* does the start state match an empty row, where ^ can follow $. states *
+ * don't know if the row is empty, so this isn't in matchAtEnd */
+static bool matchesEmpty(struct matcher *m, int s) {
+    struct dstate *d = &m->states[s];
+    nextGen(m);
+    for (int i = 0; i < d->numpcs; i++) {
+        int pc = d->pcs[i];
+        if (m->re->fwd.inst[pc].op == I_EOL && matchesAtEnd(m, pc + 1, true))
+            return true;
+    }
+    return false;
+}
+
+/* mark where in the row matches end, in one pass. the last position that *
+ * one does, -1 if none */
+static int dfaEnds(struct matcher *m, char *text, int len) {
+    int s = startState(m, true);
+    int last = -1;
+    for (int i = 0; i < len; i++) {
+        m->ends[i] = m->states[s].match;
+        last = m->ends[i] ? i : last;
+        unsigned char c = text[i];
+        int t = m->states[s].next[c];
+        s = t >= 0 ? t : stepState(m, s, c);
+    }
+    m->ends[len] = m->states[s].matchAtEnd || (len == 0 && matchesEmpty(m, s));
+    return m->ends[len] ? len : last;
+}
+
+/* ======= NFA SIMULATION ======= */
+// follow the reversed program's empty transitions from pc at pos
+static void addThread(struct matcher *m, struct threadList *l, int pc,
+                      int end, int pos) {
+    if (m->mark[pc] == m->gen)
+        return;
+    m->mark[pc] = m->gen;
+    struct inst *in = &m->re->rev.inst[pc];
+    switch (in->op) {
+    case I_JMP:
+        addThread(m, l, in->x, end, pos);
+        break;
+    case I_SPLIT:
+        addThread(m, l, in->x, end, pos);
+        addThread(m, l, in->y, end, pos);
+        break;
+    case I_BOL:
+        if (pos == 0)
+            addThread(m, l, pc + 1, end, pos);
+        break;
+    case I_EOL:
+        if (pos == m->len)
+            addThread(m, l, pc + 1, end, pos);
+        break;
+    default:
+        l->pc[l->n] = pc;
+        l->end[l->n] = end;
+        l->n++;
+    }
+}
+
+/* the longest match from every position, by running the reversed program *
+ * back from top, starting a thread wherever the DFA saw a match end (Pike's *
+ * VM without captures). threads are kept in order of their end, latest *
+ * first, and one reaching an instruction first shadows any later ones, so *
+ * each step is linear in the size of the program. stretches with no *
+ * threads running are skipped */
+static void pikeBack(struct matcher *m, char *text, int top) {
+    struct threadList *cl = &m->lists[0];
+    struct threadList *nl = &m->lists[1];
+    cl->n = 0;
+    nextGen(m);
+    for (int i = top; i >= 0; i--) {
+        if (m->ends[i])
+            addThread(m, cl, 0, i, i);
+        for (int k = 0; k < cl->n; k++) {
+            if (m->re->rev.inst[cl->pc[k]].op == I_MATCH) {
+                m->found[2 * m->numfound] = i;
+                m->found[2 * m->numfound + 1] = cl->end[k];
+                m->numfound++;
+                break;
+            }
+        }
+        nextGen(m);
+        nl->n = 0;
+        unsigned char c = i > 0 ? text[i - 1] : 0;
+        for (int k = 0; i > 0 && k < cl->n; k++) {
+            struct inst *in = &m->re->rev.inst[cl->pc[k]];
+            if (in->op == I_SET && setHas(m->re->sets[in->set], c))
+                addThread(m, nl, cl->pc[k] + 1, cl->end[k], i - 1);
+        }
+        struct threadList *t = cl;
+        cl = nl;
+        nl = t;
+        if (cl->n == 0) { // nothing running, on to where the next match ends
+            while (i > 0 && !m->ends[i - 1]) {
+                i--;
+            }
+            nextGen(m); // marks at the skipped position don't hold there
+        }
+    }
+}
+
+/* ======= MATCHING ======= */
+/* take in a row to find the matches of, for regexNext. the DFA goes over *
+ * it once to see where matches end, rows without any are done with then. *
+ * otherwise the NFA goes back over it once to find where they start */
+void regexRow(struct matcher *m, char *text, int len) {
+    if (len + 1 > m->caprow) {
+        m->caprow = len + 1 > m->caprow * 2 ? len + 1 : m->caprow * 2;
+        m->ends = realloc(m->ends, m->caprow * sizeof(bool));
+        m->found = realloc(m->found, 2 * m->caprow * sizeof(int));
+    }
+    m->len = len;
+    m->lastEnd = -1;
+    m->numfound = 0;
+    int top = dfaEnds(m, text, len);
+    if (top >= 0)
+        pikeBack(m, text, top);
+    m->next = m->numfound - 1;
+}
+
+/* the leftmost-longest match in the row starting at or after from, its *
+ * length in *mlen. -1 if none. an empty match right where the last one *
+ * ended doesn't count, so the next is looked for from c + max(*mlen, 1) */
+int regexNext(struct matcher *m, int from, int *mlen) {
+    if (m->next < m->numfound - 1 && m->found[2 * m->next + 2] >= from) {
+        m->next = m->numfound - 1; // gone back, start over
+        m->lastEnd = -1;
+    }
+    for (; m->next >= 0; m->next--) {
+        int start = m->found[2 * m->next];
+        int end = m->found[2 * m->next + 1];
+        if (start < from || (end == start && start == m->lastEnd))
+            continue;
+        m->lastEnd = end;
+        *mlen = end - start;
+        return start;
+    }
+    return -1;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdbool.h>
+
+/* regular expressions, matched in time linear in the text (no backtracking) *
+ * supported: literals, . [] [^] a-z ranges, * + ? |, (), ^ $ (ends of the *
+ * row), \d \w \s and their negations \D \W \S, \t, \ to escape the rest */
+struct regex;
+
+/* scratch state for matching: the lazily built DFA, and where the matches *
+ * of the row being searched are. one per thread */
+struct matcher;
+
+struct regex *compileRegex(char *pattern, int len, bool icase,
+                           const char **error);
+void freeRegex(struct regex *re);
+
+struct matcher *newMatcher(struct regex *re);
+void freeMatcher(struct matcher *m);
+
+/* the matches of a row, leftmost-longest and not overlapping, in time *
+ * linear in the row however many there are: regexRow, then regexNext from *
+ * 0 and from just past each match it gives */
+void regexRow(struct matcher *m, char *text, int len);
+int regexNext(struct matcher *m, int from, int *mlen);
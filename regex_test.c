@@ -0,0 +1,150 @@
+/* tests for regex.c, run by make test: the matches patterns find in rows, *
+ * leftmost-longest and one after another as a search goes through them */
+
+#include "regex.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int failed;
+
+/* every match of pattern in text as "start+len" separated by spaces, *
+ * or the compile error */
+static void matches(char *pattern, bool icase, char *text, char *out,
+                    size_t size) {
+    const char *error;
+    struct regex *re = compileRegex(pattern, strlen(pattern), icase, &error);
+    if (re == NULL) {
+        snprintf(out, size, "error: %s", error);
+        return;
+    }
+    struct matcher *m = newMatcher(re);
+    regexRow(m, text, strlen(text));
+    out[0] = '\0';
+    int c = 0;
+    int len;
+    while ((c = regexNext(m, c, &len)) != -1) {
+        size_t used = strlen(out);
+        snprintf(out + used, size - used, "%s%d+%d", used ? " " : "", c, len);
+        c += len > 0 ? len : 1;
+    }
+    freeMatcher(m);
+    freeRegex(re);
+}
+
+static void expect(char *pattern, bool icase, char *text, char *want) {
+    char got[256];
+    matches(pattern, icase, text, got, sizeof(got));
+    if (strcmp(got, want)) {
+        printf("FAIL /%s/%s on \"%s\": got \"%s\", want \"%s\"\n", pattern,
+               icase ? "i" : "", text, got, want);
+        failed++;
+    }
+}
+
+// a long row the matches of pattern are counted in, want of them
+static void expectCount(char *pattern, char *text, int want) {
+    const char *error;
+    struct regex *re = compileRegex(pattern, strlen(pattern), false, &error);
+    struct matcher *m = newMatcher(re);
+    int len = strlen(text);
+    regexRow(m, text, len);
+    int n = 0;
+    for (int c = 0; (c = regexNext(m, c, &len)) != -1; c += len ? len : 1) {
+        n++;
+    }
+    if (n != want) {
+        printf("FAIL /%s/ on a long row: %d matches, want %d\n", pattern, n,
+               want);
+        failed++;
+    }
+    freeMatcher(m);
+    freeRegex(re);
+}
+
+static char *repeat(char *s, int times) {
+    int len = strlen(s);
+    char *text = malloc(len * times + 1);
+    for (int i = 0; i < times; i++) {
+        memcpy(text + i * len, s, len);
+    }
+    text[len * times] = '\0';
+    return text;
+}
+
+int main(void) {
+    // leftmost, then longest
+    expect("a|ab", false, "ab", "0+2");
+    expect("(a|ab)(c|bcd)", false, "abcd", "0+4");
+    expect("abc|b+", false, "abbb", "1+3");
+    expect("b+|abbbc", false, "abbbc", "0+5");
+    expect("a[^x]*b|a", false, "aaab", "0+4");
+    expect("x", false, "abc", "");
+
+    // one after another, never overlapping
+    expect("\\w+", false, "hello world", "0+5 6+5");
+    expect("aa", false, "aaaaa", "0+2 2+2");
+    expect(".*", false, "abc", "0+3");
+    expect("x*", false, "axxb", "0+0 1+2 4+0");
+    expect("a[^x]*b|a", false, "aaaa", "0+1 1+1 2+1 3+1");
+    expect("", false, "ab", "0+0 1+0 2+0");
+
+    // ^ and $ are the ends of the row
+    expect("^a", false, "aaa", "0+1");
+    expect("a$", false, "aaa", "2+1");
+    expect("^a*$", false, "aaa", "0+3");
+    expect("^$", false, "", "0+0");
+    expect("^$", false, "a", "");
+    expect("b$|a", false, "ab", "0+1 1+1");
+    expect("(^|b)c", false, "cbc", "0+1 1+2");
+    expect("^(ab)?|b", false, "cab", "0+0 2+1");
+    expect("$^", false, "", "0+0");
+    expect("$^", false, "a", "");
+
+    // classes, negated ones included
+    expect("[^a-c]+", false, "abxyzc", "2+3");
+    expect("\\D+", false, "ab12cd", "0+2 4+2");
+    expect("[^\\s]+", false, "a b", "0+1 2+1");
+    expect("[^a]", true, "aAb", "2+1");
+    expect("[]a]+", false, "x]a]", "1+3");
+    expect("\\.", false, "a.b", "1+1");
+    expect("A", true, "xa", "1+1");
+
+    expect("(a", false, "", "error: missing )");
+    expect("a)", false, "", "error: unmatched )");
+    expect("[b-a]", false, "", "error: bad range");
+    expect("*a", false, "", "error: nothing to repeat");
+
+    /* rows that would take quadratic time to go through a match at a time, *
+     * if each search went to the end of the row */
+    char *text = repeat("a", 200000);
+    expectCount("a[^x]*b|a", text, 200000);
+    expectCount(".*", text, 1);
+    free(text);
+    text = repeat("hello world ", 20000);
+    expectCount("\\w+", text, 40000);
+    free(text);
+
+    /* a's and b's at random: more DFA states than a matcher keeps, so *
+     * they're thrown away midway. the counts are Python's re */
+    text = malloc(100001);
+    unsigned x = 1;
+    for (int i = 0; i < 100000; i++) {
+        x = (x * 1103515245 + 12345) & 0x7fffffff;
+        text[i] = "ab"[(x >> 16) & 1];
+    }
+    text[100000] = '\0';
+    expectCount("a(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)", text,
+                8338);
+    expectCount("(a|b)*a(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)",
+                text, 1);
+    free(text);
+
+    if (failed) {
+        printf("%d failed\n", failed);
+        return 1;
+    }
+    printf("regex: all passed\n");
+    return 0;
+}
@@ -0,0 +1,297 @@
+#include "rowtree.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* ======= BLOCK UTILS ======= */
+static int max0(int n) { return n > 0 ? n : 0; }
+
+static unsigned nextPrio(void) { // xorshift, the treap just needs noise
+    static unsigned state = 2463534242u;
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+struct rowblock *newBlock(void) {
+    struct rowblock *b = calloc(1, sizeof(struct rowblock));
+    b->prio = nextPrio();
+    b->height = -1;
+    b->stale = true;
+    return b;
+}
+
+void freeBlock(struct rowblock *b) {
+    free(b->rows);
+    free(b->heights);
+    free(b);
+}
+
+// frees the block structures only, rows must be cleared by the caller
+void freeBlockTree(struct rowblock *root) {
+    if (root == NULL)
+        return;
+    freeBlockTree(root->left);
+    freeBlockTree(root->right);
+    freeBlock(root);
+}
+
+static int subrows(struct rowblock *b) { return b ? b->subrows : 0; }
+static int subheight(struct rowblock *b) { return b ? b->subheight : 0; }
+static bool stale(struct rowblock *b) { return b && b->stale; }
+
+static void update(struct rowblock *b) {
+    b->subrows = b->numrows + subrows(b->left) + subrows(b->right);
+    b->subheight =
+        max0(b->height) + subheight(b->left) + subheight(b->right);
+    b->stale = b->height < 0 || stale(b->left) || stale(b->right);
+}
+
+/* ======= NAVIGATION ======= */
+/* find the block holding row *r, *r becomes the index inside the block *
+ * *r == total rows finds the end of the last block */
+struct rowblock *findBlock(struct rowblock *root, int *r) {
+    struct rowblock *b = root;
+    while (b) {
+        int leftrows = subrows(b->left);
+        if (*r < leftrows) {
+            b = b->left;
+        } else if (*r < leftrows + b->numrows ||
+                   (b->right == NULL && *r == leftrows + b->numrows)) {
+            *r -= leftrows;
+            return b;
+        } else {
+            *r -= leftrows + b->numrows;
+            b = b->right;
+        }
+    }
+    return NULL;
+}
+
+struct rowblock *firstBlock(struct rowblock *root) {
+    if (root == NULL)
+        return NULL;
+    while (root->left)
+        root = root->left;
+    return root;
+}
+
+struct rowblock *lastBlock(struct rowblock *root) {
+    if (root == NULL)
+        return NULL;
+    while (root->right)
+        root = root->right;
+    return root;
+}
+
+struct rowblock *nextBlock(struct rowblock *b) {
+    if (b->right)
+        return firstBlock(b->right);
+    while (b->parent && b->parent->right == b)
+        b = b->parent;
+    return b->parent;
+}
+
+struct rowblock *prevBlock(struct rowblock *b) {
+    if (b->left)
+        return lastBlock(b->left);
+    while (b->parent && b->parent->left == b)
+        b = b->parent;
+    return b->parent;
+}
+
+/* ======= STRUCTURE ======= */
+// rotate x above its parent, keeping the in-order sequence
+static void rotateUp(struct rowblock **root, struct rowblock *x) {
+    struct rowblock *p = x->parent;
+    struct rowblock *g = p->parent;
+    if (p->left == x) {
+        p->left = x->right;
+        if (x->right)
+            x->right->parent = p;
+        x->right = p;
+    } else {
+        p->right = x->left;
+        if (x->left)
+            x->left->parent = p;
+        x->left = p;
+    }
+    p->parent = x;
+    x->parent = g;
+    if (g == NULL) {
+        *root = x;
+    } else if (g->left == p) {
+        g->left = x;
+    } else {
+        g->right = x;
+    }
+    update(p);
+    update(x);
+}
+
+/* link b into the tree right after pos *
+ * pos == NULL inserts b in front of every other block */
+void insertBlockAfter(struct rowblock **root, struct rowblock *pos,
+                      struct rowblock *b) {
+    b->left = b->right = NULL;
+    update(b);
+    if (*root == NULL) {
+        b->parent = NULL;
+        *root = b;
+        return;
+    }
+
+    struct rowblock *parent;
+    if (pos == NULL) {
+        parent = firstBlock(*root);
+        parent->left = b;
+    } else if (pos->right == NULL) {
+        parent = pos;
+        parent->right = b;
+    } else {
+        parent = firstBlock(pos->right);
+        parent->left = b;
+    }
+    b->parent = parent;
+    for (struct rowblock *n = parent; n; n = n->parent) {
+        update(n);
+    }
+
+    while (b->parent && b->parent->prio < b->prio) {
+        rotateUp(root, b);
+    }
+}
+
+// unlink b from the tree, does not free it
+void removeBlock(struct rowblock **root, struct rowblock *b) {
+    while (b->left && b->right) {
+        if (b->left->prio > b->right->prio) {
+            rotateUp(root, b->left);
+        } else {
+            rotateUp(root, b->right);
+        }
+    }
+    struct rowblock *child = b->left ? b->left : b->right;
+    struct rowblock *parent = b->parent;
+    if (child)
+        child->parent = parent;
+    if (parent == NULL) {
+        *root = child;
+    } else if (parent->left == b) {
+        parent->left = child;
+    } else {
+        parent->right = child;
+    }
+    for (struct rowblock *n = parent; n; n = n->parent) {
+        update(n);
+    }
+    b->left = b->right = b->parent = NULL;
+}
+
+// rows were added to (or removed from) b, fix the cached counts
+void resizeBlock(struct rowblock *b, int delta) {
+    assert(b->numrows + delta >= 0 && b->numrows + delta <= ROWBLOCK_MAX);
+    b->numrows += delta;
+    b->height = -1;
+    for (struct rowblock *n = b; n; n = n->parent) {
+        n->subrows += delta;
+        n->stale = true;
+    }
+}
+
+/* ======= HEIGHTS ======= */
+/* rows [from, from + n) of src moved to [to, to + n) of dst, their heights *
+ * go with them. dst may be src, the ranges may overlap */
+void moveHeights(struct rowblock *dst, int to, struct rowblock *src, int from,
+                 int n) {
+    if (n <= 0)
+        return;
+    if (src->heights == NULL) {
+        forgetHeights(dst, to, n);
+        return;
+    }
+    if (dst->heights == NULL) {
+        dst->heights = malloc(ROWBLOCK_MAX * sizeof(int));
+        forgetHeights(dst, 0, ROWBLOCK_MAX);
+    }
+    memmove(dst->heights + to, src->heights + from, n * sizeof(int));
+}
+
+// rows [at, at + n) of b are new or changed, their heights unmeasured
+void forgetHeights(struct rowblock *b, int at, int n) {
+    for (int i = at; b->heights && i < at + n; i++) {
+        b->heights[i] = -1;
+    }
+}
+
+// the rows of b changed, its height has to be worked out again
+void staleBlock(struct rowblock *b) {
+    b->height = -1;
+    b->stale = true;
+    for (struct rowblock *n = b->parent; n && !n->stale; n = n->parent) {
+        n->stale = true;
+    }
+}
+
+// stale every block, the heights are for another width now
+void staleTree(struct rowblock *root) {
+    if (root == NULL)
+        return;
+    staleTree(root->left);
+    staleTree(root->right);
+    root->height = -1;
+    root->stale = true;
+}
+
+/* the caller filled in the height of every stale block, redo the cached *
+ * totals above them */
+void refreshHeights(struct rowblock *root) {
+    if (root == NULL || !root->stale)
+        return;
+    refreshHeights(root->left);
+    refreshHeights(root->right);
+    update(root);
+}
+
+/* find the block holding screen line *line (counted from the first row), *
+ * *line becomes the line inside the block. no block may be stale */
+struct rowblock *findLine(struct rowblock *root, int *line) {
+    struct rowblock *b = root;
+    while (b) {
+        int leftlines = subheight(b->left);
+        if (*line < leftlines) {
+            b = b->left;
+        } else if (*line < leftlines + b->height || b->right == NULL) {
+            *line -= leftlines;
+            return b;
+        } else {
+            *line -= leftlines + b->height;
+            b = b->right;
+        }
+    }
+    return NULL;
+}
+
+// rows of every block before b
+int rowsBefore(struct rowblock *b) {
+    int rows = subrows(b->left);
+    for (; b->parent; b = b->parent) {
+        if (b->parent->right == b) {
+            rows += subrows(b->parent->left) + b->parent->numrows;
+        }
+    }
+    return rows;
+}
+
+// screen lines of every block before b. no block may be stale
+int linesBefore(struct rowblock *b) {
+    int lines = subheight(b->left);
+    for (; b->parent; b = b->parent) {
+        if (b->parent->right == b) {
+            lines += subheight(b->parent->left) + b->parent->height;
+        }
+    }
+    return lines;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct erow;
+
+// rows a block can hold before it is split in two
+#define ROWBLOCK_MAX 512
+// how full freshly built blocks are, leaves room for typing
+#define ROWBLOCK_FILL (ROWBLOCK_MAX * 3 / 4)
+
+/* a run of consecutive rows, kept in a treap ordered by position *
+ * every node caches the number of rows in its subtree, so finding *
+ * or splicing a row by index is O(log n). the same goes for the rows' *
+ * wrapped heights, which are filled in by their owner (see wrap.h) */
+struct rowblock {
+    int numrows; // rows in this block
+    int subrows; // rows in this block + both subtrees
+    unsigned prio;
+
+    int height; // screen lines of this block's rows, -1 if stale
+    int *heights; // each row's, -1 if unmeasured. NULL while none are
+    int subheight; // height of this block + both subtrees, stale ones as 0
+    bool stale; // some block in this subtree has a stale height
+
+    struct rowblock *left;
+    struct rowblock *right;
+    struct rowblock *parent;
+
+    struct erow *rows; // ROWBLOCK_MAX slots, NULL while paged out
+    bool shared; // rows also belong to a snapshot being saved (editor.h)
+
+    // where the rows are in the file map while paged out
+    char *span;
+    size_t spanlen;
+
+    // resident blocks, most recently used first
+    struct rowblock *lruprev;
+    struct rowblock *lrunext;
+};
+
+struct rowblock *newBlock(void);
+void freeBlock(struct rowblock *b);
+void freeBlockTree(struct rowblock *root);
+
+struct rowblock *findBlock(struct rowblock *root, int *r);
+struct rowblock *firstBlock(struct rowblock *root);
+struct rowblock *lastBlock(struct rowblock *root);
+struct rowblock *nextBlock(struct rowblock *b);
+struct rowblock *prevBlock(struct rowblock *b);
+
+void insertBlockAfter(struct rowblock **root, struct rowblock *pos,
+                      struct rowblock *b);
+void removeBlock(struct rowblock **root, struct rowblock *b);
+void resizeBlock(struct rowblock *b, int delta);
+
+int rowsBefore(struct rowblock *b);
+
+void moveHeights(struct rowblock *dst, int to, struct rowblock *src, int from,
+                 int n);
+void forgetHeights(struct rowblock *b, int at, int n);
+void staleBlock(struct rowblock *b);
+void staleTree(struct rowblock *root);
+void refreshHeights(struct rowblock *root);
+struct rowblock *findLine(struct rowblock *root, int *line);
+int linesBefore(struct rowblock *b);
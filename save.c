@@ -0,0 +1,302 @@
+#include "save.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+// iovecs gathered before each writev (IOV_MAX is 1024 on linux and macos)
+#define SAVE_IOVS 1024
+
+/* a save in progress. the buffer is written from a snapshot (editor.h) *
+ * on a thread of its own, editing carries on meanwhile */
+struct saveJob {
+    pthread_t thread;
+    bool joined; // thread has ended (or never started)
+    struct snapshot *S;
+    int fd;
+    bool inplace;
+    char target[PATH_MAX];
+    char tmp[PATH_MAX + 32];
+    struct timespec start;
+    struct saveResult res; // the thread's until done
+
+    pthread_mutex_t lock;
+    size_t written; // under lock
+    bool done; // under lock
+};
+
+struct writer {
+    int fd;
+    struct saveJob *job;
+    struct iovec iov[SAVE_IOVS];
+    int numiov;
+    size_t bytes;
+};
+
+/* ======= WRITEV BATCHING ======= */
+// write out every gathered iovec, retrying short writes
+static int flushWriter(struct writer *w) {
+    struct iovec *iov = w->iov;
+    int cnt = w->numiov;
+    while (cnt > 0) {
+        ssize_t n = writev(w->fd, iov, cnt);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        w->bytes += n;
+        while (cnt > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            cnt--;
+        }
+        if (cnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    w->numiov = 0;
+    pthread_mutex_lock(&w->job->lock);
+    w->job->written = w->bytes;
+    pthread_mutex_unlock(&w->job->lock);
+    return 0;
+}
+
+// queue len bytes at text, merging with the previous iovec if they touch
+static int gather(struct writer *w, char *text, size_t len) {
+    if (len == 0)
+        return 0;
+    if (w->numiov > 0) {
+        struct iovec *last = &w->iov[w->numiov - 1];
+        if ((char *)last->iov_base + last->iov_len == text) {
+            last->iov_len += len;
+            return 0;
+        }
+    }
+    if (w->numiov == SAVE_IOVS && flushWriter(w) == -1)
+        return -1;
+    w->iov[w->numiov].iov_base = text;
+    w->iov[w->numiov].iov_len = len;
+    w->numiov++;
+    return 0;
+}
+
+static bool inMap(struct snapshot *S, char *p) {
+    return S->map && p >= S->map && p < S->map + S->maplen;
+}
+
+static int writeRowArray(struct writer *w, struct erow *rows, int numrows) {
+    static char newline[] = "\n";
+    for (int i = 0; i < numrows; i++) {
+        struct erow *row = &rows[i];
+        char *eol = row->text + row->len;
+        if (gather(w, row->text, row->len) == -1)
+            return -1;
+        if (row->cap == 0 && inMap(w->job->S, eol) && *eol == '\n') {
+            if (gather(w, eol, 1) == -1)
+                return -1;
+        } else if (gather(w, newline, 1) == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* every row followed by \n. untouched rows of a mapped file are still *
+ * followed by their own \n in the map, so whole runs of them collapse *
+ * into one iovec */
+static int writeRows(struct writer *w) {
+    struct snapshot *S = w->job->S;
+    struct erow scratch[ROWBLOCK_MAX];
+    for (int v = 0; v < S->numviews; v++) {
+        struct blockView *view = &S->views[v];
+        struct erow *rows = view->rows;
+        if (rows == NULL) {
+            char *p = view->span;
+            splitRows(&p, view->span + view->spanlen, scratch,
+                      view->numrows);
+            rows = scratch;
+        }
+        if (writeRowArray(w, rows, view->numrows) == -1)
+            return -1;
+    }
+    // what the loader hadn't got to, a block's worth of rows at a time
+    char *p = S->tail;
+    while (p < S->tail + S->taillen) {
+        int n = splitRows(&p, S->tail + S->taillen, scratch, ROWBLOCK_MAX);
+        if (writeRowArray(w, scratch, n) == -1)
+            return -1;
+    }
+    return flushWriter(w);
+}
+
+/* ======= SAVE ======= */
+static double elapsed(struct timespec start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+static struct saveResult failed(struct saveResult res, const char *step) {
+    res.error = errno;
+    res.step = step;
+    return res;
+}
+
+// create the temporary file next to path, with path's permissions
+static int createTemp(char *path, char *tmp, size_t size) {
+    char *dir = strdup(path);
+    char *base = strdup(path);
+    snprintf(tmp, size, "%s/.%s.elfin-XXXXXX", dirname(dir), basename(base));
+    free(dir);
+    free(base);
+    int fd = mkstemp(tmp);
+    if (fd == -1)
+        return -1;
+
+    struct stat st;
+    mode_t mode;
+    if (stat(path, &st) == 0) {
+        mode = st.st_mode & 07777;
+    } else { // new file, what open(O_CREAT, 0666) would have given it
+        mode_t mask = umask(0);
+        umask(mask);
+        mode = 0666 & ~mask;
+    }
+    fchmod(fd, mode);
+    return fd;
+}
+
+// make the rename itself durable
+static void syncDir(char *path) {
+    char *copy = strdup(path);
+    int fd = open(dirname(copy), O_RDONLY);
+    free(copy);
+    if (fd != -1) {
+        fsync(fd);
+        close(fd);
+    }
+}
+
+static void *saveThread(void *arg) {
+    struct saveJob *job = arg;
+    struct saveResult res = job->res;
+    struct writer w;
+    w.fd = job->fd;
+    w.job = job;
+    w.numiov = 0;
+    w.bytes = 0;
+    int err = writeRows(&w);
+    res.bytes = w.bytes;
+
+    if (err == -1) {
+        res = failed(res, "write");
+    } else if (fsync(job->fd) == -1) {
+        res = failed(res, "fsync");
+    }
+    if (close(job->fd) == -1 && res.error == 0) {
+        res = failed(res, "close");
+    }
+    if (!job->inplace) {
+        if (res.error == 0 && rename(job->tmp, job->target) == -1) {
+            res = failed(res, "rename");
+        }
+        if (res.error != 0) {
+            unlink(job->tmp);
+        } else {
+            syncDir(job->target);
+        }
+    }
+    if (res.error == 0) {
+        res.seconds = elapsed(job->start);
+    }
+
+    pthread_mutex_lock(&job->lock);
+    job->res = res;
+    job->done = true;
+    pthread_mutex_unlock(&job->lock);
+    return NULL;
+}
+
+/* start writing the buffer, as it is now, to filename. it goes to a *
+ * temporary file in the same directory which is fsynced and renamed over *
+ * filename, so a crash midway never leaves a truncated file. if the *
+ * directory isn't writable, the file is rewritten in place instead */
+struct saveJob *startSave(struct editor *E, char *filename) {
+    struct saveJob *job = calloc(1, sizeof(struct saveJob));
+    pthread_mutex_init(&job->lock, NULL);
+    job->joined = true;
+    clock_gettime(CLOCK_MONOTONIC, &job->start);
+
+    // save through symlinks rather than replacing them
+    if (realpath(filename, job->target) == NULL) {
+        snprintf(job->target, sizeof(job->target), "%s", filename);
+    }
+    job->fd = createTemp(job->target, job->tmp, sizeof(job->tmp));
+    if (job->fd == -1 &&
+        (errno == EACCES || errno == EPERM || errno == EROFS)) {
+        job->inplace = true;
+        unmapFile(E);
+        job->fd = open(job->target, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    }
+    if (job->fd == -1) {
+        job->res = failed(job->res, "create");
+        job->done = true;
+        return job;
+    }
+
+    job->S = takeSnapshot(E);
+    if (pthread_create(&job->thread, NULL, saveThread, job) == 0) {
+        job->joined = false;
+    } else {
+        saveThread(job); // no thread, save it all now
+    }
+    return job;
+}
+
+bool saveDone(struct saveJob *job) {
+    pthread_mutex_lock(&job->lock);
+    bool done = job->done;
+    pthread_mutex_unlock(&job->lock);
+    return done;
+}
+
+// percentage of the buffer written so far
+int saveProgress(struct saveJob *job) {
+    pthread_mutex_lock(&job->lock);
+    size_t written = job->written;
+    pthread_mutex_unlock(&job->lock);
+    size_t total = job->S ? job->S->bytes : 0;
+    if (total == 0)
+        return 0;
+    return written >= total ? 99 : written * 100 / total;
+}
+
+// wait for the save to end, then hand the editor its blocks back
+struct saveResult finishSave(struct editor *E, struct saveJob *job) {
+    if (!job->joined) {
+        pthread_join(job->thread, NULL);
+    }
+    if (job->S) {
+        releaseSnapshot(E);
+    }
+    struct saveResult res = job->res;
+    pthread_mutex_destroy(&job->lock);
+    free(job);
+    return res;
+}
+
+// save, waiting for it
+struct saveResult editorSaveFile(struct editor *E, char *filename) {
+    return finishSave(E, startSave(E, filename));
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "editor.h"
+
+struct saveResult {
+    size_t bytes;
+    double seconds;
+    int error;        // errno of the step that failed, 0 on success
+    const char *step; // what failed ("create", "write", "fsync", "rename"...)
+};
+
+struct saveJob;
+
+struct saveJob *startSave(struct editor *E, char *filename);
+bool saveDone(struct saveJob *job);
+int saveProgress(struct saveJob *job);
+struct saveResult finishSave(struct editor *E, struct saveJob *job);
+struct saveResult editorSaveFile(struct editor *E, char *filename);
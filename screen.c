@@ -0,0 +1,347 @@
+#include "screen.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define szstr(str) str, sizeof(str) - 1
+// unchanged cells rewritten rather than jumped over, if at most this many
+#define MAX_REWRITE 4
+// blank tails at least this wide are erased rather than written
+#define MIN_ERASE 4
+// first allocation for the output, doubled from there as needed
+#define ABUF_MIN 4096
+
+/* ======= OUTPUT BUFFER ======= */
+void abAppend(struct abuf *ab, const char *s, int len) {
+    if (ab->size + len > ab->cap) {
+        int cap = ab->cap ? ab->cap : ABUF_MIN;
+        while (cap < ab->size + len) {
+            cap *= 2;
+        }
+        char *new = realloc(ab->buf, cap);
+        if (new == NULL)
+            return; // :(
+        ab->buf = new;
+        ab->cap = cap;
+        ab->allocs++;
+    }
+    memcpy(ab->buf + ab->size, s, len);
+    ab->size += len;
+}
+
+// append n in decimal
+void abAppendNum(struct abuf *ab, int n) {
+    char digits[12];
+    int i = sizeof(digits);
+    unsigned int u = n < 0 ? -(unsigned int)n : (unsigned int)n;
+    do {
+        digits[--i] = '0' + u % 10;
+        u /= 10;
+    } while (u != 0);
+    if (n < 0) {
+        digits[--i] = '-';
+    }
+    abAppend(ab, digits + i, sizeof(digits) - i);
+}
+
+void abFree(struct abuf *ab) {
+    free(ab->buf);
+    ab->buf = NULL;
+    ab->size = ab->cap = 0;
+}
+
+/* ======= CELLS ======= */
+void initScreen(struct screen *s, const char **palette) {
+    memset(s, 0, sizeof(struct screen));
+    s->palette = palette;
+    s->stale = true;
+    s->cur_r = -1;
+    s->cur_c = -1;
+    s->shape = -1;
+}
+
+void freeScreen(struct screen *s) {
+    free(s->front);
+    free(s->back);
+    s->front = s->back = NULL;
+    abFree(&s->out);
+}
+
+// new dimensions, the next flush redraws everything
+void resizeScreen(struct screen *s, int rows, int cols) {
+    rows = rows > 0 ? rows : 1;
+    cols = cols > 0 ? cols : 1;
+    if (rows * cols != s->rows * s->cols) {
+        free(s->front);
+        free(s->back);
+        s->front = calloc(rows * cols, sizeof(struct cell));
+        s->back = calloc(rows * cols, sizeof(struct cell));
+        s->allocs += 2;
+    }
+    s->rows = rows;
+    s->cols = cols;
+    s->stale = true;
+    s->cur_r = -1;
+    s->cur_c = -1;
+    for (int r = 0; r < rows; r++) {
+        clearCells(s, r, 0, cols, 0);
+    }
+}
+
+static struct cell *cellAt(struct screen *s, int r, int c) {
+    return &s->back[r * s->cols + c];
+}
+
+// blank n cells of row r from column c
+void clearCells(struct screen *s, int r, int c, int n, int bg) {
+    if (r < 0 || r >= s->rows || c < 0 || c >= s->cols)
+        return;
+    n = n < s->cols - c ? n : s->cols - c;
+    for (struct cell *p = cellAt(s, r, c); n-- > 0; p++) {
+        memset(p, 0, sizeof(struct cell));
+        p->glyph[0] = ' ';
+        p->bg = bg;
+    }
+}
+
+// bytes in the UTF-8 character starting with lead
+static int charLen(unsigned char lead) {
+    if (lead >= 0xf0)
+        return 4;
+    if (lead >= 0xe0)
+        return 3;
+    if (lead >= 0xc0)
+        return 2;
+    return 1;
+}
+
+/* write the character at the start of text[0, len) into cell (r, c). *
+ * returns the bytes it took up */
+int putCell(struct screen *s, int r, int c, const char *text, int len, int fg,
+            int bg, bool bold) {
+    const unsigned char *t = (const unsigned char *)text;
+    int n = charLen(t[0]);
+    bool valid = n <= len && t[0] >= ' ' && t[0] != 0x7f &&
+                 (t[0] < 0x80 || t[0] >= 0xc0) && t[0] < 0xf8;
+    for (int i = 1; valid && i < n; i++) {
+        valid = (t[i] & 0xc0) == 0x80;
+    }
+    if (!valid) // control bytes and broken UTF-8 would throw the terminal off
+        n = 1;
+    if (r < 0 || r >= s->rows || c < 0 || c >= s->cols)
+        return n;
+    struct cell *p = cellAt(s, r, c);
+    memset(p->glyph, 0, sizeof(p->glyph));
+    if (valid) {
+        memcpy(p->glyph, t, n);
+    } else {
+        p->glyph[0] = '?';
+    }
+    p->fg = fg;
+    p->bg = bg;
+    p->bold = bold;
+    p->wide = false;
+    return n;
+}
+
+/* write text from (r, c) a character per cell, stopping at the end of the *
+ * row. returns the column after the last cell written */
+int putCells(struct screen *s, int r, int c, const char *text, int len,
+             int fg, int bg, bool bold) {
+    for (int i = 0; i < len && c < s->cols; c++) {
+        i += putCell(s, r, c, text + i, len - i, fg, bg, bold);
+    }
+    return c;
+}
+
+/* write a glyph of len bytes, well formed UTF-8 (see layout.h), into cell *
+ * (r, c) and the one after it if it's wide. one too long for a cell is cut *
+ * down to its first character */
+void putGlyph(struct screen *s, int r, int c, const char *text, int len,
+              bool wide, int fg, int bg) {
+    if (r < 0 || r >= s->rows || c < 0 || c + wide >= s->cols)
+        return;
+    struct cell *p = cellAt(s, r, c);
+    if (len > (int)sizeof(p->glyph)) {
+        len = charLen((unsigned char)text[0]);
+    }
+    memset(p, 0, sizeof(struct cell));
+    memcpy(p->glyph, text, len);
+    p->fg = fg;
+    p->bg = bg;
+    p->wide = wide;
+    if (wide) {
+        p[1] = *p;
+        memset(p[1].glyph, 0, sizeof(p->glyph));
+        p[1].wide = false;
+    }
+}
+
+/* ======= FLUSHING ======= */
+static void appendColor(struct screen *s, struct abuf *ab, const char *kind,
+                        int color) {
+    abAppend(ab, kind, strlen(kind));
+    abAppend(ab, s->palette[color], strlen(s->palette[color]));
+}
+
+// switch the terminal to the given attributes, sending only what changed
+static void setPen(struct screen *s, struct abuf *ab, int fg, int bg,
+                   bool bold) {
+    bool known = s->penKnown;
+    if (known && s->pen.fg == fg && s->pen.bg == bg && s->pen.bold == bold)
+        return;
+    abAppend(ab, szstr("\x1b["));
+    char *sep = "";
+    if (!known || s->pen.bold != bold) {
+        abAppend(ab, bold ? "1" : "22", bold ? 1 : 2);
+        sep = ";";
+    }
+    if (!known || s->pen.fg != fg) {
+        abAppend(ab, sep, strlen(sep));
+        appendColor(s, ab, "38;2;", fg);
+        sep = ";";
+    }
+    if (!known || s->pen.bg != bg) {
+        abAppend(ab, sep, strlen(sep));
+        appendColor(s, ab, "48;2;", bg);
+    }
+    abAppend(ab, szstr("m"));
+    s->pen.fg = fg;
+    s->pen.bg = bg;
+    s->pen.bold = bold;
+    s->penKnown = true;
+}
+
+static void writeCell(struct screen *s, struct abuf *ab, struct cell *p) {
+    setPen(s, ab, p->fg, p->bg, p->bold);
+    if (p->glyph[0] == '\0') { // half a wide glyph, the other half's gone
+        abAppend(ab, szstr(" "));
+    } else {
+        abAppend(ab, p->glyph, strnlen(p->glyph, sizeof(p->glyph)));
+    }
+    s->cur_c += p->wide ? 2 : 1;
+    if (s->cur_c >= s->cols) { // the cursor waits to wrap, don't trust it
+        s->cur_r = -1;
+        s->cur_c = -1;
+    }
+}
+
+// move the terminal's cursor to (r, c) in as few bytes as we can
+static void moveTo(struct screen *s, struct abuf *ab, int r, int c) {
+    if (s->cur_r == r && s->cur_c == c)
+        return;
+    if (s->cur_r == r && s->cur_c >= 0 && s->cur_c < c) {
+        int gap = c - s->cur_c;
+        bool rewrite = gap <= MAX_REWRITE;
+        for (int i = s->cur_c; rewrite && i < c; i++) {
+            struct cell *p = cellAt(s, r, i);
+            rewrite = s->penKnown && p->fg == s->pen.fg &&
+                      p->bg == s->pen.bg && p->bold == s->pen.bold &&
+                      !p->wide && p->glyph[0] != '\0';
+        }
+        if (rewrite) { // the cells are unchanged, sending them costs no more
+            while (s->cur_c < c) {
+                writeCell(s, ab, cellAt(s, r, s->cur_c));
+            }
+            return;
+        }
+        abAppend(ab, szstr("\x1b["));
+        if (gap > 1) {
+            abAppendNum(ab, gap);
+        }
+        abAppend(ab, szstr("C"));
+    } else if (s->cur_r == r && c == 0) {
+        abAppend(ab, szstr("\r"));
+    } else if (s->cur_r >= 0 && s->cur_r + 1 == r && c == 0) {
+        abAppend(ab, szstr("\r\n"));
+    } else {
+        abAppend(ab, szstr("\x1b["));
+        abAppendNum(ab, r + 1);
+        if (c > 0) {
+            abAppend(ab, szstr(";"));
+            abAppendNum(ab, c + 1);
+        }
+        abAppend(ab, szstr("H"));
+    }
+    s->cur_r = r;
+    s->cur_c = c;
+}
+
+static bool sameCell(struct cell *a, struct cell *b) {
+    return memcmp(a, b, sizeof(struct cell)) == 0;
+}
+
+// send the row's changed cells
+static void flushRow(struct screen *s, struct abuf *ab, int r) {
+    struct cell *front = &s->front[r * s->cols];
+    struct cell *back = &s->back[r * s->cols];
+    if (!s->stale && memcmp(front, back, s->cols * sizeof(struct cell)) == 0)
+        return;
+
+    // blanks on one background to the end of the row can just be erased
+    int tail = s->cols;
+    int bg = back[s->cols - 1].bg;
+    while (tail > 0 && back[tail - 1].bg == bg &&
+           memcmp(back[tail - 1].glyph, " \0\0", 4) == 0) {
+        tail--;
+    }
+
+    for (int c = 0; c < s->cols; c++) {
+        if (!s->stale && sameCell(&front[c], &back[c]))
+            continue;
+        moveTo(s, ab, r, c);
+        if (c >= tail && s->cols - c >= MIN_ERASE) {
+            setPen(s, ab, s->penKnown ? s->pen.fg : back[c].fg, bg,
+                   s->penKnown ? s->pen.bold : back[c].bold);
+            abAppend(ab, szstr("\x1b[K"));
+            return;
+        }
+        writeCell(s, ab, &back[c]);
+        if (back[c].wide) { // its other half went with it
+            c++;
+        }
+    }
+}
+
+/* send the difference between the frame drawn and what's on the terminal, *
+ * then leave the cursor at (r, c) with the given shape */
+void flushScreen(struct screen *s, int r, int c, int shape) {
+    struct abuf *ab = &s->out;
+    long allocs = ab->allocs;
+    ab->size = 0; // reused, frame to frame
+    abAppend(ab, szstr("\x1b[?25l")); // hide cursor
+    int start = ab->size;
+    for (int row = 0; row < s->rows; row++) {
+        flushRow(s, ab, row);
+    }
+    bool drawn = ab->size > start;
+
+    if (shape != s->shape) {
+        abAppend(ab, szstr("\x1b["));
+        abAppendNum(ab, shape);
+        abAppend(ab, szstr(" q"));
+        s->shape = shape;
+    }
+    moveTo(s, ab, r, c);
+    if (drawn) {
+        abAppend(ab, szstr("\x1b[?25h")); // show cursor
+    }
+    // nothing was drawn, so no need to hide the cursor either
+    int skip = drawn ? 0 : start;
+    // a signal can cut a write short, the rest still has to go out
+    for (int off = skip; off < ab->size;) {
+        ssize_t n = write(STDIN_FILENO, ab->buf + off, ab->size - off);
+        if (n == -1 && errno != EINTR)
+            break; // the terminal is gone
+        off += n > 0 ? n : 0;
+    }
+    s->allocs += ab->allocs - allocs;
+    s->frames++;
+
+    struct cell *front = s->front;
+    s->front = s->back;
+    s->back = front;
+    s->stale = false;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stdbool.h>
+
+/* output for the terminal. it keeps its memory between frames and only *
+ * grows (doubling) when a frame doesn't fit, so steady state never allocates */
+struct abuf {
+    char *buf;
+    int size;
+    int cap;
+    long allocs; // times buf had to be (re)allocated
+};
+
+/* one character cell of the terminal. a wide glyph takes the cell after *
+ * it as well, which is left with an empty glyph */
+struct cell {
+    char glyph[12]; // UTF-8, NUL padded when shorter
+    unsigned char fg; // colors, as indexes into the screen's palette
+    unsigned char bg;
+    unsigned char bold;
+    unsigned char wide;
+};
+
+/* the terminal as a grid of cells. a frame is drawn into back, then *
+ * flushScreen sends only the cells that differ from front (what the *
+ * terminal shows), and the two are swapped */
+struct screen {
+    int rows;
+    int cols;
+    struct cell *front;
+    struct cell *back;
+    const char **palette; // color index -> "r;g;b"
+    bool stale; // front can't be trusted, redraw every cell
+
+    // what the terminal was last told, -1 when unknown
+    int cur_r;
+    int cur_c;
+    struct cell pen; // attributes of the next cell written
+    bool penKnown;
+    int shape; // cursor shape, see DECSCUSR
+
+    struct abuf out; // the frame being sent
+    long frames; // flushes so far
+    /* allocations the screen made itself, grids and output. not the rest *
+     * of a refresh: the bench's allocs_per_op for the replayed scripts *
+     * counts those, process-wide */
+    long allocs;
+};
+
+void abAppend(struct abuf *ab, const char *s, int len);
+void abAppendNum(struct abuf *ab, int n);
+void abFree(struct abuf *ab);
+
+void initScreen(struct screen *s, const char **palette);
+void freeScreen(struct screen *s);
+void resizeScreen(struct screen *s, int rows, int cols);
+
+void clearCells(struct screen *s, int r, int c, int n, int bg);
+int putCell(struct screen *s, int r, int c, const char *text, int len, int fg,
+            int bg, bool bold);
+int putCells(struct screen *s, int r, int c, const char *text, int len,
+             int fg, int bg, bool bold);
+void putGlyph(struct screen *s, int r, int c, const char *text, int len,
+              bool wide, int fg, int bg);
+void flushScreen(struct screen *s, int r, int c, int shape);
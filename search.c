@@ -0,0 +1,332 @@
+#include "search.h"
+#include "pool.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* ======= NEEDLES ======= */
+struct needle *compileNeedle(char *text, int len, bool icase) {
+    struct needle *n = malloc(sizeof(struct needle));
+    n->len = len;
+    n->icase = icase;
+    n->re = NULL;
+    for (int c = 0; c < 256; c++) {
+        n->fold[c] = icase ? tolower(c) : c;
+    }
+    n->text = malloc(len);
+    for (int i = 0; i < len; i++) {
+        n->text[i] = n->fold[(unsigned char)text[i]];
+    }
+
+    // the shifts are worked out on folded bytes, then spread to every byte
+    int skip[256];
+    for (int c = 0; c < 256; c++) {
+        skip[c] = len;
+    }
+    for (int i = 0; i < len - 1; i++) {
+        skip[n->text[i]] = len - 1 - i;
+    }
+    for (int c = 0; c < 256; c++) {
+        n->skip[c] = skip[n->fold[c]];
+    }
+    return n;
+}
+
+// a regex needle, NULL with *error set if the pattern is malformed
+struct needle *regexNeedle(char *pattern, int len, bool icase,
+                           const char **error) {
+    struct regex *re = compileRegex(pattern, len, icase, error);
+    if (re == NULL)
+        return NULL;
+    struct needle *n = calloc(1, sizeof(struct needle));
+    n->text = malloc(len);
+    memcpy(n->text, pattern, len);
+    n->len = len;
+    n->icase = icase;
+    n->re = re;
+    pthread_mutex_init(&n->lock, NULL);
+    return n;
+}
+
+void freeNeedle(struct needle *n) {
+    if (n == NULL)
+        return;
+    if (n->re) {
+        for (int i = 0; i < n->numspares; i++) {
+            freeMatcher(n->spares[i]);
+        }
+        free(n->spares);
+        pthread_mutex_destroy(&n->lock);
+    }
+    freeRegex(n->re);
+    free(n->text);
+    free(n);
+}
+
+// a matcher for a regex needle, a spare one if there is
+static struct matcher *takeMatcher(struct needle *n) {
+    if (n->re == NULL)
+        return NULL;
+    pthread_mutex_lock(&n->lock);
+    struct matcher *mt = n->numspares ? n->spares[--n->numspares] : NULL;
+    pthread_mutex_unlock(&n->lock);
+    return mt ? mt : newMatcher(n->re);
+}
+
+// done with it, keep it for the next scan
+static void returnMatcher(struct needle *n, struct matcher *mt) {
+    if (mt == NULL)
+        return;
+    pthread_mutex_lock(&n->lock);
+    if (n->numspares == n->capspares) {
+        n->capspares = n->capspares ? n->capspares * 2 : 4;
+        n->spares =
+            realloc(n->spares, n->capspares * sizeof(struct matcher *));
+    }
+    n->spares[n->numspares++] = mt;
+    pthread_mutex_unlock(&n->lock);
+}
+
+// does the needle match at p (which has at least n->len bytes)
+static bool matchAt(struct needle *n, unsigned char *p) {
+    if (!n->icase)
+        return memcmp(p, n->text, n->len) == 0;
+    for (int i = 0; i < n->len; i++) {
+        if (n->fold[p[i]] != n->text[i])
+            return false;
+    }
+    return true;
+}
+
+// first match in text[0, len) starting at or after from, -1 if none
+int findForward(struct needle *n, char *text, int len, int from) {
+    unsigned char *t = (unsigned char *)text;
+    int m = n->len;
+    if (from < 0 || len - from < m)
+        return -1;
+
+    if (m < SHORT_NEEDLE) { // memchr for the first byte, in either case
+        unsigned char lo = n->text[0];
+        unsigned char hi = n->icase ? toupper(lo) : lo;
+        unsigned char *end = t + len - m + 1; // last possible start + 1
+        unsigned char *p = t + from;
+        unsigned char *pl = memchr(p, lo, end - p);
+        unsigned char *ph = hi == lo ? NULL : memchr(p, hi, end - p);
+        while (pl || ph) {
+            p = (ph == NULL || (pl && pl < ph)) ? pl : ph;
+            if (matchAt(n, p))
+                return p - t;
+            if (p == pl) {
+                pl = memchr(p + 1, lo, end - p - 1);
+            } else {
+                ph = memchr(p + 1, hi, end - p - 1);
+            }
+        }
+        return -1;
+    }
+
+    int last = m - 1;
+    for (int pos = from; pos <= len - m; pos += n->skip[t[pos + last]]) {
+        if (n->fold[t[pos + last]] == n->text[last] && matchAt(n, t + pos))
+            return pos;
+    }
+    return -1;
+}
+
+/* first match in a row at or after from, either kind of needle. for a *
+ * regex, mt has to have been given the row (regexRow) */
+static int findMatch(struct needle *n, struct matcher *mt, char *text,
+                     int len, int from, int *mlen) {
+    if (n->re)
+        return regexNext(mt, from, mlen);
+    *mlen = n->len;
+    return findForward(n, text, len, from);
+}
+
+/* ======= MATCH INDEX ======= */
+static void addMatch(struct matchIndex *m, int r, int c, int len) {
+    if (m->nummatches == m->capmatches) {
+        m->capmatches = m->capmatches ? m->capmatches * 2 : 64;
+        m->matches =
+            realloc(m->matches, m->capmatches * sizeof(struct match));
+    }
+    struct match *mt = &m->matches[m->nummatches++];
+    mt->at.r = r;
+    mt->at.c = c;
+    mt->len = len;
+}
+
+/* one stretch of rows for a scan job: rows [from, to), starting at row idx *
+ * of block b. blocks are peeked rather than paged in, a search shouldn't *
+ * pull in the whole file, and peeking leaves the tree alone so any number *
+ * of jobs can read it at once */
+struct scanRange {
+    struct rowblock *b;
+    int idx;
+    int from;
+    int to;
+    struct matchIndex found; // only the matches are filled in
+};
+
+struct scanJob {
+    struct needle *n;
+    struct scanRange *ranges;
+};
+
+static void scanRange(void *arg, int i) {
+    struct scanJob *job = arg;
+    struct scanRange *rg = &job->ranges[i];
+    struct erow scratch[ROWBLOCK_MAX];
+    struct matcher *mt = takeMatcher(job->n);
+    struct rowblock *b = rg->b;
+    int idx = rg->idx;
+    for (int r = rg->from; b && r < rg->to; b = nextBlock(b), idx = 0) {
+        struct erow *rows = peekBlock(b, scratch);
+        for (; idx < b->numrows && r < rg->to; idx++, r++) {
+            struct erow *row = &rows[idx];
+            if (mt) {
+                regexRow(mt, row->text, row->len);
+            }
+            int c = 0;
+            int len;
+            while ((c = findMatch(job->n, mt, row->text, row->len, c,
+                                  &len)) != -1) {
+                addMatch(&rg->found, r, c, len);
+                c += max(len, 1); // matches don't overlap
+            }
+        }
+    }
+    returnMatcher(job->n, mt);
+}
+
+/* append every match in rows [from, to) to m. the rows are split into *
+ * runs of whole blocks, scanned in parallel and then put back in order */
+static void scanRows(struct editor *E, struct needle *n, int from, int to,
+                     struct matchIndex *m) {
+    if (from >= to)
+        return;
+    struct scanRange *ranges = NULL;
+    int numranges = 0;
+    int capranges = 0;
+    int idx = from;
+    struct rowblock *b = findBlock(E->root, &idx);
+    for (int r = from; b && r < to;) {
+        if (numranges == capranges) {
+            capranges = capranges ? capranges * 2 : 16;
+            ranges = realloc(ranges, capranges * sizeof(struct scanRange));
+        }
+        struct scanRange *rg = &ranges[numranges++];
+        memset(rg, 0, sizeof(struct scanRange));
+        rg->b = b;
+        rg->idx = idx;
+        rg->from = r;
+        while (b && r < to && r - rg->from < SCAN_ROWS) {
+            r += b->numrows - idx;
+            b = nextBlock(b);
+            idx = 0;
+        }
+        rg->to = min(r, to);
+    }
+
+    struct scanJob job = {n, ranges};
+    poolRun(scanRange, &job, numranges);
+
+    int total = m->nummatches;
+    for (int i = 0; i < numranges; i++) {
+        total += ranges[i].found.nummatches;
+    }
+    if (total > m->capmatches) {
+        m->capmatches = total;
+        m->matches = realloc(m->matches, m->capmatches * sizeof(struct match));
+    }
+    for (int i = 0; i < numranges; i++) {
+        struct matchIndex *f = &ranges[i].found;
+        if (f->nummatches > 0) {
+            memcpy(m->matches + m->nummatches, f->matches,
+                   f->nummatches * sizeof(struct match));
+            m->nummatches += f->nummatches;
+            free(f->matches);
+        }
+    }
+    free(ranges);
+}
+
+// every match of n in E, kept up to date as E is edited. takes n over
+struct matchIndex *indexMatches(struct editor *E, struct needle *n) {
+    struct matchIndex *m = calloc(1, sizeof(struct matchIndex));
+    m->E = E;
+    m->n = n;
+    scanRows(E, n, 0, E->numrows, m);
+    addListener(E, matchesEdited, m);
+    return m;
+}
+
+void freeMatches(struct matchIndex *m) {
+    if (m == NULL)
+        return;
+    removeListener(m->E, matchesEdited, m);
+    freeNeedle(m->n);
+    free(m->matches);
+    free(m);
+}
+
+// index of the first match at or after p
+int lowerMatch(struct matchIndex *m, point p) {
+    int lo = 0;
+    int hi = m->nummatches;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (pointLess(m->matches[mid].at, p)) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/* index of the first match after p (or the last before it, backward), *
+ * wrapping around the ends of the buffer. -1 if there are none */
+int nextMatch(struct matchIndex *m, point p, bool backward) {
+    if (m->nummatches == 0)
+        return -1;
+    if (backward) {
+        int i = lowerMatch(m, p) - 1;
+        return i >= 0 ? i : m->nummatches - 1;
+    }
+    p.c++;
+    int i = lowerMatch(m, p);
+    return i < m->nummatches ? i : 0;
+}
+
+// edit listener: drop the matches in the replaced rows, rescan the new ones
+void matchesEdited(void *arg, int row, int oldrows, int newrows) {
+    struct matchIndex *m = arg;
+    int lo = lowerMatch(m, (point){row, 0});
+    int hi = lowerMatch(m, (point){row + oldrows, 0});
+
+    struct matchIndex fresh = {0};
+    scanRows(m->E, m->n, row, row + newrows, &fresh);
+
+    int tail = m->nummatches - hi;
+    int total = lo + fresh.nummatches + tail;
+    if (total > m->capmatches) {
+        m->capmatches = max(total, m->capmatches * 2);
+        m->matches = realloc(m->matches, m->capmatches * sizeof(struct match));
+    }
+    m->nummatches = total;
+    if (tail > 0) {
+        struct match *moved = m->matches + lo + fresh.nummatches;
+        memmove(moved, m->matches + hi, tail * sizeof(struct match));
+        int shift = newrows - oldrows;
+        for (int i = 0; shift && i < tail; i++) {
+            moved[i].at.r += shift;
+        }
+    }
+    if (fresh.nummatches > 0) {
+        memcpy(m->matches + lo, fresh.matches,
+               fresh.nummatches * sizeof(struct match));
+        free(fresh.matches);
+    }
+}
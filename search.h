@@ -0,0 +1,58 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+
+#include "editor.h"
+#include "regex.h"
+
+// needles shorter than this are found by memchr on their first byte
+#define SHORT_NEEDLE 4
+// rows searched by one job, see scanRows
+#define SCAN_ROWS (16 * ROWBLOCK_MAX)
+
+/* a search pattern, preprocessed once and then run over any number of *
+ * rows. longer needles use Boyer-Moore-Horspool, regexes their own engine */
+struct needle {
+    unsigned char *text; // folded to lower case when icase, unless a regex
+    int len;
+    bool icase;
+    struct regex *re; // NULL for a plain string
+    unsigned char fold[256]; // byte -> byte compared against text
+    int skip[256]; // shift, by the byte under the needle's end
+    /* matchers for re left over from earlier scans, their DFAs already *
+     * built, for the next to take up. a scan has one to itself */
+    struct matcher **spares;
+    int numspares;
+    int capspares;
+    pthread_mutex_t lock; // for the spares
+};
+
+struct needle *compileNeedle(char *text, int len, bool icase);
+struct needle *regexNeedle(char *pattern, int len, bool icase,
+                           const char **error);
+void freeNeedle(struct needle *n);
+
+int findForward(struct needle *n, char *text, int len, int from);
+
+/* every match of a needle in a buffer, in order. edits to the buffer *
+ * rescan only the rows they touched (see matchesEdited) */
+struct match {
+    point at;
+    int len;
+};
+
+struct matchIndex {
+    struct editor *E;
+    struct needle *n;
+    struct match *matches;
+    int nummatches;
+    int capmatches;
+};
+
+struct matchIndex *indexMatches(struct editor *E, struct needle *n);
+void freeMatches(struct matchIndex *m);
+void matchesEdited(void *arg, int row, int oldrows, int newrows);
+
+int lowerMatch(struct matchIndex *m, point p);
+int nextMatch(struct matchIndex *m, point p, bool backward);
@@ -0,0 +1,302 @@
+#include "syntax.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+// lexer states, one per row end
+enum { SYN_CODE, SYN_COMMENT, SYN_UNKNOWN = 0xff };
+
+/* ======= LANGUAGES ======= */
+static char *cExtensions[] = {".c",  ".h",  ".cc", ".cpp", ".cxx",
+                              ".hpp", ".hh", ".hxx", NULL};
+static char *cKeywords[] = {
+    "auto",      "break",    "case",     "catch",    "class",     "const",
+    "continue",  "default",  "delete",   "do",       "else",      "enum",
+    "extern",    "false",    "for",      "goto",     "if",        "inline",
+    "namespace", "new",      "nullptr",  "NULL",     "operator",  "private",
+    "protected", "public",   "register", "restrict", "return",    "sizeof",
+    "static",    "struct",   "switch",   "template", "this",      "throw",
+    "true",      "try",      "typedef",  "typename", "union",     "using",
+    "virtual",   "volatile", "while",    NULL};
+static char *cTypes[] = {
+    "bool",     "char",     "double",   "float",    "int",       "long",
+    "short",    "signed",   "unsigned", "void",     "size_t",    "ssize_t",
+    "off_t",    "int8_t",   "int16_t",  "int32_t",  "int64_t",   "uint8_t",
+    "uint16_t", "uint32_t", "uint64_t", "intptr_t", "uintptr_t", "FILE",
+    NULL};
+
+static struct syntax languages[] = {
+    {"c", cExtensions, cKeywords, cTypes, "//", "/*", "*/", true},
+};
+
+static struct syntax *syntaxFor(char *filename) {
+    char *ext = strrchr(filename, '.');
+    if (ext == NULL)
+        return NULL;
+    for (size_t i = 0; i < sizeof(languages) / sizeof(languages[0]); i++) {
+        for (char **e = languages[i].extensions; *e; e++) {
+            if (!strcmp(ext, *e))
+                return &languages[i];
+        }
+    }
+    return NULL;
+}
+
+/* ======= LEXER ======= */
+static void addSpan(struct spanCache *out, int start, int len,
+                    enum hlType type) {
+    if (out == NULL || len <= 0)
+        return;
+    if (out->numspans == out->capspans) {
+        out->capspans = out->capspans ? out->capspans * 2 : 16;
+        out->spans =
+            realloc(out->spans, out->capspans * sizeof(struct hlSpan));
+    }
+    out->spans[out->numspans++] = (struct hlSpan){start, len, type};
+}
+
+static bool startsWith(char *text, int len, char *s) {
+    int n = strlen(s);
+    return n > 0 && n <= len && !memcmp(text, s, n);
+}
+
+// index just past the first s in text[from, len), -1 if there isn't one
+static int findEnd(char *text, int len, int from, char *s) {
+    int n = strlen(s);
+    for (int i = from; i + n <= len; i++) {
+        if (!memcmp(text + i, s, n))
+            return i + n;
+    }
+    return -1;
+}
+
+static bool isWord(char c) { return isalnum((unsigned char)c) || c == '_'; }
+
+static bool inList(char **list, char *word, int len) {
+    for (; *list; list++) {
+        if (!strncmp(*list, word, len) && (*list)[len] == '\0')
+            return true;
+    }
+    return false;
+}
+
+/* lex row from state, adding its spans to out (if not NULL, it's left *
+ * out when only the state is wanted). returns the state at its end */
+static unsigned char lexRow(struct highlighter *h, struct erow *row,
+                            unsigned char state, struct spanCache *out) {
+    struct syntax *syn = h->syn;
+    char *t = row->text;
+    int len = row->len;
+    int i = 0;
+    h->lexed++;
+
+    if (state == SYN_COMMENT) {
+        i = findEnd(t, len, 0, syn->blockEnd);
+        if (i < 0) {
+            addSpan(out, 0, len, HL_COMMENT);
+            return SYN_COMMENT;
+        }
+        addSpan(out, 0, i, HL_COMMENT);
+    } else if (syn->preproc) {
+        while (i < len && isspace((unsigned char)t[i])) {
+            i++;
+        }
+        if (i < len && t[i] == '#') { // just the directive, #include and all
+            int start = i++;
+            while (i < len && isspace((unsigned char)t[i])) {
+                i++;
+            }
+            while (i < len && isWord(t[i])) {
+                i++;
+            }
+            addSpan(out, start, i - start, HL_PREPROC);
+        }
+    }
+
+    while (i < len) {
+        char c = t[i];
+        if (startsWith(t + i, len - i, syn->lineComment)) {
+            addSpan(out, i, len - i, HL_COMMENT);
+            return SYN_CODE;
+        }
+        if (startsWith(t + i, len - i, syn->blockStart)) {
+            int end = findEnd(t, len, i + strlen(syn->blockStart),
+                              syn->blockEnd);
+            if (end < 0) {
+                addSpan(out, i, len - i, HL_COMMENT);
+                return SYN_COMMENT;
+            }
+            addSpan(out, i, end - i, HL_COMMENT);
+            i = end;
+        } else if (c == '"' || c == '\'') { // strings end with the row
+            int j = i + 1;
+            while (j < len && t[j] != c) {
+                j += t[j] == '\\' ? 2 : 1;
+            }
+            j = j < len ? j + 1 : len;
+            addSpan(out, i, j - i, HL_STRING);
+            i = j;
+        } else if (isdigit((unsigned char)c) ||
+                   (c == '.' && i + 1 < len &&
+                    isdigit((unsigned char)t[i + 1]))) {
+            int j = i + 1; // 0x1f, 1.5e3, 10ul and the like
+            while (j < len && (isWord(t[j]) || t[j] == '.')) {
+                j++;
+            }
+            addSpan(out, i, j - i, HL_NUMBER);
+            i = j;
+        } else if (isWord(c)) {
+            int j = i + 1;
+            while (j < len && isWord(t[j])) {
+                j++;
+            }
+            if (out && inList(syn->keywords, t + i, j - i)) {
+                addSpan(out, i, j - i, HL_KEYWORD);
+            } else if (out && inList(syn->types, t + i, j - i)) {
+                addSpan(out, i, j - i, HL_TYPE);
+            }
+            i = j;
+        } else {
+            i++;
+        }
+    }
+    return SYN_CODE;
+}
+
+/* ======= ROW STATES ======= */
+// make room for rows the loader has added since, their states unknown
+static void growStates(struct highlighter *h, int numrows) {
+    if (numrows <= h->numstates)
+        return;
+    if (numrows > h->capstates) {
+        h->capstates = max(numrows, h->capstates * 2);
+        h->states = realloc(h->states, h->capstates);
+    }
+    memset(h->states + h->numstates, SYN_UNKNOWN, numrows - h->numstates);
+    h->numstates = numrows;
+}
+
+/* lex from firstDirty until every row before to has its state right. *
+ * once a row ends in the state it had, the rows after it are right up to *
+ * the next one an edit left unknown. stopping at to before that, the row *
+ * after is left unknown too, as it was lexed from a state that's changed */
+static void catchUp(struct highlighter *h, int to) {
+    int r = h->firstDirty;
+    if (r >= to)
+        return;
+    unsigned char state = r == 0 ? SYN_CODE : h->states[r - 1];
+    struct rowWalk w;
+    walkTo(&w, h->E, r);
+    bool settled = false;
+    while (r < to) {
+        unsigned char end = lexRow(h, walkNext(&w), state, NULL);
+        settled = h->states[r] == end;
+        h->states[r++] = end;
+        state = end;
+        if (settled && r < to) {
+            unsigned char *next = memchr(h->states + r, SYN_UNKNOWN, to - r);
+            if (next == NULL) {
+                r = to;
+                break;
+            }
+            r = next - h->states;
+            state = h->states[r - 1];
+            walkTo(&w, h->E, r);
+        }
+    }
+    if (!settled && to < h->numstates) {
+        h->states[to] = SYN_UNKNOWN;
+    }
+    h->firstDirty = r;
+}
+
+// the lexer's state at the start of row
+static unsigned char startState(struct highlighter *h, int row) {
+    if (row - h->firstDirty <= SYNTAX_CATCHUP) {
+        catchUp(h, row);
+        return row == 0 ? SYN_CODE : h->states[row - 1];
+    }
+    /* too far ahead to catch up with in one go, lex a little way up to it *
+     * and hope that's enough. rows drawn one after another carry on from *
+     * the last guess */
+    int from = h->guessRow;
+    unsigned char state = h->guessState;
+    if (from < 0 || from > row || row - from > SYNTAX_SYNC) {
+        from = row - SYNTAX_SYNC;
+        state = SYN_CODE;
+    }
+    struct rowWalk w;
+    walkTo(&w, h->E, from);
+    for (int r = from; r < row; r++) {
+        state = lexRow(h, walkNext(&w), state, NULL);
+    }
+    h->guessRow = row;
+    h->guessState = state;
+    return state;
+}
+
+/* ======= HIGHLIGHTER ======= */
+/* highlighting for E, kept up to date as it's edited. NULL if there's *
+ * no syntax for the file */
+struct highlighter *openHighlighter(struct editor *E, char *filename) {
+    struct syntax *syn = syntaxFor(filename);
+    if (syn == NULL)
+        return NULL;
+    struct highlighter *h = calloc(1, sizeof(struct highlighter));
+    h->E = E;
+    h->syn = syn;
+    h->guessRow = -1;
+    for (int i = 0; i < SPAN_CACHE; i++) {
+        h->cache[i].row = -1;
+    }
+    growStates(h, E->numrows);
+    addListener(E, syntaxEdited, h);
+    return h;
+}
+
+void closeHighlighter(struct highlighter *h) {
+    if (h == NULL)
+        return;
+    removeListener(h->E, syntaxEdited, h);
+    for (int i = 0; i < SPAN_CACHE; i++) {
+        free(h->cache[i].spans);
+    }
+    free(h->states);
+    free(h);
+}
+
+// the spans of row, good until the next call
+struct hlSpan *rowSpans(struct highlighter *h, int row, int *numspans) {
+    growStates(h, h->E->numrows);
+    unsigned char start = startState(h, row);
+    struct spanCache *c = &h->cache[row % SPAN_CACHE];
+    if (c->row != row || c->start != start) {
+        c->numspans = 0;
+        lexRow(h, getRow(h->E, row), start, c);
+        c->row = row;
+        c->start = start;
+    }
+    *numspans = c->numspans;
+    return c->spans;
+}
+
+// edit listener: the new rows' states are unknown, the rest move with them
+void syntaxEdited(void *arg, int row, int oldrows, int newrows) {
+    struct highlighter *h = arg;
+    int shift = newrows - oldrows;
+    growStates(h, h->E->numrows - shift);
+    int tail = h->numstates - row - oldrows;
+    growStates(h, h->numstates + shift);
+    memmove(h->states + row + newrows, h->states + row + oldrows, tail);
+    memset(h->states + row, SYN_UNKNOWN, newrows);
+    h->numstates = h->E->numrows;
+    h->firstDirty = min(h->firstDirty, row);
+    h->guessRow = -1;
+    for (int i = 0; i < SPAN_CACHE; i++) {
+        struct spanCache *c = &h->cache[i];
+        if (c->row >= row && (shift != 0 || c->row < row + newrows)) {
+            c->row = -1;
+        }
+    }
+}
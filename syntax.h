@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "editor.h"
+
+// rows whose spans are kept, by row number modulo this
+#define SPAN_CACHE 256
+// most rows lexed to catch up with a row asked for, past that it's guessed
+#define SYNTAX_CATCHUP (256 * 1024)
+// rows lexed before a guessed row, starting from the state of plain code
+#define SYNTAX_SYNC 1000
+
+// what a run of text is, each drawn in its own color (display.h)
+enum hlType {
+    HL_NORMAL,
+    HL_COMMENT,
+    HL_KEYWORD,
+    HL_TYPE,
+    HL_STRING,
+    HL_NUMBER,
+    HL_PREPROC
+};
+
+// a language, picked by the file's extension
+struct syntax {
+    char *name;
+    char **extensions;
+    char **keywords;
+    char **types;
+    char *lineComment;
+    char *blockStart;
+    char *blockEnd;
+    bool preproc; // lines starting with # are directives
+};
+
+// a run of characters of one type, anything not in a span is HL_NORMAL
+struct hlSpan {
+    int start;
+    int len;
+    enum hlType type;
+};
+
+// the spans of a row, as lexed from the state at its start
+struct spanCache {
+    int row; // -1 if empty
+    unsigned char start;
+    struct hlSpan *spans;
+    int numspans;
+    int capspans;
+};
+
+/* highlighting for a buffer. the lexer's state at the end of each row is *
+ * kept, so a row can be lexed on its own once the rows before it have *
+ * been. an edit forgets the states of the rows it replaced, and lexing *
+ * picks up from there until a row ends in the state it used to, after *
+ * which the rest are as they were. only rows that get drawn are turned *
+ * into spans */
+struct highlighter {
+    struct editor *E;
+    struct syntax *syn;
+    unsigned char *states; // per row, SYN_UNKNOWN until lexed
+    int numstates;
+    int capstates;
+    int firstDirty; // rows before this have their states right
+    int guessRow; // the last row guessed past SYNTAX_CATCHUP, -1 if none
+    unsigned char guessState; // the state it started in
+    struct spanCache cache[SPAN_CACHE];
+    long lexed; // rows run through the lexer, for :stats
+};
+
+struct highlighter *openHighlighter(struct editor *E, char *filename);
+void closeHighlighter(struct highlighter *h);
+struct hlSpan *rowSpans(struct highlighter *h, int row, int *numspans);
+void syntaxEdited(void *arg, int row, int oldrows, int newrows);
@@ -0,0 +1,530 @@
+#include "undo.h"
+#include "journal.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RECORD_ALIGN _Alignof(struct undoRecord)
+
+/* ======= TREE ======= */
+// where parent (NULL for base) keeps its newest branch
+static struct undoRecord **childLink(struct undoLog *log,
+                                     struct undoRecord *parent) {
+    return parent ? &parent->child : &log->child;
+}
+
+// where parent (NULL for base) keeps the branch redo goes to
+static struct undoRecord **redoLink(struct undoLog *log,
+                                    struct undoRecord *parent) {
+    return parent ? &parent->redo : &log->redo;
+}
+
+/* the record after rec in a walk of the subtree under top (NULL for the *
+ * whole tree), parents before children */
+static struct undoRecord *nextRecord(struct undoRecord *rec,
+                                     struct undoRecord *top) {
+    if (rec->child)
+        return rec->child;
+    for (; rec != top; rec = rec->parent) {
+        if (rec->sibling)
+            return rec->sibling;
+    }
+    return NULL;
+}
+
+static struct undoRecord *commonAncestor(struct undoRecord *a,
+                                         struct undoRecord *b) {
+    int da = 0, db = 0;
+    for (struct undoRecord *r = a; r; r = r->parent) {
+        da++;
+    }
+    for (struct undoRecord *r = b; r; r = r->parent) {
+        db++;
+    }
+    for (; da > db; da--) {
+        a = a->parent;
+    }
+    for (; db > da; db--) {
+        b = b->parent;
+    }
+    while (a != b) {
+        a = a->parent;
+        b = b->parent;
+    }
+    return a;
+}
+
+/* ======= ARENA ======= */
+static size_t roundUp(size_t n) {
+    return (n + RECORD_ALIGN - 1) / RECORD_ALIGN * RECORD_ALIGN;
+}
+
+// the bytes rec takes up in its chunk
+static size_t recordSize(struct undoRecord *rec) {
+    return roundUp(sizeof(struct undoRecord) + rec->len);
+}
+
+/* size bytes on top of the arena. a new chunk, if one is needed, gets *
+ * room for at least want bytes */
+static void *arenaAlloc(struct undoLog *log, size_t size, size_t want) {
+    struct undoChunk *c = log->chunk;
+    size = roundUp(size);
+    if (c == NULL || c->cap - c->used < size) {
+        size_t cap = roundUp(size > want ? size : want);
+        cap = cap > UNDO_CHUNK ? cap : UNDO_CHUNK;
+        struct undoChunk *fresh = malloc(sizeof(struct undoChunk) + cap);
+        fresh->prev = c;
+        fresh->used = 0;
+        fresh->cap = cap;
+        log->chunk = c = fresh;
+        log->bytes += cap;
+    }
+    void *p = c->data + c->used;
+    c->used += size;
+    return p;
+}
+
+/* make room for extra more bytes of text in the newest record, which is *
+ * always the last thing in the newest chunk */
+static struct undoRecord *growNewest(struct undoLog *log, int extra) {
+    struct undoRecord *rec = log->newest;
+    struct undoChunk *c = log->chunk;
+    size_t start = (char *)rec - c->data;
+    size_t size = sizeof(struct undoRecord) + rec->len + extra;
+    log->live += roundUp(size) - recordSize(rec);
+    if (start + roundUp(size) <= c->cap) {
+        c->used = start + roundUp(size);
+        return rec;
+    }
+    // move it to a chunk of its own, with room to keep growing
+    struct undoRecord *to = arenaAlloc(log, size, 2 * size);
+    memcpy(to, rec, sizeof(struct undoRecord) + rec->len);
+    c->used = start;
+    if (start == 0) { // the old chunk held nothing else
+        log->chunk->prev = c->prev;
+        log->bytes -= c->cap;
+        free(c);
+    }
+    // the newest record has no children and no newer siblings
+    *childLink(log, to->parent) = to;
+    if (*redoLink(log, to->parent) == rec) {
+        *redoLink(log, to->parent) = to;
+    }
+    if (log->cur == rec) {
+        log->cur = to;
+    }
+    log->newest = to;
+    return to;
+}
+
+/* ======= BUDGET ======= */
+/* where a mark (see undoLog.saved) stands once rec leaves the history, *
+ * folded into base or dropped */
+static long remark(long mark, struct undoRecord *rec, bool folded) {
+    if (folded)
+        return mark == 0 ? -1 : mark == rec->seq ? 0 : mark;
+    return mark == rec->seq ? -1 : mark;
+}
+
+static void unmark(struct undoLog *log, struct undoRecord *rec,
+                   bool folded) {
+    log->saved = remark(log->saved, rec, folded);
+    log->saving = remark(log->saving, rec, folded);
+}
+
+/* forget the oldest history: a branch off base other than the one the *
+ * buffer is on or, once that's the only one, its first record (which *
+ * becomes part of base) */
+static void dropOldest(struct undoLog *log) {
+    struct undoRecord *path = log->cur;
+    while (path && path->parent) {
+        path = path->parent;
+    }
+    struct undoRecord **oldest = NULL;
+    for (struct undoRecord **l = &log->child; *l; l = &(*l)->sibling) {
+        if (*l != path) {
+            oldest = l;
+        }
+    }
+
+    if (oldest) {
+        struct undoRecord *drop = *oldest;
+        *oldest = drop->sibling;
+        if (log->redo == drop) {
+            log->redo = log->child;
+        }
+        for (struct undoRecord *r = drop; r; r = nextRecord(r, drop)) {
+            log->live -= recordSize(r);
+            unmark(log, r, false);
+        }
+        return;
+    }
+    log->child = path->child;
+    log->redo = path->redo;
+    for (struct undoRecord *r = path->child; r; r = r->sibling) {
+        r->parent = NULL;
+    }
+    if (log->cur == path) {
+        log->cur = NULL;
+    }
+    unmark(log, path, true);
+    log->live -= recordSize(path);
+}
+
+static struct undoRecord *moved(struct undoRecord *rec) {
+    return rec ? rec->fwd : NULL;
+}
+
+// copy the records still reachable into fresh chunks, freeing the old ones
+static void compact(struct undoLog *log) {
+    struct undoChunk *old = log->chunk;
+    log->chunk = NULL;
+    log->bytes = 0;
+    for (struct undoRecord *r = log->child; r; r = nextRecord(r, NULL)) {
+        size_t size = sizeof(struct undoRecord) + r->len;
+        r->fwd = arenaAlloc(log, size, 0);
+        memcpy(r->fwd, r, size);
+    }
+    for (struct undoRecord *r = log->child; r; r = nextRecord(r, NULL)) {
+        struct undoRecord *to = r->fwd;
+        to->parent = moved(r->parent);
+        to->child = moved(r->child);
+        to->sibling = moved(r->sibling);
+        to->redo = moved(r->redo);
+    }
+    log->cur = moved(log->cur);
+    log->child = moved(log->child);
+    log->redo = moved(log->redo);
+    while (old) {
+        struct undoChunk *c = old;
+        old = c->prev;
+        free(c);
+    }
+}
+
+// drop the oldest history until the live records fit the budget
+static void trimHistory(struct undoLog *log) {
+    if (log->live <= log->budget)
+        return;
+    // go well under, so this doesn't run again on the next keystroke
+    size_t goal = log->budget / 4 * 3;
+    while (log->live > goal && log->child) {
+        dropOldest(log);
+    }
+    log->newest = NULL;
+    compact(log);
+}
+
+void setUndoBudget(struct undoLog *log, size_t budget) {
+    if (log->journal) {
+        journalEvent(log->journal, J_BUDGET, budget);
+    }
+    log->budget = budget;
+    trimHistory(log);
+}
+
+/* ======= RECORDING ======= */
+void initUndo(struct undoLog *log) {
+    memset(log, 0, sizeof(struct undoLog));
+    log->budget = UNDO_BUDGET;
+}
+
+/* fold a one-row ADD or DELETE into the newest record if it carries on *
+ * where that left off. a word starts a new record, so undo goes back a *
+ * word at a time: no record has a space followed by a non-space */
+static bool mergeCommand(struct undoLog *log, struct command *cmd) {
+    struct undoRecord *top = log->newest;
+    if (top == NULL || top != log->cur || log->sealed ||
+        top->type != cmd->type || (cmd->type != ADD && cmd->type != DELETE) ||
+        top->numrows != 1 || cmd->numrows != 1 || top->at.r != cmd->at.r ||
+        top->len == 0)
+        return false;
+    struct erow *row = cmd->rows[0];
+    if (row->len == 0)
+        return true; // nothing to undo
+
+    bool append = cmd->at.c == top->at.c + (cmd->type == ADD ? top->len : 0);
+    bool prepend = cmd->type == DELETE && cmd->at.c + row->len == top->at.c;
+    if (append) {
+        if (isspace((unsigned char)top->text[top->len - 1]) &&
+            !isspace((unsigned char)row->text[0]))
+            return false;
+    } else if (prepend) {
+        if (isspace((unsigned char)row->text[row->len - 1]) &&
+            !isspace((unsigned char)top->text[0]))
+            return false;
+    } else {
+        return false;
+    }
+
+    top = growNewest(log, row->len);
+    if (prepend) {
+        memmove(top->text + row->len, top->text, top->len);
+        memcpy(top->text, row->text, row->len);
+        top->at.c = cmd->at.c;
+    } else {
+        memcpy(top->text + top->len, row->text, row->len);
+    }
+    top->len += row->len;
+    return true;
+}
+
+/* note a command that was just done, so it can be undone. it becomes the *
+ * newest branch off the state it was done in */
+void recordCommand(struct undoLog *log, struct command *cmd) {
+    if (log->journal) {
+        journalCommand(log->journal, cmd);
+    }
+    if (mergeCommand(log, cmd)) {
+        trimHistory(log);
+        return;
+    }
+    bool hasRows = cmd->type == ADD || cmd->type == DELETE;
+    int numrows = hasRows ? cmd->numrows : 0;
+    int len = max(numrows - 1, 0); // the '\n's
+    for (int i = 0; i < numrows; i++) {
+        len += cmd->rows[i]->len;
+    }
+
+    struct undoRecord *rec =
+        arenaAlloc(log, sizeof(struct undoRecord) + len, 0);
+    rec->parent = log->cur;
+    rec->child = NULL;
+    rec->sibling = *childLink(log, log->cur);
+    rec->redo = NULL;
+    rec->fwd = NULL;
+    rec->seq = ++log->seq;
+    rec->type = cmd->type;
+    rec->at = cmd->at;
+    rec->numrows = numrows;
+    rec->len = len;
+    char *p = rec->text;
+    for (int i = 0; i < numrows; i++) {
+        if (i > 0) {
+            *p++ = '\n';
+        }
+        memcpy(p, cmd->rows[i]->text, cmd->rows[i]->len);
+        p += cmd->rows[i]->len;
+    }
+    *childLink(log, log->cur) = rec;
+    *redoLink(log, log->cur) = rec;
+    log->cur = log->newest = rec;
+    log->sealed = false;
+    log->live += recordSize(rec);
+    trimHistory(log);
+}
+
+// end the current run, the next command gets a record of its own
+void sealUndo(struct undoLog *log) {
+    if (!log->sealed && log->journal) {
+        journalEvent(log->journal, J_SEAL, 0);
+    }
+    log->sealed = true;
+}
+
+/* ======= UNDOING ======= */
+// do (or undo) rec's command again, with rows borrowing its text
+static void applyRecord(struct editor *E, struct undoRecord *rec,
+                        bool undo) {
+    int numrows = max(rec->numrows, 1);
+    struct erow *rows = malloc(numrows * sizeof(struct erow));
+    struct erow **ptrs = malloc(numrows * sizeof(struct erow *));
+    char *p = rec->text;
+    char *end = rec->text + rec->len;
+    for (int i = 0; i < numrows; i++) {
+        char *nl = memchr(p, '\n', end - p);
+        char *eol = nl && i < numrows - 1 ? nl : end;
+        rows[i].len = eol - p;
+        rows[i].cap = 0;
+        rows[i].text = p;
+        ptrs[i] = &rows[i];
+        p = eol + 1;
+    }
+    struct command cmd = {rec->at, ptrs, rec->numrows, rec->type};
+    if (undo) {
+        undoCommand(E, &cmd);
+    } else {
+        doCommand(E, &cmd);
+    }
+    free(rows);
+    free(ptrs);
+}
+
+static bool stepBack(struct undoLog *log, struct editor *E, point *cursor) {
+    struct undoRecord *rec = log->cur;
+    if (rec == NULL)
+        return false;
+    applyRecord(E, rec, true);
+    *cursor = rec->at;
+    if (rec->type == DELROW) {
+        cursor->c = 0;
+    }
+    *redoLink(log, rec->parent) = rec;
+    log->cur = rec->parent;
+    log->sealed = true;
+    return true;
+}
+
+static bool stepForward(struct undoLog *log, struct editor *E,
+                        point *cursor) {
+    struct undoRecord *rec = *redoLink(log, log->cur);
+    if (rec == NULL)
+        return false;
+    applyRecord(E, rec, false);
+    *cursor = rec->at;
+    if (rec->type == NEWROW) {
+        cursor->r++;
+        cursor->c = 0;
+    } else if (rec->type == DELROW) {
+        cursor->r--;
+        cursor->c = getRow(E, cursor->r)->len - rec->at.c;
+    }
+    log->cur = rec;
+    log->sealed = true;
+    return true;
+}
+
+/* undo the record the buffer is at, setting *cursor to where it happened. *
+ * false if there was nothing to undo */
+bool undoLast(struct undoLog *log, struct editor *E, point *cursor) {
+    if (log->cur && log->journal) {
+        journalEvent(log->journal, J_UNDO, 0);
+    }
+    return stepBack(log, E, cursor);
+}
+
+// redo the branch last undone (or made) from here
+bool redoNext(struct undoLog *log, struct editor *E, point *cursor) {
+    if (*redoLink(log, log->cur) && log->journal) {
+        journalEvent(log->journal, J_REDO, 0);
+    }
+    return stepForward(log, E, cursor);
+}
+
+// undo back to where target branches off, then redo down to it
+static void travel(struct undoLog *log, struct editor *E, point *cursor,
+                   struct undoRecord *target) {
+    struct undoRecord *fork = commonAncestor(log->cur, target);
+    while (log->cur != fork) {
+        stepBack(log, E, cursor);
+    }
+    for (struct undoRecord *r = target; r != fork; r = r->parent) {
+        *redoLink(log, r->parent) = r;
+    }
+    while (log->cur != target) {
+        stepForward(log, E, cursor);
+    }
+}
+
+/* go to the state just before (or after) the current one in time, across *
+ * branches, like vim's g- and g+. false if there is none */
+bool undoTime(struct undoLog *log, struct editor *E, point *cursor,
+              bool backward) {
+    long now = log->cur ? log->cur->seq : 0;
+    struct undoRecord *target = NULL;
+    for (struct undoRecord *r = log->child; r; r = nextRecord(r, NULL)) {
+        if (backward ? r->seq < now && (!target || r->seq > target->seq)
+                     : r->seq > now && (!target || r->seq < target->seq)) {
+            target = r;
+        }
+    }
+    if (target == NULL && (!backward || log->cur == NULL))
+        return false;
+    if (log->journal) {
+        journalEvent(log->journal, backward ? J_BACK : J_FORWARD, 0);
+    }
+    travel(log, E, cursor, target);
+    return true;
+}
+
+// go to the state after the record numbered seq (0 for base)
+bool undoTo(struct undoLog *log, struct editor *E, point *cursor, long seq) {
+    struct undoRecord *target = NULL;
+    for (struct undoRecord *r = log->child; r && seq; r = nextRecord(r, NULL)) {
+        if (r->seq == seq) {
+            target = r;
+            break;
+        }
+    }
+    if (target == NULL && seq != 0)
+        return false;
+    if (log->journal) {
+        journalEvent(log->journal, J_GOTO, seq);
+    }
+    travel(log, E, cursor, target);
+    return true;
+}
+
+// the state the buffer is in, as the record it's after (0 for base)
+long undoVersion(struct undoLog *log) {
+    return log->cur ? log->cur->seq : 0;
+}
+
+/* ======= PERSISTING ======= */
+// the record after rec (the first if NULL) in a walk of the whole tree
+struct undoRecord *nextUndoRecord(struct undoLog *log, struct undoRecord *rec) {
+    return rec ? nextRecord(rec, NULL) : log->child;
+}
+
+/* put back a record read from a journal. records come in the order *
+ * nextUndoRecord gives them, so parent is always the last one restored *
+ * or one of its ancestors */
+void restoreRecord(struct undoLog *log, long parent, long seq, bool redo,
+                   cmdType type, point at, int numrows, const char *text,
+                   int len) {
+    struct undoRecord *up = log->newest;
+    while (up && up->seq != parent) {
+        up = up->parent;
+    }
+    struct undoRecord *rec =
+        arenaAlloc(log, sizeof(struct undoRecord) + len, 0);
+    rec->parent = up;
+    rec->child = NULL;
+    rec->sibling = NULL;
+    rec->redo = NULL;
+    rec->fwd = NULL;
+    rec->seq = seq;
+    rec->type = type;
+    rec->at = at;
+    rec->numrows = numrows;
+    rec->len = len;
+    memcpy(rec->text, text, len);
+
+    // newer branches came first, this one goes last
+    struct undoRecord **link = childLink(log, up);
+    while (*link) {
+        link = &(*link)->sibling;
+    }
+    *link = rec;
+    if (redo) {
+        *redoLink(log, up) = rec;
+    }
+    log->newest = rec;
+    log->seq = seq > log->seq ? seq : log->seq;
+    log->live += recordSize(rec);
+}
+
+/* after restoring the records, the one the buffer (and the file it was *
+ * saved to) is at, 0 for base */
+void restoreCurrent(struct undoLog *log, long seq) {
+    log->cur = NULL;
+    log->saved = seq;
+    for (struct undoRecord *r = log->child; r && seq; r = nextRecord(r, NULL)) {
+        if (r->seq == seq) {
+            log->cur = r;
+            break;
+        }
+    }
+    log->newest = NULL;
+    log->sealed = true;
+}
+
+void freeUndo(struct undoLog *log) {
+    while (log->chunk) {
+        struct undoChunk *c = log->chunk;
+        log->chunk = c->prev;
+        free(c);
+    }
+    initUndo(log);
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "command.h"
+
+struct journal;
+
+// bytes per arena chunk, records bigger than this get a chunk of their own
+#define UNDO_CHUNK (64 << 10)
+// history kept by default, see undoLog.budget
+#define UNDO_BUDGET (64 << 20)
+
+/* one undoable command. the text of its rows follows the header, joined *
+ * by '\n'. runs of typing or deleting in a row grow the latest record *
+ * instead of adding new ones, so a typed word costs a byte per character. *
+ * records form a tree: undoing and then doing something else starts a new *
+ * branch, the old one is kept and can be gone back to */
+struct undoRecord {
+    struct undoRecord *parent; // the state this was done in, NULL for base
+    struct undoRecord *child; // newest branch off this state
+    struct undoRecord *sibling; // next older branch off parent's state
+    struct undoRecord *redo; // the child redo goes to
+    struct undoRecord *fwd; // new home while compacting
+    long seq; // when it was done, counting from 1
+    cmdType type;
+    point at;
+    int numrows;
+    int len; // bytes of text
+    char text[];
+};
+
+struct undoChunk {
+    struct undoChunk *prev;
+    size_t used;
+    size_t cap;
+    char data[];
+};
+
+/* the commands done so far, packed into chunks (an arena). once the live *
+ * records outgrow the budget the oldest history is dropped and the rest *
+ * copied into fresh chunks */
+struct undoLog {
+    struct undoChunk *chunk; // newest chunk
+    struct undoRecord *cur; // the record the buffer is at, NULL for base
+    struct undoRecord *child; // newest branch off the base state
+    struct undoRecord *redo; // the branch redo takes from base
+    struct undoRecord *newest; // the last record made, while it can grow
+    bool sealed; // newest takes no more merging
+    long seq; // of the last record made
+    size_t live; // bytes of records still reachable
+    size_t bytes; // allocated for chunks
+    size_t budget; // most live bytes kept
+    struct journal *journal; // where changes to the log are copied, or NULL
+    long saved; // record the file on disk matches, 0 for base, -1 if gone
+    long saving; // the same for a save still being written
+};
+
+void initUndo(struct undoLog *log);
+void recordCommand(struct undoLog *log, struct command *cmd);
+void sealUndo(struct undoLog *log);
+bool undoLast(struct undoLog *log, struct editor *E, point *cursor);
+bool redoNext(struct undoLog *log, struct editor *E, point *cursor);
+bool undoTime(struct undoLog *log, struct editor *E, point *cursor,
+              bool backward);
+bool undoTo(struct undoLog *log, struct editor *E, point *cursor, long seq);
+long undoVersion(struct undoLog *log);
+void setUndoBudget(struct undoLog *log, size_t budget);
+void freeUndo(struct undoLog *log);
+
+struct undoRecord *nextUndoRecord(struct undoLog *log, struct undoRecord *rec);
+void restoreRecord(struct undoLog *log, long parent, long seq, bool redo,
+                   cmdType type, point at, int numrows, const char *text,
+                   int len);
+void restoreCurrent(struct undoLog *log, long seq);
@@ -0,0 +1,209 @@
+#include "watch.h"
+
+#include <fcntl.h>
+#include <libgen.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#else
+#include <sys/event.h>
+#include <sys/time.h>
+#ifndef O_EVTONLY // just for events, doesn't keep the volume from unmounting
+#define O_EVTONLY O_RDONLY
+#endif
+#endif
+
+/* ======= STAMPS ======= */
+static void fromStat(struct stat *st, bool ok, struct fileStamp *stamp) {
+    memset(stamp, 0, sizeof(*stamp));
+    if (!ok)
+        return;
+    stamp->exists = true;
+    stamp->dev = st->st_dev;
+    stamp->ino = st->st_ino;
+    stamp->size = st->st_size;
+    stamp->mtime = st->st_mtime;
+#ifdef __APPLE__
+    stamp->mtimeNsec = st->st_mtimespec.tv_nsec;
+#else
+    stamp->mtimeNsec = st->st_mtim.tv_nsec;
+#endif
+}
+
+void stampFile(char *filename, struct fileStamp *stamp) {
+    struct stat st;
+    fromStat(&st, stat(filename, &st) == 0, stamp);
+}
+
+// the same for an open file
+void stampFd(int fd, struct fileStamp *stamp) {
+    struct stat st;
+    fromStat(&st, fstat(fd, &st) == 0, stamp);
+}
+
+bool sameStamp(struct fileStamp *a, struct fileStamp *b) {
+    return a->exists == b->exists && a->dev == b->dev && a->ino == b->ino &&
+           a->size == b->size && a->mtime == b->mtime &&
+           a->mtimeNsec == b->mtimeNsec;
+}
+
+/* ======= WATCHING ======= */
+struct watch {
+    int fd; // readable once something happened
+    char *path; // symlinks resolved, if the file's there yet
+#ifdef __linux__
+    char *name; // the file's name in its directory
+#else
+    int file; // -1 while there's no file to watch
+    int dir;
+#endif
+};
+
+// the file's path with symlinks resolved, so their target is what's watched
+static char *resolve(char *filename) {
+    char *path = realpath(filename, NULL);
+    return path ? path : strdup(filename);
+}
+
+#ifdef __linux__
+// events on the directory, filtered down to the file's name
+#define DIR_EVENTS                                                            \
+    (IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_CREATE | IN_DELETE |        \
+     IN_MOVED_FROM | IN_MOVED_TO)
+
+// NULL if it can't be watched
+struct watch *watchFile(char *filename) {
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd == -1)
+        return NULL;
+    struct watch *w = calloc(1, sizeof(struct watch));
+    w->fd = fd;
+    w->path = resolve(filename);
+    char *dir = strdup(w->path);
+    char *base = strdup(w->path);
+    w->name = strdup(basename(base));
+    bool ok = inotify_add_watch(fd, dirname(dir), DIR_EVENTS) != -1;
+    free(dir);
+    free(base);
+    if (!ok) {
+        closeWatch(w);
+        return NULL;
+    }
+    return w;
+}
+
+// whether the file changed since this was last asked, without waiting
+bool watchFired(struct watch *w) {
+    char buf[4096]
+        __attribute__((aligned(__alignof__(struct inotify_event))));
+    bool fired = false;
+    ssize_t n;
+    while ((n = read(w->fd, buf, sizeof(buf))) > 0) {
+        for (char *p = buf; p < buf + n;) {
+            struct inotify_event *ev = (struct inotify_event *)p;
+            if (ev->mask & IN_Q_OVERFLOW ||
+                (ev->len > 0 && !strcmp(ev->name, w->name))) {
+                fired = true;
+            }
+            p += sizeof(struct inotify_event) + ev->len;
+        }
+    }
+    return fired;
+}
+
+void closeWatch(struct watch *w) {
+    if (w == NULL)
+        return;
+    close(w->fd);
+    free(w->path);
+    free(w->name);
+    free(w);
+}
+#else
+// -1 if path isn't there
+static int addVnode(int kq, char *path, unsigned flags) {
+    int fd = open(path, O_EVTONLY | O_CLOEXEC);
+    if (fd == -1)
+        return -1;
+    struct kevent ev;
+    EV_SET(&ev, fd, EVFILT_VNODE, EV_ADD | EV_CLEAR, flags, 0, NULL);
+    if (kevent(kq, &ev, 1, NULL, 0, NULL) == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+#define FILE_EVENTS                                                           \
+    (NOTE_WRITE | NOTE_EXTEND | NOTE_ATTRIB | NOTE_DELETE | NOTE_RENAME)
+
+// NULL if it can't be watched
+struct watch *watchFile(char *filename) {
+    int kq = kqueue();
+    if (kq == -1)
+        return NULL;
+    fcntl(kq, F_SETFD, FD_CLOEXEC);
+    struct watch *w = calloc(1, sizeof(struct watch));
+    w->fd = kq;
+    w->path = resolve(filename);
+    char *dir = strdup(w->path);
+    w->dir = addVnode(kq, dirname(dir), NOTE_WRITE);
+    free(dir);
+    w->file = addVnode(kq, w->path, FILE_EVENTS);
+    if (w->dir == -1) {
+        closeWatch(w);
+        return NULL;
+    }
+    return w;
+}
+
+/* whether the file changed since this was last asked, without waiting. *
+ * the directory changing is taken as the file maybe having changed, it's *
+ * for the caller to tell. a file that's been deleted or renamed away is *
+ * let go of, and whatever has its name is watched from then on */
+bool watchFired(struct watch *w) {
+    struct kevent evs[16];
+    struct timespec zero = {0, 0};
+    bool fired = false;
+    bool replaced = false;
+    int n;
+    while ((n = kevent(w->fd, NULL, 0, evs, 16, &zero)) > 0) {
+        for (int i = 0; i < n; i++) {
+            fired = true;
+            if ((int)evs[i].ident == w->file &&
+                evs[i].fflags & (NOTE_DELETE | NOTE_RENAME)) {
+                replaced = true;
+            }
+        }
+    }
+    if (replaced && w->file != -1) {
+        close(w->file); // closing it takes it out of the kqueue
+        w->file = -1;
+    }
+    if (w->file == -1 && fired) {
+        w->file = addVnode(w->fd, w->path, FILE_EVENTS);
+    }
+    return fired;
+}
+
+void closeWatch(struct watch *w) {
+    if (w == NULL)
+        return;
+    if (w->file != -1) {
+        close(w->file);
+    }
+    if (w->dir != -1) {
+        close(w->dir);
+    }
+    close(w->fd);
+    free(w->path);
+    free(w);
+}
+#endif
+
+// for poll: readable when watchFired has something to say
+int watchFd(struct watch *w) { return w->fd; }
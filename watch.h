@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdbool.h>
+
+// how a file on disk last looked, to tell when something else changes it
+struct fileStamp {
+    bool exists;
+    long long dev;
+    long long ino;
+    long long size;
+    long long mtime;
+    long long mtimeNsec;
+};
+
+void stampFile(char *filename, struct fileStamp *stamp);
+void stampFd(int fd, struct fileStamp *stamp);
+bool sameStamp(struct fileStamp *a, struct fileStamp *b);
+
+/* says when a file may have changed on disk: written to, replaced by a *
+ * rename, deleted or created. inotify on linux, kqueue elsewhere. the *
+ * directory is watched along with the file, since editors and build tools *
+ * mostly write a new file and rename it over the old one */
+struct watch;
+
+struct watch *watchFile(char *filename);
+int watchFd(struct watch *w);
+bool watchFired(struct watch *w);
+void closeWatch(struct watch *w);
@@ -0,0 +1,191 @@
+#include "wrap.h"
+#include "layout.h"
+#include "pool.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define UNUSED(x) (void)(x)
+// stale rows worth spreading over the pool rather than doing here
+#define WRAP_PARALLEL (4 * ROWBLOCK_MAX)
+
+/* ======= ROWS ======= */
+// screen line (of the row's own) that the glyph holding byte c ends up on
+int sublineOf(struct erow *row, int c, int width) {
+    c = min(c, row->len - 1);
+    if (c < 0)
+        return 0;
+    int plain = 0; // printable ASCII, every column is a byte
+    while (plain <= c && (unsigned char)(row->text[plain] - ' ') < 0x5f) {
+        plain++;
+    }
+    if (plain > c) {
+        return width > 1 ? c / (width - 1) : c + 1;
+    }
+    int line = 0;
+    int visual_c = 0;
+    for (int i = 0; i <= c;) {
+        int cwidth;
+        bool shown;
+        i += glyphLen(row->text + i, row->len - i, visual_c, &cwidth, &shown);
+        if (visual_c + cwidth >= width) { // new subline
+            line++;
+            visual_c = 0;
+        }
+        visual_c += cwidth;
+    }
+    return line;
+}
+
+int rowHeight(struct erow *row, int width) {
+    return sublineOf(row, row->len - 1, width) + 1;
+}
+
+/* ======= BLOCKS ======= */
+struct staleBlocks {
+    struct rowblock **blocks; // starts out as local, heap once that's full
+    struct rowblock *local[16];
+    int numblocks;
+    int capblocks;
+    int width;
+};
+
+static void collectStale(struct rowblock *b, struct staleBlocks *s) {
+    if (b == NULL || !b->stale)
+        return;
+    collectStale(b->left, s);
+    if (b->height < 0) {
+        if (s->numblocks == s->capblocks) {
+            s->capblocks *= 2;
+            struct rowblock **blocks =
+                malloc(s->capblocks * sizeof(struct rowblock *));
+            memcpy(blocks, s->blocks, s->numblocks * sizeof(struct rowblock *));
+            if (s->blocks != s->local) {
+                free(s->blocks);
+            }
+            s->blocks = blocks;
+        }
+        s->blocks[s->numblocks++] = b;
+    }
+    collectStale(b->right, s);
+}
+
+/* work out the height of one block, peeked so it can run on the pool. *
+ * only rows that were edited since they were last measured are looked at */
+static void measureBlock(void *arg, int i) {
+    struct staleBlocks *s = arg;
+    struct rowblock *b = s->blocks[i];
+    if (b->heights == NULL) {
+        b->heights = malloc(ROWBLOCK_MAX * sizeof(int));
+        forgetHeights(b, 0, ROWBLOCK_MAX);
+    }
+    struct erow scratch[ROWBLOCK_MAX];
+    struct erow *rows = NULL;
+    int height = 0;
+    for (int r = 0; r < b->numrows; r++) {
+        if (b->heights[r] < 0) {
+            rows = rows ? rows : peekBlock(b, scratch);
+            b->heights[r] = rowHeight(&rows[r], s->width);
+        }
+        height += b->heights[r];
+    }
+    b->height = height;
+}
+
+// bring every stale block's height up to date
+static void fixHeights(struct editor *E) {
+    if (E->root == NULL || !E->root->stale)
+        return;
+    // an edit stales a block or two, so most of the time nothing's allocated
+    struct staleBlocks s;
+    s.blocks = s.local;
+    s.numblocks = 0;
+    s.capblocks = sizeof(s.local) / sizeof(s.local[0]);
+    s.width = E->wrapwidth;
+    collectStale(E->root, &s);
+    if (s.numblocks * ROWBLOCK_FILL >= WRAP_PARALLEL) {
+        poolRun(measureBlock, &s, s.numblocks);
+    } else {
+        for (int i = 0; i < s.numblocks; i++) {
+            measureBlock(&s, i);
+        }
+    }
+    refreshHeights(E->root);
+    if (s.blocks != s.local) {
+        free(s.blocks);
+    }
+}
+
+/* ======= LINES ======= */
+// keep heights for this width from now on
+void setWrapWidth(struct editor *E, int width) {
+    width = max(width, 1); // narrower wraps the same way
+    if (E->wrapwidth == width)
+        return;
+    if (E->wrapwidth == 0) {
+        addListener(E, wrapEdited, E);
+    }
+    E->wrapwidth = width;
+    staleTree(E->root);
+    for (struct rowblock *b = firstBlock(E->root); b; b = nextBlock(b)) {
+        forgetHeights(b, 0, b->numrows);
+    }
+}
+
+// first screen line of row, counted from the top of the buffer
+int lineOfRow(struct editor *E, int row) {
+    fixHeights(E);
+    int idx = row;
+    struct rowblock *b = findBlock(E->root, &idx);
+    if (b == NULL)
+        return 0;
+    int line = linesBefore(b);
+    for (int i = 0; i < idx; i++) {
+        line += b->heights[i];
+    }
+    return line;
+}
+
+/* the row on screen line line, *sub becomes the line inside the row. *
+ * lines past the end give the last row */
+int rowOfLine(struct editor *E, int line, int *sub) {
+    fixHeights(E);
+    int idx = max(line, 0);
+    struct rowblock *b = findLine(E->root, &idx);
+    *sub = 0;
+    if (b == NULL)
+        return 0;
+    int i;
+    for (i = 0; i < b->numrows - 1 && idx >= b->heights[i]; i++) {
+        idx -= b->heights[i];
+    }
+    *sub = min(idx, b->heights[i] - 1);
+    return rowsBefore(b) + i;
+}
+
+/* the height of a row at a width, as its layout (layout.h) found it, so it *
+ * isn't measured again. ignored if the heights are for another width */
+void setRowHeight(struct editor *E, int row, int width, int height) {
+    if (max(width, 1) != E->wrapwidth)
+        return;
+    int idx = row;
+    struct rowblock *b = findBlock(E->root, &idx);
+    if (b && b->heights && idx < b->numrows && b->heights[idx] < 0) {
+        b->heights[idx] = height; // its block is stale already
+    }
+}
+
+/* edit listener: the new rows need measuring again, the rest keep their *
+ * heights wherever they moved to */
+void wrapEdited(void *arg, int row, int oldrows, int newrows) {
+    UNUSED(oldrows);
+    struct editor *E = arg;
+    int idx = row;
+    struct rowblock *b = findBlock(E->root, &idx);
+    for (int r = row; b && r < row + newrows; b = nextBlock(b), idx = 0) {
+        int n = min(b->numrows - idx, row + newrows - r);
+        forgetHeights(b, idx, n);
+        staleBlock(b);
+        r += n;
+    }
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "editor.h"
+
+// tabs advance to the next multiple of this
+#define TAB_WIDTH 4
+
+/* rows wrapped to a width, the way printEditorContents lays them out: a *
+ * screen line holds whatever fits in width - 1 columns. every row block *
+ * caches its rows' heights and their total (see rowtree.h), so once the *
+ * rows an edit touched are measured, mapping rows to lines and back is *
+ * O(log n) plus a walk over one block's heights */
+int sublineOf(struct erow *row, int c, int width);
+int rowHeight(struct erow *row, int width);
+
+void setWrapWidth(struct editor *E, int width);
+int lineOfRow(struct editor *E, int row);
+int rowOfLine(struct editor *E, int line, int *sub);
+void setRowHeight(struct editor *E, int row, int width, int height);
+void wrapEdited(void *arg, int row, int oldrows, int newrows);